@@ -0,0 +1,16 @@
+#ifndef INC_ARBITER_H_
+#define INC_ARBITER_H_
+
+#include "main.h"
+
+#define ARBITER_MAX_DEFER_TIME 50 // milliseconds, non-urgent work is started anyway after this
+
+typedef enum
+{
+  ARBITER_SD = 0,
+  ARBITER_OLED
+} ARBITER_CLIENT;
+
+void arbiter_wait(ARBITER_CLIENT client);
+
+#endif /* INC_ARBITER_H_ */
@@ -0,0 +1,70 @@
+#ifndef INC_BLOCKSTORE_H_
+#define INC_BLOCKSTORE_H_
+
+#include "main.h"
+#include "ff.h"
+#include "fdsemu.h"
+
+// comment it to disable deduplicated image storage
+#define BLOCK_STORE
+
+// manifest ".fdm" lists blocks of every side, block data is stored once in the shared pack file:
+// pack is append-only, its records are [hash 4][size 2][data], data is block without CRC,
+// index is open addressing hash table of the pack records, it's used only to find duplicates,
+// there is no garbage collection: blocks no longer referenced by any manifest stay in the pack
+#define BLOCK_STORE_DIR "fdskey.bs"
+#define BLOCK_STORE_PACK_FILE BLOCK_STORE_DIR "\\blocks.dat"
+#define BLOCK_STORE_INDEX_FILE BLOCK_STORE_DIR "\\index.dat"
+// updated manifest is written here first, followed by the path of the manifest it replaces
+#define BLOCK_STORE_TEMP_FILE BLOCK_STORE_DIR "\\manifest.tmp"
+#define BLOCK_STORE_INDEX_SLOTS 16384 // must be power of two, 128KB index file
+#define BLOCK_STORE_MAX_PROBES 64 // block is appended without index entry if there is no free slot
+#define BLOCK_STORE_PACK_MAGIC 0x4B504246 // "FBPK"
+#define BLOCK_STORE_MANIFEST_MAGIC 0x314D4446 // "FDM1"
+#define BLOCK_STORE_MANIFEST_EXT ".fdm"
+#define BLOCK_STORE_MAX_SIDES 16
+#define BLOCK_STORE_COMPARE_BUFFER 256
+#define BLOCK_STORE_COPY_BUFFER 256
+
+typedef struct __attribute__((packed))
+{
+  uint32_t hash;
+  uint32_t offset; // offset of data in the pack file, 0 for the empty slot
+} BLOCK_STORE_SLOT;
+
+typedef struct __attribute__((packed))
+{
+  uint32_t offset;
+  uint16_t size;
+} BLOCK_STORE_REF;
+
+typedef struct __attribute__((packed))
+{
+  uint32_t magic;
+  uint8_t side_count;
+} BLOCK_STORE_MANIFEST_HEADER;
+
+typedef struct __attribute__((packed))
+{
+  uint16_t block_count;
+  BLOCK_STORE_REF blocks[FDS_MAX_BLOCKS];
+} BLOCK_STORE_SIDE;
+
+typedef struct
+{
+  FIL pack;
+  FIL index;
+} BLOCK_STORE_FILES;
+
+uint8_t block_store_is_manifest(char *filename);
+FRESULT block_store_get_side_count(char *path, uint8_t *side_count);
+FRESULT block_store_read_side(char *path, uint8_t side, BLOCK_STORE_SIDE *side_data);
+FRESULT block_store_write_side(char *path, uint8_t side, BLOCK_STORE_SIDE *side_data);
+FRESULT block_store_open(BLOCK_STORE_FILES *store);
+FRESULT block_store_put(BLOCK_STORE_FILES *store, uint8_t *data, uint16_t size, BLOCK_STORE_REF *ref);
+FRESULT block_store_close(BLOCK_STORE_FILES *store);
+FRESULT block_store_open_pack(FIL *fp);
+FRESULT block_store_convert(char *path, char *manifest_path);
+FRESULT block_store_recover();
+
+#endif /* INC_BLOCKSTORE_H_ */
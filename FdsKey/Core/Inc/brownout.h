@@ -0,0 +1,21 @@
+#ifndef INC_BROWNOUT_H_
+#define INC_BROWNOUT_H_
+
+#include "main.h"
+
+// there is no PVD in STM32G0B0, so supply voltage is monitored
+// using ADC analog watchdog on the internal reference voltage channel
+#define BROWNOUT_VREFINT_CHANNEL 13
+#define BROWNOUT_VREFINT_CAL (*((uint16_t*)0x1FFF75AAUL)) // factory calibration value
+#define BROWNOUT_VREFINT_CAL_MV 3000                        // VDDA during calibration
+#define BROWNOUT_THRESHOLD_MV 3100    // supply voltage is 3.3V, power failure below this value
+#define BROWNOUT_HYSTERESIS_MV 100    // power is back above threshold + hysteresis
+#define BROWNOUT_CONFIRM_SAMPLES 8    // consecutive low conversions before power failure, ~6us each
+#define BROWNOUT_RECOVERY_TIME 500    // power must be good for this time to restart, milliseconds
+
+void brownout_init();
+void brownout_irq_handler();
+uint8_t brownout_is_low();
+void brownout_wait_recovery();
+
+#endif /* INC_BROWNOUT_H_ */
@@ -11,6 +11,11 @@
 
 #define BROWSER_USE_RUSSIAN
 
+// keep the last listing while its directory generation is the same,
+// side memory is allocated from the same heap, so only small listings are kept
+#define BROWSER_USE_CACHE
+#define BROWSER_CACHE_MAX_ITEMS 128
+
 typedef enum {
   BROWSER_BACK,
   BROWSER_BACK_LONGPRESS,
@@ -27,5 +32,6 @@ typedef struct {
 } DYN_FILINFO;
 
 BROWSER_RESULT browser_tree(char *directory, int dir_max_len, FILINFO *fno);
+void browser_free();
 
 #endif /* INC_BROWSER_H_ */
@@ -0,0 +1,41 @@
+#ifndef INC_CRASHDUMP_H_
+#define INC_CRASHDUMP_H_
+
+#include "main.h"
+#include "ff.h"
+#include "perf.h"
+
+#define CRASH_DUMP_FLASH_OFFSET (0x08080000 - FLASH_PAGE_SIZE * 5) // reserved one page
+#define CRASH_DUMP_MAGIC 0x48535243
+#define CRASH_DUMP_FILE "crash.txt"
+
+typedef struct
+{
+  uint32_t magic;
+  // registers stacked on exception entry
+  uint32_t r0;
+  uint32_t r1;
+  uint32_t r2;
+  uint32_t r3;
+  uint32_t r12;
+  uint32_t lr;
+  uint32_t pc;
+  uint32_t xpsr;
+  uint32_t sp;
+  uint32_t exc_return;
+  // there are no fault status registers on Cortex-M0+
+  uint32_t icsr;
+  uint32_t shcsr;
+  uint32_t tick;
+  // emulator state
+  uint32_t fds_state;
+  int32_t fds_head_position;
+  int32_t fds_used_space;
+  int32_t fds_block_count;
+  PERF_COUNTER perf[PERF_COUNTER_COUNT];
+} CRASH_DUMP;
+
+void crash_dump_save(uint32_t *frame, uint32_t exc_return);
+FRESULT crash_dump_export(uint8_t *found);
+
+#endif /* INC_CRASHDUMP_H_ */
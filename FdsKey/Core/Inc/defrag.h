@@ -0,0 +1,56 @@
+#ifndef INC_DEFRAG_H_
+#define INC_DEFRAG_H_
+
+#include "main.h"
+#include "ff.h"
+
+// comment it to disable idle time defragmentation
+#define DEFRAG_IDLE
+
+#define DEFRAG_STATE_FILE "fdskey.dfg"  // progress, it survives power cycles
+#define DEFRAG_TEMP_FILE "fdskey.tmp"   // contiguous copy before swap
+#define DEFRAG_STATE_MAGIC 0xDF4B
+#define DEFRAG_MAX_DEPTH 8
+#define DEFRAG_MAX_PATH_LENGTH 256
+#define DEFRAG_MAX_FRAGMENTS 16         // link map size, it's enough to count fragments
+#define DEFRAG_BUFFER_SIZE 4096
+#define DEFRAG_TIME_SLICE 50            // maximum directory scan time per defrag_step() call, milliseconds
+
+typedef enum __attribute__ ((__packed__))
+{
+  DEFRAG_PHASE_SCAN = 0,
+  DEFRAG_PHASE_COPIED       // temp file is complete, original can be replaced
+} DEFRAG_PHASE;
+
+typedef struct __attribute__((packed))
+{
+  uint8_t depth;
+  uint16_t index[DEFRAG_MAX_DEPTH];   // entries already read on every directory level
+  char dir[DEFRAG_MAX_PATH_LENGTH];
+} DEFRAG_CURSOR;
+
+typedef struct __attribute__((packed))
+{
+  uint16_t magic;
+  DEFRAG_PHASE phase;
+  uint32_t relocated;
+  DEFRAG_CURSOR cursor;
+  char file[DEFRAG_MAX_PATH_LENGTH];  // file being relocated
+  FSIZE_t fsize;                      // and its size and timestamp when it was copied
+  WORD fdate;
+  WORD ftime;
+} DEFRAG_STATE;
+
+typedef struct
+{
+  int images;
+  int fragmented;
+  int fragments;
+  uint32_t relocated;
+} DEFRAG_REPORT;
+
+FRESULT defrag_recover();
+FRESULT defrag_step();
+FRESULT defrag_report(DEFRAG_REPORT *report);
+
+#endif /* INC_DEFRAG_H_ */
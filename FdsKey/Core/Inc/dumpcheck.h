@@ -0,0 +1,30 @@
+#ifndef INC_DUMPCHECK_H_
+#define INC_DUMPCHECK_H_
+
+#include "main.h"
+#include "ff.h"
+
+// comment it to disable verification of the sides written by a disk copier
+#define DUMP_CHECK
+
+// known-good dumps, one side per line: <disk ID, 16 hex digits> <CRC32, 8 hex digits> [comment]
+// disk ID is bytes 0x0F-0x16 of the disk info block (manufacturer, game name, type, version, side, disk),
+// CRC32 is calculated over the data of all the blocks without gaps and CRCs, as they are stored in .fds
+#define DUMP_CHECK_FILE "fdsdumps.txt"
+#define DUMP_CHECK_ID_OFFSET 0x0F
+#define DUMP_CHECK_ID_SIZE 8
+#define DUMP_CHECK_MAX_LINE 64
+
+// ordered by priority, matching line wins over the other dumps of the same disk
+typedef enum
+{
+  DUMP_CHECK_NONE = 0,    // side was not written or there is no database
+  DUMP_CHECK_UNKNOWN,     // no such disk in the database
+  DUMP_CHECK_MISMATCH,    // disk is known but data differs
+  DUMP_CHECK_MATCH        // side matches known-good dump
+} DUMP_CHECK_RESULT;
+
+uint32_t dump_check_crc32(uint32_t crc, const uint8_t *data, uint32_t size);
+DUMP_CHECK_RESULT dump_check_lookup(const uint8_t *disk_id, uint32_t crc);
+
+#endif /* INC_DUMPCHECK_H_ */
@@ -21,6 +21,15 @@ typedef enum {
 	RES_PARERR		/* 4: Invalid Parameter */
 } DRESULT;
 
+/* SD card error recovery counters */
+typedef struct {
+	DWORD retries;		/* Transfer repeated */
+	DWORD reinits;		/* Card reinitialized at the same speed */
+	DWORD slowdowns;	/* Card reinitialized at lower speed */
+	DWORD failures;		/* Errors returned to FatFs */
+	BYTE last_error;	/* SD_RESULT of the last failure */
+} DISK_ERROR_STATS;
+
 
 /*---------------------------------------*/
 /* Prototypes for disk control functions */
@@ -31,6 +40,9 @@ DSTATUS disk_status (BYTE pdrv);
 DRESULT disk_read (BYTE pdrv, BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_write (BYTE pdrv, const BYTE* buff, LBA_t sector, UINT count);
 DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
+BYTE disk_is_busy (void);
+void disk_call_when_idle (void (*callback)(void));
+const DISK_ERROR_STATS* disk_get_error_stats (void);
 
 
 /* Disk Status Bits (DSTATUS) */
@@ -40,7 +40,7 @@
 /* This option switches fast seek function. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_EXPAND	0
+#define FF_USE_EXPAND	1
 /* This option switches f_expand function. (0:Disable or 1:Enable) */
 
 
@@ -277,6 +277,21 @@
 /      lock control is independent of re-entrancy. */
 
 
+#define FF_PATH_CACHE	16
+/* The option FF_PATH_CACHE defines how many resolved paths are remembered with the
+/  location of their directory entries. A cached path is opened by checking the
+/  single entry at the known location instead of searching each directory in the
+/  path. The cache is dropped when any directory entry is registered or removed.
+/  It requires FF_USE_LFN > 0.
+/
+/  0:  Disable path cache.
+/  >0: Number of cached paths. */
+
+#define FF_PATH_CACHE_LEN	128
+/* The option FF_PATH_CACHE_LEN defines the longest path in characters that can be
+/  cached. The whole path is stored and compared, longer paths are not cached. */
+
+
 #define FF_FS_REENTRANT	0
 #define FF_FS_TIMEOUT	1000
 /* The option FF_FS_REENTRANT switches the re-entrancy (thread safe) of the FatFs
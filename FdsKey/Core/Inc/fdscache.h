@@ -0,0 +1,35 @@
+#ifndef INC_FDSCACHE_H_
+#define INC_FDSCACHE_H_
+
+#include "main.h"
+#include "ff.h"
+#include "fdsemu.h"
+
+// comment it to disable the block CRC cache
+#define FDS_USE_CACHE
+
+#define FDS_CACHE_FILE "fdskey.cache"
+#define FDS_CACHE_ENTRIES 32
+#define FDS_CACHE_MAGIC 0xFDCA
+
+typedef struct __attribute__((packed))
+{
+  // key
+  uint16_t magic;
+  uint32_t path_hash;
+  FSIZE_t fsize;
+  WORD fdate;
+  WORD ftime;
+  uint8_t side;
+  // cached data
+  uint16_t block_count;
+  uint16_t crc[FDS_MAX_BLOCKS];
+} FDS_CACHE_ENTRY;
+
+uint32_t fds_cache_path_hash(char *path);
+void fds_cache_set_key(FDS_CACHE_ENTRY *entry, char *path, FILINFO *fno, uint8_t side);
+FRESULT fds_cache_find(FDS_CACHE_ENTRY *entry);
+FRESULT fds_cache_store(FDS_CACHE_ENTRY *entry);
+FRESULT fds_cache_invalidate(char *path);
+
+#endif /* INC_FDSCACHE_H_ */
@@ -10,11 +10,19 @@
 #define FDS_READ_PWM_TIMER htim3
 #define FDS_READ_PWM_TIMER_CHANNEL 1
 #define FDS_READ_DMA hdma_tim3_up
+#define FDS_READ_DMA_CHANNEL 1
 #define FDS_READ_IMPULSE_LENGTH 32
+#define FDS_READ_PERIOD_NORMAL 319   // must match timer settings
+#define FDS_READ_PERIOD_FAST 287     // +11%
+#define FDS_READ_PERIOD_FASTER 255   // +25%
+#define FDS_RATE_MAX_FAILURES 2      // fallback to normal transfer rate after this amount of read failures
+
+#define FDS_DEADLINE_TIMER htim1       // one-shot timer with 1ms tick for not-ready and autosave deadlines
 
 #define FDS_WRITE_CAPTURE_TIMER htim17
 #define FDS_WRITE_CAPTURE_TIMER_CHANNEL 1
 #define FDS_WRITE_DMA hdma_tim17_ch1
+#define FDS_WRITE_DMA_CHANNEL 2
 #define FDS_THRESHOLD_1 960
 #define FDS_THRESHOLD_2 1120
 
@@ -33,6 +41,14 @@
 #define FDS_NOT_READY_BYTES 1024      // fast rewind after this amount of bytes of used data
 #define FDS_MULTI_WRITE_UNLICENSED_BITS 32 // some unlicensed software can write multiple blocks at once
 #define FDS_AUTOSAVE_DELAY 1000
+#define FDS_BOUNDARY_GUARD_BYTES 64   // bus traffic is deferred this close to the block start, ~5ms
+#define FDS_LOAD_FIRST_BLOCKS 2       // blocks to load before drive emulation start
+#define FDS_LOAD_TIME_SLICE 20        // maximum time for fds_load_continue() call, milliseconds
+#define FDS_JOURNAL_FILE "fdskey.jrn" // unsaved data is written here on power failure
+#define FDS_JOURNAL_MAGIC 0x4C4E524A
+#define FDS_JOURNAL_HEADER_SECTORS 3
+#define FDS_IMAGE_SECTORS (FDS_MAX_SIDE_SIZE / FF_MIN_SS)
+#define FDS_JOURNAL_SIZE ((FDS_JOURNAL_HEADER_SECTORS + FDS_IMAGE_SECTORS) * FF_MIN_SS)
 
 // do not touch it
 #define FDS_ROM_HEADER_SIZE 16    // header in ROM
@@ -48,6 +64,15 @@
 #define FDS_WRITE_CAPTURE_TIMER_CHANNEL_REG FDS_TIMER_CHANNEL_REG(FDS_WRITE_CAPTURE_TIMER_CHANNEL)
 #define FDS_WRITE_CAPTURE_TIMER_CHANNEL_CONST FDS_TIMER_CHANNEL_CONST(FDS_WRITE_CAPTURE_TIMER_CHANNEL)
 #define FDS_WRITE_CAPTURE_DMA_TRIGGER_CONST FDS_TIMER_DMA_TRIGGER_CONST(FDS_WRITE_CAPTURE_TIMER_CHANNEL)
+#define FDS_DMA_CHANNEL_INSTANCE(v) FDS_GLUE(DMA1_Channel, v)
+#define FDS_DMA_FLAG(flag, v) FDS_GLUE(flag, v)
+#define FDS_READ_DMA_INSTANCE FDS_DMA_CHANNEL_INSTANCE(FDS_READ_DMA_CHANNEL)
+#define FDS_WRITE_DMA_INSTANCE FDS_DMA_CHANNEL_INSTANCE(FDS_WRITE_DMA_CHANNEL)
+
+// register-level GPIO access for the interrupt context
+#define FDS_PIN_READ(port, pin) (((port)->IDR & (pin)) != 0)
+#define FDS_PIN_SET(port, pin) ((port)->BSRR = (pin))
+#define FDS_PIN_RESET(port, pin) ((port)->BRR = (pin))
 
 typedef enum {
   FDS_OFF,                    // disk image is not loaded
@@ -61,6 +86,32 @@ typedef enum {
   FDS_SAVE_PENDING            // saving image
 } FDS_STATE;
 
+typedef struct __attribute__((packed))
+{
+  uint32_t magic;
+  uint32_t payload_hash;
+  uint16_t sector_count;
+  uint8_t side;
+  int32_t used_space;
+  int32_t block_count;
+  uint32_t dirty_sectors[(FDS_IMAGE_SECTORS + 31) / 32];
+  int32_t block_offsets[FDS_MAX_BLOCKS];
+  char filename[FF_MAX_LFN + 1];
+} FDS_JOURNAL_HEADER;
+
+typedef union
+{
+  FDS_JOURNAL_HEADER header;
+  uint8_t sectors[FDS_JOURNAL_HEADER_SECTORS][FF_MIN_SS];
+} FDS_JOURNAL;
+
+typedef enum __attribute__ ((__packed__))
+{
+  FDS_RATE_NORMAL = 0,
+  FDS_RATE_FAST,
+  FDS_RATE_FASTER
+} FDS_TRANSFER_RATE;
+
 #define FDSR_WRONG_CRC 0x80
 #define FDSR_INVALID_ROM 0x81
 #define FDSR_OUT_OF_MEMORY 0x82
@@ -69,21 +120,37 @@ typedef enum {
 #define FDSR_CANCELLED 0x85
 
 FRESULT fds_load_side(char *filename, uint8_t side, uint8_t ro);
+FRESULT fds_load_continue();
 FRESULT fds_close(uint8_t save);
 FRESULT fds_save();
+FRESULT fds_journal_replay(uint8_t *restored);
+void fds_power_fail();
 void fds_check_pins();
+void fds_read_dma_irq_handler();
+void fds_write_dma_irq_handler();
 FDS_STATE fds_get_state();
+void fds_set_transfer_rate(FDS_TRANSFER_RATE rate);
+FDS_TRANSFER_RATE fds_get_transfer_rate();
+uint8_t fds_transfer_rate_fallback();
 uint8_t fds_is_changed();
+int fds_find_file(const char *name);
+uint8_t *fds_get_file_data(int header_block, uint16_t *size);
+FRESULT fds_put_file(int header_block, const char *name, uint16_t address, uint8_t type, const uint8_t *data, uint16_t size);
+void fds_discard_changes();
 int fds_get_block();
+uint8_t fds_is_timing_critical();
 int fds_get_block_count();
 int fds_get_head_position();
 int fds_get_max_size();
 int fds_get_used_space();
+void fds_update_side_crc();
+uint8_t fds_take_written_side(uint32_t *crc, uint8_t *disk_id);
 
 extern TIM_HandleTypeDef FDS_READ_PWM_TIMER;
 extern DMA_HandleTypeDef FDS_READ_DMA;
 extern TIM_HandleTypeDef FDS_WRITE_TIMER;
 extern DMA_HandleTypeDef FDS_WRITE_DMA;
 extern TIM_HandleTypeDef FDS_WRITE_CAPTURE_TIMER;
+extern TIM_HandleTypeDef FDS_DEADLINE_TIMER;
 
 #endif /* INC_FDSEMU_H_ */
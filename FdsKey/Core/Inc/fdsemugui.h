@@ -8,6 +8,7 @@
 #define FDS_GUI_HORIZONTAL_SCROLL_PAUSE 24
 #define FDS_GUI_FILE_NUMBER_FONT FONT_DIGITS
 #define FDS_GUI_SIDE_SWITCH_DELAY 800
+#define FDS_GUI_MESSAGE_DELAY 1000
 
 FRESULT fds_gui_load_side(char *filename, char *game_name, uint8_t *side, uint8_t side_count, uint8_t ro);
 
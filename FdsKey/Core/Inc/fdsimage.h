@@ -0,0 +1,30 @@
+#ifndef INC_FDSIMAGE_H_
+#define INC_FDSIMAGE_H_
+
+#include "fdsemu.h"
+
+// disk side storage backend, it's selected at compile time
+// and the read/write stream accessors are inlined, so DMA interrupts pay no indirect calls
+//
+// every backend provides:
+//   FRESULT fds_image_alloc()                                - allocate empty side
+//   void fds_image_free()                                    - release side storage
+//   uint8_t fds_image_read(int offset)                       - next byte for the read stream (inline)
+//   void fds_image_write(int offset, uint8_t value)          - byte from the write stream (inline)
+//   uint8_t *fds_image_ptr(int offset)                       - direct access for parsing and CRC
+//   FRESULT fds_image_load(FIL *fp, int offset, UINT size, UINT *br) - read data from the image file
+//   FRESULT fds_image_flush(FIL *fp, int offset, UINT size)  - write data to the image file
+//   void fds_image_mark_dirty(int start, int end)            - range is changed since last save
+//   void fds_image_clear_dirty()
+//   int fds_image_next_dirty(int sector)                     - next changed sector after this one or -1
+//   void fds_image_get_dirty_map(void *map)                  - changed sectors bitmap, map can be unaligned
+
+#define FDS_IMAGE_BACKEND_GAPPED
+
+#if defined(FDS_IMAGE_BACKEND_GAPPED)
+#include "fdsimage_gapped.h"
+#else
+#error No disk image backend selected
+#endif
+
+#endif /* INC_FDSIMAGE_H_ */
@@ -0,0 +1,40 @@
+#ifndef INC_FDSIMAGE_GAPPED_H_
+#define INC_FDSIMAGE_GAPPED_H_
+
+#include "main.h"
+#include "ff.h"
+#include "fdsemu.h"
+
+// whole side in memory as it's on the disk: gaps, data and CRCs
+
+#ifdef FDS_USE_DYNAMIC_MEMORY
+extern uint8_t * volatile fds_image_data;
+#else
+extern volatile uint8_t fds_image_data[FDS_MAX_SIDE_SIZE];
+#endif
+
+static inline uint8_t fds_image_read(int offset)
+{
+  return fds_image_data[offset];
+}
+
+static inline void fds_image_write(int offset, uint8_t value)
+{
+  fds_image_data[offset] = value;
+}
+
+static inline uint8_t *fds_image_ptr(int offset)
+{
+  return (uint8_t*)fds_image_data + offset;
+}
+
+FRESULT fds_image_alloc();
+void fds_image_free();
+FRESULT fds_image_load(FIL *fp, int offset, UINT size, UINT *br);
+FRESULT fds_image_flush(FIL *fp, int offset, UINT size);
+void fds_image_mark_dirty(int start, int end);
+void fds_image_clear_dirty();
+int fds_image_next_dirty(int sector);
+void fds_image_get_dirty_map(void *map);
+
+#endif /* INC_FDSIMAGE_GAPPED_H_ */
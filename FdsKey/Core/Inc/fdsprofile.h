@@ -0,0 +1,23 @@
+#ifndef INC_FDSPROFILE_H_
+#define INC_FDSPROFILE_H_
+
+#include "main.h"
+#include "ff.h"
+#include "fdsemu.h"
+
+#define FDS_PROFILE_FILE "fdskey.prf"
+#define FDS_PROFILE_ENTRIES 64
+#define FDS_PROFILE_MAGIC 0xFDAF
+
+// per-title settings
+typedef struct __attribute__((packed))
+{
+  uint16_t magic;
+  uint32_t path_hash;
+  FDS_TRANSFER_RATE rate;
+} FDS_PROFILE_ENTRY;
+
+FDS_TRANSFER_RATE fds_profile_get_rate(char *path);
+FRESULT fds_profile_set_rate(char *path, FDS_TRANSFER_RATE rate);
+
+#endif /* INC_FDSPROFILE_H_ */
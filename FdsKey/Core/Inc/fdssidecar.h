@@ -0,0 +1,41 @@
+#ifndef INC_FDSSIDECAR_H_
+#define INC_FDSSIDECAR_H_
+
+#include "main.h"
+#include "ff.h"
+#include "fdsemu.h"
+
+// comment it to disable pre-expanded copies of loaded sides
+#define FDS_USE_SIDECAR
+
+#define FDS_SIDECAR_DIR "fdskey.sc"
+#define FDS_SIDECAR_MAGIC 0xFD5C
+// sides to remove on invalidation
+#define FDS_SIDECAR_MAX_SIDES 16
+// image data written per background step
+#define FDS_SIDECAR_CHUNK_SIZE 4096
+
+// sidecar file is this header followed by the raw side image:
+// gaps, terminators and CRCs are already there, so it's loaded as is
+typedef struct __attribute__((packed))
+{
+  // key, same as for the CRC cache
+  uint16_t magic;
+  uint32_t path_hash;
+  FSIZE_t fsize;
+  WORD fdate;
+  WORD ftime;
+  uint8_t side;
+  // block table
+  int32_t used_space;
+  int32_t block_count;
+  int32_t block_offsets[FDS_MAX_BLOCKS];
+} FDS_SIDECAR_HEADER;
+
+void fds_sidecar_set_key(FDS_SIDECAR_HEADER *header, char *path, FILINFO *fno, uint8_t side);
+FRESULT fds_sidecar_open(FIL *fp, FDS_SIDECAR_HEADER *header);
+FRESULT fds_sidecar_store_step(FDS_SIDECAR_HEADER *header, int *written, uint8_t *done);
+FRESULT fds_sidecar_remove(uint32_t path_hash, uint8_t side);
+FRESULT fds_sidecar_invalidate(char *path);
+
+#endif /* INC_FDSSIDECAR_H_ */
@@ -6,6 +6,8 @@
 #define FILE_PROPERTIES_WRITE_PROTECT 0
 #define FILE_PROPERTIES_RESTORE_BACKUP 1
 #define FILE_PROPERTIES_DELETE 2
+#define FILE_PROPERTIES_MOVE_TO_STORE 3
+#define FILE_PROPERTIES_VISIBLE_ITEMS 3
 
 void file_properties(char *directory, FILINFO *fno);
 
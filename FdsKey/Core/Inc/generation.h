@@ -0,0 +1,27 @@
+#ifndef INC_GENERATION_H_
+#define INC_GENERATION_H_
+
+#include "main.h"
+#include "ff.h"
+#include "settings.h"
+
+// boot counter log in the unused tail of the settings pages, one doubleword per boot
+#define GENERATION_LOG_SIZE 128
+#define GENERATION_FLASH_OFFSET (SETTINGS_FLASH_OFFSET + FLASH_PAGE_SIZE * 2 - GENERATION_LOG_SIZE)
+#define GENERATION_LOG_SLOTS (GENERATION_LOG_SIZE / sizeof(uint64_t))
+// every boot gets its own range of generations
+#define GENERATION_SESSION_BITS 14
+#define GENERATION_EPOCH_MAX 0xFFFF
+// copy of the epoch on the card
+#define GENERATION_FILE "fdskey.gen"
+
+void generation_init();
+FRESULT generation_sync();
+HAL_StatusTypeDef generation_store();
+uint32_t generation_next();
+DWORD generation_to_fattime(uint32_t generation);
+uint32_t generation_from_fattime(WORD fdate, WORD ftime);
+FRESULT generation_touch_dir(char *path);
+FRESULT generation_get(char *path, uint32_t *generation);
+
+#endif /* INC_GENERATION_H_ */
@@ -0,0 +1,33 @@
+#ifndef INC_IOSCHED_H_
+#define INC_IOSCHED_H_
+
+#include "main.h"
+#include "ff.h"
+
+#define IOSCHED_QUIET_TIME 200 // milliseconds without foreground SD access before background jobs start
+#define IOSCHED_MAX_JOBS 4
+
+// SD card users from highest to lowest priority
+typedef enum
+{
+  IOSCHED_EMULATOR = 0,       // image loads and saves
+  IOSCHED_UI,                 // directory reads, settings, menus
+  IOSCHED_BACKGROUND,         // caches, defragmentation
+  IOSCHED_CLASS_COUNT
+} IOSCHED_CLASS;
+
+// single step of a background job, it should do a bounded amount of work
+// and check iosched_should_yield() between chunks
+typedef FRESULT (*IOSCHED_JOB)();
+
+IOSCHED_CLASS iosched_get_class();
+IOSCHED_CLASS iosched_set_class(IOSCHED_CLASS cls);
+void iosched_transfer_done();
+uint8_t iosched_background_allowed();
+uint8_t iosched_should_yield();
+FRESULT iosched_run(IOSCHED_JOB job);
+void iosched_post(IOSCHED_JOB job);
+void iosched_cancel(IOSCHED_JOB job);
+FRESULT iosched_run_pending();
+
+#endif /* INC_IOSCHED_H_ */
@@ -0,0 +1,60 @@
+#ifndef INC_LAUNCHER_H_
+#define INC_LAUNCHER_H_
+
+#include "main.h"
+#include "ff.h"
+
+// comment it to disable the TV launcher channel
+#define LAUNCHER_ENABLED
+
+// launcher is a regular disk image with the Famicom program that browses the card on TV,
+// it talks to the emulator by writing files with special names:
+//
+// command file "FDSKCMD ", written by the console:
+//   [0]    sequence number, echoed in the answer
+//   [1]    command, see LAUNCHER_COMMAND
+//   [2..3] argument, little-endian: page number or entry index
+//
+// answer file "FDSKDIR " replaces the command file, loaded at LAUNCHER_PAGE_ADDRESS:
+//   [0]    sequence number
+//   [1]    result, FRESULT code, 0 if ok
+//   [2..3] total entries in the current directory
+//   [4..5] page number
+//   [6]    entries on this page
+//   [7]    directory depth, 0 for the root
+//   then LAUNCHER_PAGE_ENTRIES entries, LAUNCHER_ENTRY_SIZE bytes each:
+//     [0]     LAUNCHER_ENTRY_DIRECTORY flag
+//     [1..31] uppercase name without extension, zero padded
+//
+// command is processed when disk stops and the write is settled,
+// image is selected by LAUNCHER_CMD_OPEN with index of the file entry
+#define LAUNCHER_COMMAND_FILE "FDSKCMD "
+#define LAUNCHER_ANSWER_FILE "FDSKDIR "
+#define LAUNCHER_PAGE_ADDRESS 0x6000
+#define LAUNCHER_PAGE_ENTRIES 16
+#define LAUNCHER_ENTRY_SIZE 32
+#define LAUNCHER_HEADER_SIZE 8
+#define LAUNCHER_ENTRY_DIRECTORY 0x01
+#define LAUNCHER_MAX_PATH_LENGTH 256
+
+typedef enum __attribute__ ((__packed__))
+{
+  LAUNCHER_CMD_LIST = 1,    // list page of the current directory
+  LAUNCHER_CMD_OPEN,        // enter directory or select image by entry index
+  LAUNCHER_CMD_UP           // go to the parent directory
+} LAUNCHER_COMMAND;
+
+typedef enum
+{
+  LAUNCHER_NONE = 0,        // no command on the disk
+  LAUNCHER_ANSWERED,        // answer is written to the disk
+  LAUNCHER_SELECTED         // image is selected, see launcher_get_*()
+} LAUNCHER_RESULT;
+
+FRESULT launcher_process(LAUNCHER_RESULT *result);
+char *launcher_get_path();
+char *launcher_get_name();
+uint8_t launcher_get_side_count();
+uint8_t launcher_get_readonly();
+
+#endif /* INC_LAUNCHER_H_ */
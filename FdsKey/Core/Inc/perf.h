@@ -0,0 +1,88 @@
+#ifndef INC_PERF_H_
+#define INC_PERF_H_
+
+#include "main.h"
+#include "ff.h"
+
+// uncomment it to measure the hot paths, it adds some cycles to every measured ISR
+//#define PERF_COUNTERS
+
+#define PERF_FILE "perf.txt"
+
+typedef enum
+{
+  PERF_FDS_READ_DMA = 0,
+  PERF_FDS_WRITE_DMA,
+  PERF_FDS_CHECK_PINS,
+  PERF_SD_READ_BLOCK,
+  PERF_SD_WRITE_BLOCK,
+  PERF_SD_COMMAND,
+  PERF_SD_DEFERRED,
+  PERF_OLED_DEFERRED,
+  // SD transfers by priority class, same order as IOSCHED_CLASS
+  PERF_IO_EMULATOR,
+  PERF_IO_UI,
+  PERF_IO_BACKGROUND,
+  PERF_IO_PREEMPT_WAIT,
+  PERF_COUNTER_COUNT
+} PERF_COUNTER_ID;
+
+typedef struct
+{
+  uint32_t calls;
+  uint64_t cycles;
+  uint32_t max;
+} PERF_COUNTER;
+
+typedef struct
+{
+  uint32_t tick;
+  uint32_t val;
+} PERF_TIMESTAMP;
+
+extern volatile PERF_COUNTER perf_counters[PERF_COUNTER_COUNT];
+
+// SysTick counts down HCLK cycles and wraps every millisecond,
+// so full cycle count = ticks * reload + SysTick delta
+static inline PERF_TIMESTAMP perf_timestamp()
+{
+  PERF_TIMESTAMP ts;
+  uint32_t primask = __get_PRIMASK();
+
+  // the pair must be consistent, SysTick interrupt can't run inside higher priority ISRs
+  __disable_irq();
+  ts.tick = HAL_GetTick();
+  ts.val = SysTick->VAL;
+  if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)
+  {
+    // counter wrapped but the tick is not incremented yet
+    ts.tick++;
+    ts.val = SysTick->VAL;
+  }
+  __set_PRIMASK(primask);
+  return ts;
+}
+
+static inline void perf_add(PERF_COUNTER_ID id, PERF_TIMESTAMP start)
+{
+  PERF_TIMESTAMP end = perf_timestamp();
+  uint32_t cycles = (end.tick - start.tick) * (SysTick->LOAD + 1) + start.val - end.val;
+  perf_counters[id].calls++;
+  perf_counters[id].cycles += cycles;
+  if (cycles > perf_counters[id].max)
+    perf_counters[id].max = cycles;
+}
+
+#ifdef PERF_COUNTERS
+#define PERF_START() PERF_TIMESTAMP perf_start = perf_timestamp()
+#define PERF_STOP(id) perf_add(id, perf_start)
+#else
+#define PERF_START()
+#define PERF_STOP(id)
+#endif
+
+void perf_reset();
+const char* perf_get_name(PERF_COUNTER_ID id);
+FRESULT perf_save(char *filename);
+
+#endif /* INC_PERF_H_ */
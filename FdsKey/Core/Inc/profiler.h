@@ -0,0 +1,36 @@
+#ifndef INC_PROFILER_H_
+#define INC_PROFILER_H_
+
+#include "main.h"
+#include "ff.h"
+
+// comment it to remove the sampling profiler from the build
+#define PROFILER
+
+#define PROFILER_FILE "profile.txt"
+// TIM14 is not used by anything else
+#define PROFILER_TIMER TIM14
+#define PROFILER_IRQ TIM14_IRQn
+#define PROFILER_IRQ_HANDLER TIM14_IRQHandler
+// below DMA and EXTI, so FDS timings are never disturbed, but above SysTick and TIM1
+#define PROFILER_IRQ_PRIORITY 1
+// sampling period in microseconds, not a multiple of 1ms to avoid aliasing with SysTick
+#define PROFILER_PERIOD_US 1009
+// histogram size, must be a power of two
+#define PROFILER_SLOTS 512
+#define PROFILER_MAX_PROBES 8
+
+typedef struct
+{
+  uint32_t pc;
+  uint32_t lr;
+  uint32_t count;
+} PROFILER_SLOT;
+
+void profiler_start();
+void profiler_stop();
+uint8_t profiler_is_running();
+uint32_t profiler_get_samples();
+FRESULT profiler_save(char *filename);
+
+#endif /* INC_PROFILER_H_ */
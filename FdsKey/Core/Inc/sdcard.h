@@ -4,12 +4,15 @@
 #include "main.h"
 
 #define SD_SPI_PORT      hspi3
+#define SD_SPI_INSTANCE  SPI3
 
 #define SD_INIT_TRIES             32
+#define SD_INIT_FAST_TRIES        4 // tries with the remembered speed before the full search
 #define SD_TIMEOUT                1000 // milliseconds
 #define SD_R1_ANSWER_RETRY_COUNT  32
 #define SD_CMD0_RETRY_COUNT       100
 #define SD_ACMD41_TIMEOUT         500 // milliseconds
+#define SD_LOWEST_SPEED           SPI_BAUDRATEPRESCALER_16
 
 #define SD_R1_IDLE (1 << 0)
 #define SD_R1_ERASE_CLEARED (1 << 1)
@@ -136,7 +139,11 @@ extern SPI_HandleTypeDef SD_SPI_PORT;
 // Initialization
 SD_RESULT SD_init();
 SD_RESULT SD_init_try_speed();
+SD_RESULT SD_init_at_speed(uint32_t prescaler, int tries);
 uint32_t SD_get_spi_speed();
+uint32_t SD_get_slower_speed(uint32_t prescaler);
+uint8_t SD_get_version();
+uint8_t SD_is_high_capacity();
 
 // Read/write single blocks
 SD_RESULT SD_read_single_block(uint32_t blockNum, uint8_t* buff); // sizeof(buff) == 512!
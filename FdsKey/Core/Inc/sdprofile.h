@@ -0,0 +1,23 @@
+#ifndef INC_SDPROFILE_H_
+#define INC_SDPROFILE_H_
+
+#include "main.h"
+#include "sdcard.h"
+
+#define SD_PROFILE_FLASH_OFFSET (0x08080000 - FLASH_PAGE_SIZE * 6) // reserved one page
+#define SD_PROFILE_MAGIC 0x50445346
+
+// parameters of the last successfully mounted card
+typedef struct
+{
+  uint32_t magic;
+  SD_CID cid;
+  uint32_t prescaler;
+  uint8_t version;
+  uint8_t high_capacity;
+} SD_PROFILE;
+
+SD_RESULT sd_profile_init();
+HAL_StatusTypeDef sd_profile_forget();
+
+#endif /* INC_SDPROFILE_H_ */
@@ -4,13 +4,18 @@
 #include <stdint.h>
 #include "main.h"
 #include "oled.h"
+#include "perf.h"
 
 #define SERVICE_SETTINGS_SIGNATURE "SFDSKEY"
 
 #define SERVICE_SETTINGS_FLASH_OFFSET (0x08080000 - FLASH_PAGE_SIZE * 3)
 #define HARDWARE_VERSION_FLASH_OFFSET (0x08080000 - FLASH_PAGE_SIZE * 4)
 
-#define SERVICE_SETTINGS_ITEM_COUNT 20
+#ifdef PERF_COUNTERS
+#define SERVICE_SETTINGS_ITEM_COUNT 24
+#else
+#define SERVICE_SETTINGS_ITEM_COUNT 23
+#endif
 
 #define DISK_LABEL "FDSKey"
 
@@ -27,6 +32,7 @@ typedef enum
   SERVICE_SETTING_FAT_FREE,
   SERVICE_SETTING_FILE_SYSTEM,
   SERVICE_SETTING_SD_SPI_SPEED,
+  SERVICE_SETTING_SD_ERRORS,
   SERVICE_SETTING_SD_MANUFACTURER_ID,
   SERVICE_SETTING_SD_OEM_ID,
   SERVICE_SETTING_SD_PROD_NAME,
@@ -35,7 +41,12 @@ typedef enum
   SERVICE_SETTING_SD_PROD_MANUFACT_YEAR,
   SERVICE_SETTING_SD_PROD_MANUFACT_MONTH,
   SERVICE_SETTING_SD_FORMAT,
-  SERVICE_SETTING_BL_UPDATE
+  SERVICE_SETTING_BL_UPDATE,
+#ifdef PERF_COUNTERS
+  SERVICE_SETTING_PERF_SAVE,
+#endif
+  SERVICE_SETTING_DEFRAG_REPORT,
+  SERVICE_SETTING_PROFILER
 } SERVICE_SETTING_ID;
 
 typedef struct __attribute__((packed))
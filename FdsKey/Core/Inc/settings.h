@@ -5,7 +5,7 @@
 #include "main.h"
 #include "ff.h"
 
-#define SETTINGS_FLASH_OFFSET (0x08080000 - FLASH_PAGE_SIZE * 2) // reserved two pages
+#define SETTINGS_FLASH_OFFSET (0x08080000 - FLASH_PAGE_SIZE * 2) // reserved two pages, last 128 bytes are for the boot counter
 #define SETTINGS_SIGNATURE "FDSKEY"
 #define SETTINGS_FONT FONT_SLIMFONT_8
 #define SETTINGS_AUTOSAVE_TIME_MAX 10
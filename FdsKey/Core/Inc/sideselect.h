@@ -11,5 +11,6 @@
 
 void fds_side_select(char *directory, FILINFO *fno, uint8_t load_first);
 DotMatrixImage* side_select_get_disk_image(uint8_t side, uint8_t side_count);
+void text_remove_brackets(char *text);
 
 #endif /* INC_SIDESELECT_H_ */
@@ -0,0 +1,21 @@
+#include "arbiter.h"
+#include "fdsemu.h"
+#include "perf.h"
+
+// wait until emulator leaves timing critical section before SD or OLED transfer,
+// deferrals are counted by perf counters
+void arbiter_wait(ARBITER_CLIENT client)
+{
+  uint32_t start_time;
+
+  // interrupt handlers can't wait, emulator can't proceed while they are running
+  if (__get_IPSR())
+    return;
+  if (!fds_is_timing_critical())
+    return;
+
+  PERF_START();
+  start_time = HAL_GetTick();
+  while (fds_is_timing_critical() && (HAL_GetTick() - start_time < ARBITER_MAX_DEFER_TIME));
+  PERF_STOP(client == ARBITER_SD ? PERF_SD_DEFERRED : PERF_OLED_DEFERRED);
+}
@@ -0,0 +1,619 @@
+#include <stdlib.h>
+#include <string.h>
+#include "blockstore.h"
+
+// FNV-1a hash of block data
+static uint32_t block_store_hash(uint8_t *data, int size)
+{
+  uint32_t hash = 2166136261UL;
+  while (size--)
+  {
+    hash ^= *data++;
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+// check manifest extension
+uint8_t block_store_is_manifest(char *filename)
+{
+  int l = strlen(filename);
+  return l >= 4 && !strcasecmp(filename + l - 4, BLOCK_STORE_MANIFEST_EXT);
+}
+
+// open manifest and read its header,
+// returns FR_NO_FILE if file is not a manifest
+static FRESULT block_store_open_manifest(FIL *fp, char *path, BYTE mode, BLOCK_STORE_MANIFEST_HEADER *header)
+{
+  FRESULT fr;
+  UINT br;
+
+  fr = f_open(fp, path, mode);
+  if (fr != FR_OK)
+    return fr;
+  fr = f_read(fp, header, sizeof(BLOCK_STORE_MANIFEST_HEADER), &br);
+  if (fr == FR_OK && (br != sizeof(BLOCK_STORE_MANIFEST_HEADER) || header->magic != BLOCK_STORE_MANIFEST_MAGIC))
+    fr = FR_NO_FILE;
+  if (fr != FR_OK)
+    f_close(fp);
+  return fr;
+}
+
+// read amount of sides from the manifest
+FRESULT block_store_get_side_count(char *path, uint8_t *side_count)
+{
+  FRESULT fr;
+  FIL fp;
+  BLOCK_STORE_MANIFEST_HEADER header;
+
+  fr = block_store_open_manifest(&fp, path, FA_READ, &header);
+  if (fr == FR_NO_FILE)
+    return FDSR_INVALID_ROM;
+  if (fr != FR_OK)
+    return fr;
+  *side_count = header.side_count;
+  return f_close(&fp);
+}
+
+// read block list of the side,
+// returns FR_NO_FILE if file is not a manifest, so it's a regular image
+FRESULT block_store_read_side(char *path, uint8_t side, BLOCK_STORE_SIDE *side_data)
+{
+  FRESULT fr;
+  FIL fp;
+  UINT br;
+  BLOCK_STORE_MANIFEST_HEADER header;
+
+  fr = block_store_open_manifest(&fp, path, FA_READ, &header);
+  if (fr != FR_OK)
+    return fr;
+  if (side >= header.side_count)
+  {
+    f_close(&fp);
+    return FDSR_INVALID_ROM;
+  }
+  fr = f_lseek(&fp, sizeof(BLOCK_STORE_MANIFEST_HEADER) + (FSIZE_t)side * sizeof(BLOCK_STORE_SIDE));
+  if (fr == FR_OK)
+    fr = f_read(&fp, side_data, sizeof(BLOCK_STORE_SIDE), &br);
+  if (fr == FR_OK && (br != sizeof(BLOCK_STORE_SIDE) || side_data->block_count > FDS_MAX_BLOCKS))
+    fr = FDSR_INVALID_ROM;
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    return fr;
+  }
+  return f_close(&fp);
+}
+
+// size of the manifest with all the sides
+static FSIZE_t block_store_manifest_size(BLOCK_STORE_MANIFEST_HEADER *header)
+{
+  return sizeof(BLOCK_STORE_MANIFEST_HEADER) + (FSIZE_t)header->side_count * sizeof(BLOCK_STORE_SIDE);
+}
+
+// replace manifest with the complete temporary copy and cut the path after it
+static FRESULT block_store_swap(char *path, FSIZE_t size)
+{
+  FRESULT fr;
+  FIL fp;
+
+  fr = f_unlink(path);
+  if (fr != FR_OK && fr != FR_NO_FILE)
+    return fr;
+  fr = f_rename(BLOCK_STORE_TEMP_FILE, path);
+  if (fr != FR_OK)
+    return fr;
+  fr = f_open(&fp, path, FA_WRITE);
+  if (fr != FR_OK)
+    return fr;
+  fr = f_lseek(&fp, size);
+  if (fr == FR_OK)
+    fr = f_truncate(&fp);
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    return fr;
+  }
+  return f_close(&fp);
+}
+
+// write block list of the side,
+// whole manifest is written to the temporary file and then renamed, so power loss never tears it
+FRESULT block_store_write_side(char *path, uint8_t side, BLOCK_STORE_SIDE *side_data)
+{
+  FRESULT fr;
+  FIL fp, fp_temp;
+  UINT br, bw;
+  BLOCK_STORE_MANIFEST_HEADER header;
+  uint8_t buffer[BLOCK_STORE_COPY_BUFFER];
+  FSIZE_t size, left;
+
+  fr = block_store_open_manifest(&fp, path, FA_READ, &header);
+  if (fr == FR_NO_FILE)
+    return FDSR_INVALID_ROM;
+  if (fr != FR_OK)
+    return fr;
+  if (side >= header.side_count)
+  {
+    f_close(&fp);
+    return FDSR_INVALID_ROM;
+  }
+  size = block_store_manifest_size(&header);
+  fr = f_open(&fp_temp, BLOCK_STORE_TEMP_FILE, FA_CREATE_ALWAYS | FA_WRITE);
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    return fr;
+  }
+  // copy of the manifest
+  fr = f_write(&fp_temp, &header, sizeof(header), &bw);
+  if (fr == FR_OK && bw != sizeof(header))
+    fr = FR_DENIED;
+  while (fr == FR_OK && (left = size - f_tell(&fp_temp)))
+  {
+    fr = f_read(&fp, buffer, left < sizeof(buffer) ? left : sizeof(buffer), &br);
+    if (fr == FR_OK && !br)
+      fr = FDSR_INVALID_ROM; // truncated manifest
+    if (fr == FR_OK)
+      fr = f_write(&fp_temp, buffer, br, &bw);
+    if (fr == FR_OK && bw != br)
+      fr = FR_DENIED;
+  }
+  f_close(&fp);
+  // with the new side
+  if (fr == FR_OK)
+    fr = f_lseek(&fp_temp, sizeof(header) + (FSIZE_t)side * sizeof(BLOCK_STORE_SIDE));
+  if (fr == FR_OK)
+    fr = f_write(&fp_temp, side_data, sizeof(BLOCK_STORE_SIDE), &bw);
+  if (fr == FR_OK && bw != sizeof(BLOCK_STORE_SIDE))
+    fr = FR_DENIED;
+  // and target path at the end, it marks the copy as complete
+  if (fr == FR_OK)
+    fr = f_lseek(&fp_temp, size);
+  if (fr == FR_OK)
+    fr = f_write(&fp_temp, path, strlen(path) + 1, &bw);
+  if (fr == FR_OK && bw != strlen(path) + 1)
+    fr = FR_DENIED;
+  if (fr != FR_OK)
+  {
+    f_close(&fp_temp);
+    f_unlink(BLOCK_STORE_TEMP_FILE);
+    return fr;
+  }
+  fr = f_close(&fp_temp);
+  if (fr != FR_OK)
+    return fr;
+  return block_store_swap(path, size);
+}
+
+// finish manifest replacement interrupted by power loss, call it on start before any image is loaded
+FRESULT block_store_recover()
+{
+  FRESULT fr;
+  FIL fp;
+  UINT br;
+  BLOCK_STORE_MANIFEST_HEADER header;
+  FSIZE_t size;
+  char *path;
+
+  fr = block_store_open_manifest(&fp, BLOCK_STORE_TEMP_FILE, FA_READ, &header);
+  if (fr == FR_NO_PATH)
+    return FR_OK; // no store
+  if (fr == FR_NO_FILE)
+  {
+    // no file or garbage
+    fr = f_unlink(BLOCK_STORE_TEMP_FILE);
+    return fr == FR_NO_FILE ? FR_OK : fr;
+  }
+  if (fr != FR_OK)
+    return fr;
+  path = malloc(FDS_MAX_FILE_PATH_LENGTH);
+  if (!path)
+  {
+    f_close(&fp);
+    return FDSR_OUT_OF_MEMORY;
+  }
+  size = block_store_manifest_size(&header);
+  br = 0;
+  fr = f_lseek(&fp, size);
+  if (fr == FR_OK)
+    fr = f_read(&fp, path, FDS_MAX_FILE_PATH_LENGTH, &br);
+  f_close(&fp);
+  if (fr == FR_OK)
+  {
+    if (br > 1 && path[br - 1] == 0 && strlen(path) == br - 1)
+      // complete copy, original could be removed already
+      fr = block_store_swap(path, size);
+    else
+      // incomplete copy, original is untouched
+      fr = f_unlink(BLOCK_STORE_TEMP_FILE);
+  }
+  free(path);
+  return fr;
+}
+
+// create empty index, every slot must be zero
+static FRESULT block_store_create_index(FIL *fp)
+{
+  FRESULT fr;
+  UINT bw;
+  int i;
+  uint8_t zero[FF_MIN_SS];
+
+  memset(zero, 0, sizeof(zero));
+  fr = f_expand(fp, (FSIZE_t)BLOCK_STORE_INDEX_SLOTS * sizeof(BLOCK_STORE_SLOT), 0);
+  if (fr == FR_DENIED)
+    fr = FR_OK; // no contiguous space, fragmented file is still fine
+  for (i = 0; fr == FR_OK && i < BLOCK_STORE_INDEX_SLOTS * sizeof(BLOCK_STORE_SLOT) / sizeof(zero); i++)
+  {
+    fr = f_write(fp, zero, sizeof(zero), &bw);
+    if (fr == FR_OK && bw != sizeof(zero))
+      fr = FR_DENIED;
+  }
+  if (fr == FR_OK)
+    fr = f_sync(fp);
+  return fr;
+}
+
+// open pack and index for writing, create them if need
+FRESULT block_store_open(BLOCK_STORE_FILES *store)
+{
+  FRESULT fr;
+  UINT bw;
+  const uint32_t magic = BLOCK_STORE_PACK_MAGIC;
+
+  fr = f_mkdir(BLOCK_STORE_DIR);
+  if (fr == FR_OK)
+    // hide it from the file browser
+    fr = f_chmod(BLOCK_STORE_DIR, AM_HID, AM_HID);
+  else if (fr == FR_EXIST)
+    fr = FR_OK;
+  if (fr != FR_OK)
+    return fr;
+
+  fr = f_open(&store->pack, BLOCK_STORE_PACK_FILE, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+  if (fr != FR_OK)
+    return fr;
+  // magic value at the start, so zero offset is never valid
+  if (f_size(&store->pack) == 0)
+  {
+    fr = f_write(&store->pack, &magic, sizeof(magic), &bw);
+    if (fr == FR_OK && bw != sizeof(magic))
+      fr = FR_DENIED;
+    if (fr != FR_OK)
+    {
+      f_close(&store->pack);
+      return fr;
+    }
+  }
+
+  fr = f_open(&store->index, BLOCK_STORE_INDEX_FILE, FA_OPEN_EXISTING | FA_READ | FA_WRITE);
+  if (fr == FR_NO_FILE)
+  {
+    fr = f_open(&store->index, BLOCK_STORE_INDEX_FILE, FA_CREATE_NEW | FA_READ | FA_WRITE);
+    if (fr == FR_OK)
+    {
+      fr = block_store_create_index(&store->index);
+      if (fr != FR_OK)
+      {
+        // incomplete index is garbage
+        f_close(&store->index);
+        f_unlink(BLOCK_STORE_INDEX_FILE);
+      }
+    }
+  }
+  if (fr != FR_OK)
+  {
+    f_close(&store->pack);
+    return fr;
+  }
+  return FR_OK;
+}
+
+// compare data with the pack record
+static FRESULT block_store_compare(FIL *pack, uint32_t offset, uint8_t *data, uint16_t size, uint8_t *equal)
+{
+  FRESULT fr;
+  UINT br;
+  uint16_t stored_size;
+  uint8_t buffer[BLOCK_STORE_COMPARE_BUFFER];
+  int l;
+
+  *equal = 0;
+  fr = f_lseek(pack, offset - sizeof(stored_size));
+  if (fr == FR_OK)
+    fr = f_read(pack, &stored_size, sizeof(stored_size), &br);
+  if (fr != FR_OK || br != sizeof(stored_size) || stored_size != size)
+    return fr;
+  while (size)
+  {
+    l = size < sizeof(buffer) ? size : sizeof(buffer);
+    fr = f_read(pack, buffer, l, &br);
+    if (fr != FR_OK || br != l || memcmp(buffer, data, l) != 0)
+      return fr;
+    data += l;
+    size -= l;
+  }
+  *equal = 1;
+  return FR_OK;
+}
+
+// find block in the store or append it, returns its reference
+FRESULT block_store_put(BLOCK_STORE_FILES *store, uint8_t *data, uint16_t size, BLOCK_STORE_REF *ref)
+{
+  FRESULT fr;
+  UINT br, bw;
+  uint32_t hash = block_store_hash(data, size);
+  uint32_t slot = hash & (BLOCK_STORE_INDEX_SLOTS - 1);
+  int probe;
+  uint8_t equal;
+  BLOCK_STORE_SLOT entry;
+
+  // probe sequence is limited, every probe is a card read
+  for (probe = 0; probe < BLOCK_STORE_MAX_PROBES; probe++, slot = (slot + 1) & (BLOCK_STORE_INDEX_SLOTS - 1))
+  {
+    fr = f_lseek(&store->index, (FSIZE_t)slot * sizeof(BLOCK_STORE_SLOT));
+    if (fr == FR_OK)
+      fr = f_read(&store->index, &entry, sizeof(entry), &br);
+    if (fr != FR_OK)
+      return fr;
+    if (br != sizeof(entry) || entry.offset == 0)
+      break; // empty slot, it's a new block
+    if (entry.hash != hash)
+      continue;
+    // same hash, make sure that it's the same data
+    fr = block_store_compare(&store->pack, entry.offset, data, size, &equal);
+    if (fr != FR_OK)
+      return fr;
+    if (equal)
+    {
+      ref->offset = entry.offset;
+      ref->size = size;
+      return FR_OK;
+    }
+  }
+  // append record to the pack
+  entry.hash = hash;
+  entry.offset = f_size(&store->pack) + sizeof(hash) + sizeof(size);
+  fr = f_lseek(&store->pack, f_size(&store->pack));
+  if (fr == FR_OK)
+    fr = f_write(&store->pack, &hash, sizeof(hash), &bw);
+  if (fr == FR_OK)
+    fr = f_write(&store->pack, &size, sizeof(size), &bw);
+  if (fr == FR_OK)
+    fr = f_write(&store->pack, data, size, &bw);
+  if (fr == FR_OK && bw != size)
+    fr = FR_DENIED;
+  // data must be on the card before index points to it
+  if (fr == FR_OK)
+    fr = f_sync(&store->pack);
+  if (fr != FR_OK)
+    return fr;
+  // then add it to the index, if there is no free slot nearby
+  // the block is stored without it and just can't be deduplicated
+  if (probe < BLOCK_STORE_MAX_PROBES)
+  {
+    fr = f_lseek(&store->index, (FSIZE_t)slot * sizeof(BLOCK_STORE_SLOT));
+    if (fr == FR_OK)
+      fr = f_write(&store->index, &entry, sizeof(entry), &bw);
+    if (fr == FR_OK && bw != sizeof(entry))
+      fr = FR_DENIED;
+    if (fr != FR_OK)
+      return fr;
+  }
+  ref->offset = entry.offset;
+  ref->size = size;
+  return FR_OK;
+}
+
+// close pack and index
+FRESULT block_store_close(BLOCK_STORE_FILES *store)
+{
+  FRESULT fr, fr2;
+
+  fr = f_close(&store->index);
+  fr2 = f_close(&store->pack);
+  return fr != FR_OK ? fr : fr2;
+}
+
+// open pack for reading blocks
+FRESULT block_store_open_pack(FIL *fp)
+{
+  return f_open(fp, BLOCK_STORE_PACK_FILE, FA_READ);
+}
+
+// split raw side to blocks and put them to the store,
+// there must be only zero padding after the last block, nothing is dropped
+static FRESULT block_store_put_side(uint8_t *side_data, int side_size, BLOCK_STORE_SIDE *side)
+{
+  FRESULT fr;
+  BLOCK_STORE_FILES store;
+  int pos = 0;
+  int size;
+  int i;
+  uint8_t block_type;
+
+  fr = block_store_open(&store);
+  if (fr != FR_OK)
+    return fr;
+  for (i = 0; i < FDS_MAX_BLOCKS; i++)
+  {
+    // disk info, file amount, then file header and file data pairs
+    block_type = i == 0 ? 1 : i == 1 ? 2 : i % 2 == 0 ? 3 : 4;
+    if (pos >= side_size || side_data[pos] != block_type)
+      break;
+    if (block_type == 1)
+      size = 56;
+    else if (block_type == 2)
+      size = 2;
+    else if (block_type == 3)
+      size = 16;
+    else // size stored in previous block
+      size = 1 + (side_data[pos - 16 + 0x0D] | (side_data[pos - 16 + 0x0E] << 8));
+    if (pos + size > side_size)
+      break;
+    fr = block_store_put(&store, side_data + pos, size, &side->blocks[i]);
+    if (fr != FR_OK)
+    {
+      block_store_close(&store);
+      return fr;
+    }
+    pos += size;
+  }
+  side->block_count = i;
+  while (pos < side_size && !side_data[pos])
+    pos++;
+  if (i < 2 || pos < side_size)
+  {
+    block_store_close(&store);
+    return FDSR_INVALID_ROM;
+  }
+  return block_store_close(&store);
+}
+
+// read raw side from the .fds image, image is closed after it
+static FRESULT block_store_read_raw_side(char *path, FSIZE_t offset, uint8_t *side_data)
+{
+  FRESULT fr;
+  FIL fp;
+  UINT br;
+
+  fr = f_open(&fp, path, FA_READ);
+  if (fr != FR_OK)
+    return fr;
+  fr = f_lseek(&fp, offset);
+  if (fr == FR_OK)
+    fr = f_read(&fp, side_data, FDS_ROM_SIDE_SIZE, &br);
+  if (fr == FR_OK && br != FDS_ROM_SIDE_SIZE)
+    fr = FDSR_INVALID_ROM;
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    return fr;
+  }
+  return f_close(&fp);
+}
+
+// rebuild side from the manifest and compare it with the raw side
+static FRESULT block_store_verify_side(char *manifest_path, uint8_t side, uint8_t *side_data, BLOCK_STORE_SIDE *side_blocks)
+{
+  FRESULT fr;
+  FIL pack;
+  int i;
+  int pos = 0;
+  uint8_t equal = 1;
+
+  fr = block_store_read_side(manifest_path, side, side_blocks);
+  if (fr != FR_OK)
+    return fr;
+  fr = block_store_open_pack(&pack);
+  if (fr != FR_OK)
+    return fr;
+  for (i = 0; equal && i < side_blocks->block_count; i++)
+  {
+    if (pos + side_blocks->blocks[i].size > FDS_ROM_SIDE_SIZE)
+    {
+      equal = 0;
+      break;
+    }
+    fr = block_store_compare(&pack, side_blocks->blocks[i].offset, side_data + pos, side_blocks->blocks[i].size, &equal);
+    if (fr != FR_OK)
+      break;
+    pos += side_blocks->blocks[i].size;
+  }
+  f_close(&pack);
+  if (fr != FR_OK)
+    return fr;
+  // zero padding is not stored
+  while (equal && pos < FDS_ROM_SIDE_SIZE)
+    equal = !side_data[pos++];
+  return equal ? FR_OK : FR_INT_ERR;
+}
+
+// convert .fds image to manifest and remove it,
+// files are opened one by one, so it works with FF_FS_LOCK = 2
+FRESULT block_store_convert(char *path, char *manifest_path)
+{
+  FRESULT fr;
+  FIL fp;
+  FILINFO fno;
+  UINT bw;
+  uint8_t *side_data;
+  int header_offset;
+  int side;
+  BLOCK_STORE_MANIFEST_HEADER header;
+  BLOCK_STORE_SIDE side_blocks;
+
+  fr = f_stat(path, &fno);
+  if (fr != FR_OK)
+    return fr;
+  header_offset = fno.fsize % FDS_ROM_SIDE_SIZE;
+  if ((header_offset != 0 && header_offset != FDS_ROM_HEADER_SIZE)
+      || fno.fsize / FDS_ROM_SIDE_SIZE == 0 || fno.fsize / FDS_ROM_SIDE_SIZE > BLOCK_STORE_MAX_SIDES)
+    return FDSR_INVALID_ROM;
+  header.magic = BLOCK_STORE_MANIFEST_MAGIC;
+  header.side_count = fno.fsize / FDS_ROM_SIDE_SIZE;
+
+  side_data = malloc(FDS_ROM_SIDE_SIZE);
+  if (!side_data)
+    return FDSR_OUT_OF_MEMORY;
+
+  // empty manifest with header only
+  fr = f_open(&fp, manifest_path, FA_CREATE_NEW | FA_WRITE);
+  if (fr != FR_OK)
+  {
+    free(side_data);
+    return fr;
+  }
+  fr = f_write(&fp, &header, sizeof(header), &bw);
+  if (fr == FR_OK && bw != sizeof(header))
+    fr = FR_DENIED;
+  memset(&side_blocks, 0, sizeof(side_blocks));
+  for (side = 0; fr == FR_OK && side < header.side_count; side++)
+  {
+    fr = f_write(&fp, &side_blocks, sizeof(side_blocks), &bw);
+    if (fr == FR_OK && bw != sizeof(side_blocks))
+      fr = FR_DENIED;
+  }
+  if (fr != FR_OK)
+    f_close(&fp);
+  else
+    fr = f_close(&fp);
+
+  for (side = 0; fr == FR_OK && side < header.side_count; side++)
+  {
+    // read whole side and close image, so pack and index can be opened
+    fr = block_store_read_raw_side(path, header_offset + (FSIZE_t)side * FDS_ROM_SIDE_SIZE, side_data);
+    if (fr == FR_OK)
+      fr = block_store_put_side(side_data, FDS_ROM_SIDE_SIZE, &side_blocks);
+    if (fr == FR_OK)
+      fr = block_store_write_side(manifest_path, side, &side_blocks);
+  }
+  // every side must be restored exactly before the original is removed
+  for (side = 0; fr == FR_OK && side < header.side_count; side++)
+  {
+    fr = block_store_read_raw_side(path, header_offset + (FSIZE_t)side * FDS_ROM_SIDE_SIZE, side_data);
+    if (fr == FR_OK)
+      fr = block_store_verify_side(manifest_path, side, side_data, &side_blocks);
+  }
+  free(side_data);
+
+  if (fr != FR_OK)
+  {
+    // added blocks stay in the store, they can be used later
+    f_unlink(manifest_path);
+    return fr;
+  }
+  // keep write protection
+  if (fno.fattrib & AM_RDO)
+  {
+    fr = f_chmod(manifest_path, AM_RDO, AM_RDO);
+    if (fr != FR_OK)
+      return fr;
+  }
+  // original image is not needed anymore
+  fr = f_chmod(path, 0, AM_RDO);
+  if (fr != FR_OK)
+    return fr;
+  return f_unlink(path);
+}
@@ -0,0 +1,108 @@
+#include "main.h"
+#include "brownout.h"
+#include "fdsemu.h"
+
+static volatile uint8_t brownout_low = 0;
+static uint16_t brownout_threshold_low;
+static uint16_t brownout_threshold_good;
+
+// VREFINT raw value at given supply voltage,
+// it's higher when supply voltage is lower
+static uint16_t brownout_vrefint_raw(uint32_t mv)
+{
+  return (uint32_t)BROWNOUT_VREFINT_CAL * BROWNOUT_VREFINT_CAL_MV / mv;
+}
+
+// set analog watchdog window for power failure or power recovery detection
+static void brownout_set_window(uint8_t low)
+{
+  if (!low)
+    ADC1->AWD1TR = (brownout_threshold_low << ADC_AWD1TR_HT1_Pos) | (0 << ADC_AWD1TR_LT1_Pos);
+  else
+    ADC1->AWD1TR = (0xFFF << ADC_AWD1TR_HT1_Pos) | (brownout_threshold_good << ADC_AWD1TR_LT1_Pos);
+}
+
+// start continuous VREFINT conversion with analog watchdog interrupt
+void brownout_init()
+{
+  brownout_threshold_low = brownout_vrefint_raw(BROWNOUT_THRESHOLD_MV);
+  brownout_threshold_good = brownout_vrefint_raw(BROWNOUT_THRESHOLD_MV + BROWNOUT_HYSTERESIS_MV);
+
+  __HAL_RCC_ADC_CLK_ENABLE();
+  // synchronous clock PCLK/2
+  ADC1->CFGR2 = ADC_CFGR2_CKMODE_0;
+  // voltage regulator startup
+  ADC1->CR = ADC_CR_ADVREGEN;
+  delay_us(20);
+  // calibration
+  ADC1->CR |= ADC_CR_ADCAL;
+  while (ADC1->CR & ADC_CR_ADCAL);
+  // internal reference voltage, it needs long sampling time
+  ADC1_COMMON->CCR |= ADC_CCR_VREFEN;
+  ADC1->SMPR = ADC_SMPR_SMP1_0 | ADC_SMPR_SMP1_1 | ADC_SMPR_SMP1_2;
+  ADC1->CFGR1 = ADC_CFGR1_CONT | ADC_CFGR1_OVRMOD
+      | ADC_CFGR1_AWD1EN | ADC_CFGR1_AWD1SGL | (BROWNOUT_VREFINT_CHANNEL << ADC_CFGR1_AWD1CH_Pos);
+  ADC1->ISR = ADC_ISR_CCRDY;
+  ADC1->CHSELR = 1UL << BROWNOUT_VREFINT_CHANNEL;
+  while (!(ADC1->ISR & ADC_ISR_CCRDY));
+  brownout_set_window(0);
+  // enable ADC
+  ADC1->ISR = ADC_ISR_ADRDY;
+  ADC1->CR |= ADC_CR_ADEN;
+  while (!(ADC1->ISR & ADC_ISR_ADRDY));
+  // lowest priority, drive emulation must not be interrupted by false alarm
+  ADC1->ISR = ADC_ISR_AWD1;
+  ADC1->IER = ADC_IER_AWD1IE;
+  HAL_NVIC_SetPriority(ADC1_IRQn, 3, 0);
+  HAL_NVIC_EnableIRQ(ADC1_IRQn);
+  ADC1->CR |= ADC_CR_ADSTART;
+}
+
+// make sure that voltage is really low using fresh conversions,
+// single sample can be just noise
+static uint8_t brownout_confirm()
+{
+  int i;
+
+  for (i = 0; i < BROWNOUT_CONFIRM_SAMPLES; i++)
+  {
+    ADC1->ISR = ADC_ISR_EOC;
+    while (!(ADC1->ISR & ADC_ISR_EOC));
+    if (ADC1->DR <= brownout_threshold_low)
+      return 0;
+  }
+  return 1;
+}
+
+// analog watchdog interrupt, called directly from the IRQ handler
+void brownout_irq_handler()
+{
+  if (!(ADC1->ISR & ADC_ISR_AWD1))
+    return;
+  ADC1->ISR = ADC_ISR_AWD1;
+  // false alarm, window stays the same
+  if (!brownout_low && !brownout_confirm())
+    return;
+  brownout_low = !brownout_low;
+  brownout_set_window(brownout_low);
+  if (brownout_low)
+    fds_power_fail(); // doesn't return if there is something to save
+}
+
+// check current supply voltage
+uint8_t brownout_is_low()
+{
+  // conversion result is updated continuously
+  return ADC1->DR > (brownout_low ? brownout_threshold_good : brownout_threshold_low);
+}
+
+// wait until power is good for some time, can be called from interrupt
+void brownout_wait_recovery()
+{
+  uint32_t start_time = HAL_GetTick();
+  while (HAL_GetTick() - start_time < BROWNOUT_RECOVERY_TIME)
+  {
+    if (brownout_is_low())
+      start_time = HAL_GetTick();
+  }
+}
@@ -8,13 +8,19 @@
 #include "splash.h"
 #include "fdsemu.h"
 #include "settings.h"
+#include "blockstore.h"
+#include "generation.h"
 
 static DYN_FILINFO** dir_list = 0;
 static DYN_FILINFO** file_list = 0;
 static int dir_count = 0;
 static int file_count = 0;
-
-static void browser_free();
+#ifdef BROWSER_USE_CACHE
+// key of the listing above, empty path if nothing is kept
+static char cache_path[sizeof(fdskey_settings.last_directory)] = "";
+static uint32_t cache_generation = 0;
+static uint8_t cache_hide = 0;
+#endif
 
 #ifdef BROWSER_USE_RUSSIAN
 // codepage conversions for russian characters
@@ -123,7 +129,11 @@ static void browser_draw_item(uint8_t line, int item, uint8_t is_selected, int t
   {
     text = file_list[item - dir_count]->filename;
     // hide extension if enabled and .fds file
-    if (fdskey_settings.hide_extensions && !strcasecmp(text + strlen(text) - 4, ".fds"))
+    if (fdskey_settings.hide_extensions && (!strcasecmp(text + strlen(text) - 4, ".fds")
+#ifdef BLOCK_STORE
+        || block_store_is_manifest(text)
+#endif
+        ))
     {
       char trimmed[FF_MAX_LFN + 1];
       strlcpy(trimmed, text, sizeof(trimmed));
@@ -272,8 +282,21 @@ FRESULT browser(char *path, FILINFO *output, BROWSER_RESULT *result, char *selec
   int mem_file_count = 512;
   int i, r, selection;
   uint8_t is_selected = 0;
-  dir_count = 0;
-  file_count = 0;
+#ifdef BROWSER_USE_CACHE
+  uint32_t generation = 0;
+  uint8_t hide = fdskey_settings.hide_hidden | (fdskey_settings.hide_non_fds << 1);
+
+  // root directory has no timestamp, so it's always loaded
+  if (*path && generation_get(path, &generation) == FR_OK)
+  {
+    if (cache_path[0] && !strcmp(cache_path, path)
+        && cache_generation == generation && cache_hide == hide)
+      goto show;
+  } else {
+    generation = 0;
+  }
+#endif
+  browser_free();
 
   show_loading_screen();
 
@@ -323,7 +346,11 @@ FRESULT browser(char *path, FILINFO *output, BROWSER_RESULT *result, char *selec
       } else {
         if (fdskey_settings.hide_non_fds)
         {
-          if (strcasecmp(fno.fname + strlen(fno.fname) - 4, ".fds") != 0)
+          if (strcasecmp(fno.fname + strlen(fno.fname) - 4, ".fds") != 0
+#ifdef BLOCK_STORE
+              && !block_store_is_manifest(fno.fname)
+#endif
+              )
               continue;
         }
         if (file_count + 1 > mem_file_count)
@@ -369,6 +396,17 @@ FRESULT browser(char *path, FILINFO *output, BROWSER_RESULT *result, char *selec
   top_down_merge_sort(dir_list, dir_count);
   top_down_merge_sort(file_list, file_count);
 
+#ifdef BROWSER_USE_CACHE
+  if (generation && dir_count + file_count <= BROWSER_CACHE_MAX_ITEMS
+      && strlen(path) < sizeof(cache_path))
+  {
+    strcpy(cache_path, path);
+    cache_generation = generation;
+    cache_hide = hide;
+  }
+
+show:
+#endif
   selection = 0;
   if (select && select[0])
   {
@@ -418,6 +456,9 @@ FRESULT browser(char *path, FILINFO *output, BROWSER_RESULT *result, char *selec
     }
   }
 
+#ifdef BROWSER_USE_CACHE
+  if (!cache_path[0])
+#endif
   browser_free();
 
   return FR_OK;
@@ -519,7 +560,7 @@ BROWSER_RESULT browser_tree(char *directory, int dir_max_len, FILINFO *fno)
   }
 }
 
-// free allocated memory
+// free allocated memory, including the cached listing
 void browser_free()
 {
   int i;
@@ -540,4 +581,7 @@ void browser_free()
   dir_list = 0;
   dir_count = 0;
   file_count = 0;
+#ifdef BROWSER_USE_CACHE
+  cache_path[0] = 0;
+#endif
 }
@@ -3,6 +3,8 @@
 #include "settings.h"
 #include "oled.h"
 #include "fdsemu.h"
+#include "defrag.h"
+#include "iosched.h"
 
 static uint8_t up_pressed = 0;
 static uint8_t down_pressed = 0;
@@ -154,7 +156,12 @@ void button_check_screen_off()
     oled_send_command(OLED_CMD_SET_OFF);
     while (!(button_left_holding() || button_right_holding() ||
           button_up_holding() || button_down_holding() ||
-          (fds_get_state() != FDS_OFF && fds_get_state() != FDS_IDLE)));
+          (fds_get_state() != FDS_OFF && fds_get_state() != FDS_IDLE)))
+    {
+      // use idle time to defragment disk images, errors are not critical here
+      if (fds_get_state() == FDS_OFF)
+        iosched_run(defrag_step);
+    }
     // time to wake up
     oled_send_command(OLED_CMD_SET_ON);
     last_active_time = HAL_GetTick();
@@ -0,0 +1,168 @@
+#include <string.h>
+#include <stdio.h>
+#include "crashdump.h"
+#include "fdsemu.h"
+
+extern uint32_t _estack;
+
+static CRASH_DUMP crash_dump;
+
+// hard fault entry, find the stack with exception frame and pass it to crash_dump_save()
+__attribute__((naked)) void HardFault_Handler(void)
+{
+  __asm volatile(
+      "movs r0, #4\n"
+      "mov r1, lr\n"
+      "tst r0, r1\n"
+      "beq 1f\n"
+      "mrs r0, psp\n"
+      "b 2f\n"
+      "1:\n"
+      "mrs r0, msp\n"
+      "2:\n"
+      "ldr r2, =crash_dump_save\n"
+      "bx r2\n"
+      ".ltorg\n");
+}
+
+static HAL_StatusTypeDef crash_dump_erase()
+{
+  HAL_StatusTypeDef r;
+  FLASH_EraseInitTypeDef erase_init_struct;
+  uint32_t sector_error = 0;
+
+  // unlock flash
+  r = HAL_FLASH_Unlock();
+  if (r != HAL_OK) return r;
+
+  // erase flash page
+  erase_init_struct.TypeErase = FLASH_TYPEERASE_PAGES;
+  erase_init_struct.Banks = ((CRASH_DUMP_FLASH_OFFSET - 0x08000000) / FLASH_BANK_SIZE == 0) ? FLASH_BANK_1 : FLASH_BANK_2;
+  erase_init_struct.Page = ((CRASH_DUMP_FLASH_OFFSET - 0x08000000) / FLASH_PAGE_SIZE) % FLASH_PAGE_NB;
+  erase_init_struct.NbPages = 1;
+  r = HAL_FLASHEx_Erase(&erase_init_struct, &sector_error);
+  if (r != HAL_OK)
+  {
+    HAL_FLASH_Lock();
+    return r;
+  }
+
+  return HAL_FLASH_Lock();
+}
+
+// called from the hard fault handler: store registers, emulator state and perf counters to flash and reboot
+__attribute__((used, noreturn)) void crash_dump_save(uint32_t *frame, uint32_t exc_return)
+{
+  int i;
+
+  __disable_irq();
+  memset(&crash_dump, 0, sizeof(crash_dump));
+  crash_dump.magic = CRASH_DUMP_MAGIC;
+  crash_dump.sp = (uint32_t)frame;
+  crash_dump.exc_return = exc_return;
+  // do not touch broken stack pointer
+  if ((uint32_t)frame >= SRAM_BASE && (uint32_t)frame + 8 * sizeof(uint32_t) <= (uint32_t)&_estack)
+  {
+    crash_dump.r0 = frame[0];
+    crash_dump.r1 = frame[1];
+    crash_dump.r2 = frame[2];
+    crash_dump.r3 = frame[3];
+    crash_dump.r12 = frame[4];
+    crash_dump.lr = frame[5];
+    crash_dump.pc = frame[6];
+    crash_dump.xpsr = frame[7];
+  }
+  crash_dump.icsr = SCB->ICSR;
+  crash_dump.shcsr = SCB->SHCSR;
+  crash_dump.tick = HAL_GetTick();
+  crash_dump.fds_state = fds_get_state();
+  crash_dump.fds_head_position = fds_get_head_position();
+  crash_dump.fds_used_space = fds_get_used_space();
+  crash_dump.fds_block_count = fds_get_block_count();
+  memcpy(crash_dump.perf, (void*)perf_counters, sizeof(crash_dump.perf));
+
+  // flash operations are polling, so they work without interrupts
+  if (crash_dump_erase() == HAL_OK && HAL_FLASH_Unlock() == HAL_OK)
+  {
+    for (i = 0; i < sizeof(crash_dump); i += sizeof(uint64_t))
+    {
+      uint64_t dw = 0;
+      memcpy(&dw, (uint8_t*)&crash_dump + i, sizeof(crash_dump) - i < sizeof(uint64_t) ? sizeof(crash_dump) - i : sizeof(uint64_t));
+      if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, CRASH_DUMP_FLASH_OFFSET + i, dw) != HAL_OK)
+        break;
+    }
+    HAL_FLASH_Lock();
+  }
+
+  NVIC_SystemReset();
+  while (1);
+}
+
+// copy crash dump from flash to the text file on SD card if any
+FRESULT crash_dump_export(uint8_t *found)
+{
+  FRESULT fr;
+  FIL fp;
+  UINT bw;
+  char line[96];
+  int i, l;
+  CRASH_DUMP *dump = (CRASH_DUMP*)CRASH_DUMP_FLASH_OFFSET;
+
+  *found = 0;
+  if (dump->magic != CRASH_DUMP_MAGIC)
+    return FR_OK;
+  *found = 1;
+
+  fr = f_open(&fp, CRASH_DUMP_FILE, FA_OPEN_APPEND | FA_WRITE);
+  if (fr != FR_OK)
+    return fr;
+  l = sprintf(line, "hard fault at %lu ms\r\n", (unsigned long)dump->tick);
+  fr = f_write(&fp, line, l, &bw);
+  if (fr == FR_OK)
+  {
+    l = sprintf(line, "r0  %08lX r1  %08lX r2   %08lX r3   %08lX\r\n",
+        (unsigned long)dump->r0, (unsigned long)dump->r1, (unsigned long)dump->r2, (unsigned long)dump->r3);
+    fr = f_write(&fp, line, l, &bw);
+  }
+  if (fr == FR_OK)
+  {
+    l = sprintf(line, "r12 %08lX lr  %08lX pc   %08lX xpsr %08lX\r\n",
+        (unsigned long)dump->r12, (unsigned long)dump->lr, (unsigned long)dump->pc, (unsigned long)dump->xpsr);
+    fr = f_write(&fp, line, l, &bw);
+  }
+  if (fr == FR_OK)
+  {
+    l = sprintf(line, "sp  %08lX exc %08lX icsr %08lX shcsr %08lX\r\n",
+        (unsigned long)dump->sp, (unsigned long)dump->exc_return, (unsigned long)dump->icsr, (unsigned long)dump->shcsr);
+    fr = f_write(&fp, line, l, &bw);
+  }
+  if (fr == FR_OK)
+  {
+    l = sprintf(line, "fds state %lu, head %ld, used %ld, blocks %ld\r\n",
+        (unsigned long)dump->fds_state, (long)dump->fds_head_position, (long)dump->fds_used_space, (long)dump->fds_block_count);
+    fr = f_write(&fp, line, l, &bw);
+  }
+  for (i = 0; (fr == FR_OK) && (i < PERF_COUNTER_COUNT); i++)
+  {
+    l = sprintf(line, "perf %-16s %10lu %10lu %10lu\r\n", perf_get_name(i),
+        (unsigned long)dump->perf[i].calls,
+        (unsigned long)(dump->perf[i].calls ? dump->perf[i].cycles / dump->perf[i].calls : 0),
+        (unsigned long)dump->perf[i].max);
+    fr = f_write(&fp, line, l, &bw);
+  }
+  if (fr == FR_OK)
+    fr = f_write(&fp, "\r\n", 2, &bw);
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    return fr;
+  }
+  fr = f_close(&fp);
+  if (fr != FR_OK)
+    return fr;
+
+  // exported, do not export it again
+  if (crash_dump_erase() != HAL_OK)
+    return FR_DISK_ERR;
+  return FR_OK;
+}
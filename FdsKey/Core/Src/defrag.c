@@ -0,0 +1,455 @@
+#include <string.h>
+#include <stdlib.h>
+#include "defrag.h"
+#include "iosched.h"
+
+static DEFRAG_STATE defrag_state;
+static uint8_t defrag_loaded = 0;
+static uint8_t defrag_finished = 0;
+static DIR defrag_dir;
+static uint8_t defrag_dir_open = 0;
+
+// disk images, backups and Everdrive saves
+static uint8_t defrag_is_image(char *name)
+{
+  int l = strlen(name);
+  if (l >= 4 && !strcasecmp(name + l - 4, ".fds"))
+    return 1;
+  if (l >= 4 && !strcasecmp(name + l - 4, ".bak"))
+    return 1;
+  if (!strcasecmp(name, "bram.srm"))
+    return 1;
+  return 0;
+}
+
+static FRESULT defrag_state_save()
+{
+  FRESULT fr;
+  FIL fp;
+  UINT bw;
+  uint8_t created = 0;
+
+  fr = f_open(&fp, DEFRAG_STATE_FILE, FA_OPEN_EXISTING | FA_WRITE);
+  if (fr == FR_NO_FILE)
+  {
+    fr = f_open(&fp, DEFRAG_STATE_FILE, FA_CREATE_NEW | FA_WRITE);
+    created = 1;
+  }
+  if (fr != FR_OK)
+    return fr;
+  fr = f_write(&fp, &defrag_state, sizeof(defrag_state), &bw);
+  if (fr == FR_OK && bw != sizeof(defrag_state))
+    fr = FR_DENIED;
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    return fr;
+  }
+  fr = f_close(&fp);
+  if (fr != FR_OK)
+    return fr;
+  // hide it from the file browser
+  if (created)
+    fr = f_chmod(DEFRAG_STATE_FILE, AM_HID, AM_HID);
+  return fr;
+}
+
+// load progress or start from the beginning
+static FRESULT defrag_state_load()
+{
+  FRESULT fr;
+  FIL fp;
+  UINT br = 0;
+
+  fr = f_open(&fp, DEFRAG_STATE_FILE, FA_READ);
+  if (fr == FR_OK)
+  {
+    fr = f_read(&fp, &defrag_state, sizeof(defrag_state), &br);
+    f_close(&fp);
+  }
+  if (fr == FR_NO_FILE)
+    fr = FR_OK;
+  if (fr != FR_OK)
+    return fr;
+  if (br != sizeof(defrag_state) || defrag_state.magic != DEFRAG_STATE_MAGIC
+      || defrag_state.cursor.depth >= DEFRAG_MAX_DEPTH)
+  {
+    memset(&defrag_state, 0, sizeof(defrag_state));
+    defrag_state.magic = DEFRAG_STATE_MAGIC;
+  }
+  defrag_state.cursor.dir[sizeof(defrag_state.cursor.dir) - 1] = 0;
+  defrag_state.file[sizeof(defrag_state.file) - 1] = 0;
+  return FR_OK;
+}
+
+static void defrag_close_dir()
+{
+  if (defrag_dir_open)
+    f_closedir(&defrag_dir);
+  defrag_dir_open = 0;
+}
+
+// read next file entry, walks into subdirectories, end is set when the whole card is scanned
+static FRESULT defrag_next_file(DEFRAG_CURSOR *cursor, FILINFO *fno, uint8_t *end)
+{
+  FRESULT fr;
+  int i;
+  char *p;
+
+  *end = 0;
+  while (1)
+  {
+    if (!defrag_dir_open)
+    {
+      // reopen directory and skip already processed entries
+      fr = f_opendir(&defrag_dir, cursor->dir);
+      if (fr != FR_OK)
+        return fr;
+      defrag_dir_open = 1;
+      for (i = 0; i < cursor->index[cursor->depth]; i++)
+      {
+        fr = f_readdir(&defrag_dir, fno);
+        if (fr != FR_OK)
+          return fr;
+        if (!fno->fname[0])
+          break;
+      }
+    }
+    fr = f_readdir(&defrag_dir, fno);
+    if (fr != FR_OK)
+      return fr;
+    if (!fno->fname[0])
+    {
+      // end of directory
+      defrag_close_dir();
+      if (!cursor->depth)
+      {
+        *end = 1;
+        return FR_OK;
+      }
+      // back to the parent
+      p = strrchr(cursor->dir, '\\');
+      if (p)
+        *p = 0;
+      cursor->depth--;
+      cursor->index[cursor->depth]++;
+      continue;
+    }
+    if (fno->fattrib & (AM_HID | AM_SYS))
+    {
+      cursor->index[cursor->depth]++;
+      continue;
+    }
+    if (fno->fattrib & AM_DIR)
+    {
+      if (cursor->depth + 1 >= DEFRAG_MAX_DEPTH
+          || strlen(cursor->dir) + 1 + strlen(fno->fname) + 1 > sizeof(cursor->dir))
+      {
+        cursor->index[cursor->depth]++;
+        continue;
+      }
+      // enter subdirectory
+      defrag_close_dir();
+      strcat(cursor->dir, "\\");
+      strcat(cursor->dir, fno->fname);
+      cursor->depth++;
+      cursor->index[cursor->depth] = 0;
+      continue;
+    }
+    cursor->index[cursor->depth]++;
+    return FR_OK;
+  }
+}
+
+// count file fragments using fast seek link map
+static FRESULT defrag_count_fragments(char *path, int *fragments)
+{
+  FRESULT fr;
+  FIL fp;
+  DWORD link_map[DEFRAG_MAX_FRAGMENTS * 2 + 1];
+
+  fr = f_open(&fp, path, FA_READ);
+  if (fr != FR_OK)
+    return fr;
+  fp.cltbl = link_map;
+  link_map[0] = sizeof(link_map) / sizeof(link_map[0]);
+  fr = f_lseek(&fp, CREATE_LINKMAP);
+  f_close(&fp);
+  // required size is returned even if table is too small
+  if (fr != FR_OK && fr != FR_NOT_ENOUGH_CORE)
+    return fr;
+  *fragments = (link_map[0] - 1) / 2;
+  return FR_OK;
+}
+
+// replace original file with the contiguous copy,
+// the copy is dropped if the original was changed after copying
+static FRESULT defrag_swap()
+{
+  FRESULT fr;
+  FILINFO fno;
+
+  fr = f_stat(DEFRAG_TEMP_FILE, &fno);
+  if (fr == FR_NO_FILE)
+  {
+    // already renamed, only the state was not saved
+    defrag_state.phase = DEFRAG_PHASE_SCAN;
+    defrag_state.relocated++;
+    return defrag_state_save();
+  }
+  if (fr != FR_OK)
+    return fr;
+  fr = f_stat(defrag_state.file, &fno);
+  if (fr != FR_OK && fr != FR_NO_FILE)
+    return fr;
+  if (fr == FR_OK && (fno.fsize != defrag_state.fsize
+      || fno.fdate != defrag_state.fdate || fno.ftime != defrag_state.ftime))
+  {
+    // stale copy
+    fr = f_unlink(DEFRAG_TEMP_FILE);
+    if (fr != FR_OK)
+      return fr;
+  } else {
+    if (fr == FR_OK)
+    {
+      fr = f_unlink(defrag_state.file);
+      if (fr != FR_OK)
+        return fr;
+    }
+    fr = f_rename(DEFRAG_TEMP_FILE, defrag_state.file);
+    if (fr != FR_OK)
+      return fr;
+    fr = f_chmod(defrag_state.file, 0, AM_HID);
+    if (fr != FR_OK)
+      return fr;
+    defrag_state.relocated++;
+  }
+  defrag_state.phase = DEFRAG_PHASE_SCAN;
+  return defrag_state_save();
+}
+
+// copy file into contiguous clusters, then swap it with the original,
+// preempted is set if copying is interrupted by more important SD access
+static FRESULT defrag_relocate(char *path, FILINFO *fno, uint8_t *preempted)
+{
+  FRESULT fr;
+  FIL fp_src, fp_dst;
+  UINT br, bw;
+  uint8_t *buffer;
+
+  *preempted = 0;
+  fr = f_open(&fp_dst, DEFRAG_TEMP_FILE, FA_CREATE_ALWAYS | FA_WRITE);
+  if (fr != FR_OK)
+    return fr;
+  fr = f_expand(&fp_dst, fno->fsize, 1);
+  if (fr == FR_DENIED)
+  {
+    // no contiguous space, skip this file
+    f_close(&fp_dst);
+    return f_unlink(DEFRAG_TEMP_FILE);
+  }
+  if (fr != FR_OK)
+  {
+    f_close(&fp_dst);
+    return fr;
+  }
+  fr = f_open(&fp_src, path, FA_READ);
+  if (fr != FR_OK)
+  {
+    f_close(&fp_dst);
+    return fr;
+  }
+  buffer = malloc(DEFRAG_BUFFER_SIZE);
+  if (!buffer)
+  {
+    f_close(&fp_src);
+    f_close(&fp_dst);
+    return FR_NOT_ENOUGH_CORE;
+  }
+  do
+  {
+    if (iosched_should_yield())
+    {
+      *preempted = 1;
+      break;
+    }
+    fr = f_read(&fp_src, buffer, DEFRAG_BUFFER_SIZE, &br);
+    if (fr != FR_OK)
+      break;
+    fr = f_write(&fp_dst, buffer, br, &bw);
+    if (fr == FR_OK && bw != br)
+      fr = FR_DENIED;
+  } while (fr == FR_OK && br == DEFRAG_BUFFER_SIZE);
+  free(buffer);
+  f_close(&fp_src);
+  if (fr != FR_OK)
+  {
+    f_close(&fp_dst);
+    return fr;
+  }
+  if (*preempted)
+  {
+    // drop incomplete copy, file will be copied again next time
+    f_close(&fp_dst);
+    return f_unlink(DEFRAG_TEMP_FILE);
+  }
+  fr = f_close(&fp_dst);
+  if (fr != FR_OK)
+    return fr;
+  // keep timestamp, so block cache entry is still valid
+  fr = f_utime(DEFRAG_TEMP_FILE, fno);
+  if (fr != FR_OK)
+    return fr;
+  fr = f_chmod(DEFRAG_TEMP_FILE, AM_HID, AM_HID);
+  if (fr != FR_OK)
+    return fr;
+
+  // copy is complete, remember it before touching the original
+  strcpy(defrag_state.file, path);
+  defrag_state.fsize = fno->fsize;
+  defrag_state.fdate = fno->fdate;
+  defrag_state.ftime = fno->ftime;
+  defrag_state.phase = DEFRAG_PHASE_COPIED;
+  fr = defrag_state_save();
+  if (fr != FR_OK)
+    return fr;
+  return defrag_swap();
+}
+
+// finish or roll back the swap interrupted by power loss,
+// call it on start before any image can be loaded and saved
+FRESULT defrag_recover()
+{
+#ifdef DEFRAG_IDLE
+  FRESULT fr;
+
+  defrag_loaded = 1;
+  fr = defrag_state_load();
+  if (fr == FR_OK && defrag_state.phase == DEFRAG_PHASE_COPIED)
+    fr = defrag_swap();
+  if (fr == FR_OK)
+  {
+    // incomplete copy
+    fr = f_unlink(DEFRAG_TEMP_FILE);
+    if (fr == FR_NO_FILE)
+      fr = FR_OK;
+  }
+  if (fr != FR_OK)
+    defrag_finished = 1;
+  return fr;
+#else
+  return FR_OK;
+#endif
+}
+
+// do some defragmentation work, run it with iosched_run() when no image is loaded,
+// it returns after single file relocation or DEFRAG_TIME_SLICE of scanning
+FRESULT defrag_step()
+{
+#ifdef DEFRAG_IDLE
+  FRESULT fr;
+  FILINFO fno;
+  char path[DEFRAG_MAX_PATH_LENGTH];
+  int fragments;
+  uint8_t end;
+  uint8_t preempted;
+  uint32_t start_time = HAL_GetTick();
+
+  fr = FR_OK;
+  if (defrag_finished)
+    return FR_OK;
+
+  if (!defrag_loaded)
+  {
+    fr = defrag_recover();
+    if (fr != FR_OK)
+      return fr;
+  }
+
+  while (HAL_GetTick() - start_time < DEFRAG_TIME_SLICE && !iosched_should_yield())
+  {
+    fr = defrag_next_file(&defrag_state.cursor, &fno, &end);
+    if (fr != FR_OK)
+      break;
+    if (end)
+    {
+      // whole card is processed, next pass will be after reboot
+      memset(&defrag_state.cursor, 0, sizeof(defrag_state.cursor));
+      defrag_finished = 1;
+      fr = defrag_state_save();
+      break;
+    }
+    if ((fno.fattrib & AM_RDO) || !defrag_is_image(fno.fname)
+        || strlen(defrag_state.cursor.dir) + 1 + strlen(fno.fname) + 1 > sizeof(path))
+      continue;
+    strcpy(path, defrag_state.cursor.dir);
+    strcat(path, "\\");
+    strcat(path, fno.fname);
+    fr = defrag_count_fragments(path, &fragments);
+    if (fr != FR_OK)
+      break;
+    if (fragments > 1)
+    {
+      defrag_close_dir();
+      fr = defrag_relocate(path, &fno, &preempted);
+      if (fr == FR_OK && preempted)
+        // read this entry again next time
+        defrag_state.cursor.index[defrag_state.cursor.depth]--;
+      break;
+    }
+  }
+  defrag_close_dir();
+  // position is saved only on phase changes, scan is repeated from there after reboot
+  if (fr != FR_OK)
+    defrag_finished = 1;
+  return fr;
+#else
+  return FR_OK;
+#endif
+}
+
+// scan whole card and count fragmented images
+FRESULT defrag_report(DEFRAG_REPORT *report)
+{
+  FRESULT fr;
+  FILINFO fno;
+  DEFRAG_CURSOR cursor;
+  char path[DEFRAG_MAX_PATH_LENGTH];
+  int fragments;
+  uint8_t end;
+
+  memset(report, 0, sizeof(*report));
+  memset(&cursor, 0, sizeof(cursor));
+  if (!defrag_loaded)
+  {
+    fr = defrag_state_load();
+    if (fr != FR_OK)
+      return fr;
+  }
+  report->relocated = defrag_state.relocated;
+
+  defrag_close_dir();
+  while (1)
+  {
+    fr = defrag_next_file(&cursor, &fno, &end);
+    if (fr != FR_OK || end)
+      break;
+    if (!defrag_is_image(fno.fname)
+        || strlen(cursor.dir) + 1 + strlen(fno.fname) + 1 > sizeof(path))
+      continue;
+    strcpy(path, cursor.dir);
+    strcat(path, "\\");
+    strcat(path, fno.fname);
+    fr = defrag_count_fragments(path, &fragments);
+    if (fr != FR_OK)
+      break;
+    report->images++;
+    if (fragments > 1)
+    {
+      report->fragmented++;
+      report->fragments += fragments;
+    }
+  }
+  defrag_close_dir();
+  return fr;
+}
@@ -0,0 +1,110 @@
+#include <string.h>
+#include "dumpcheck.h"
+
+// half-byte table is enough, the side is hashed block by block behind the copier
+static const uint32_t dump_check_crc_table[16] = {
+  0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+  0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+// update CRC32 with the data, start with 0
+uint32_t dump_check_crc32(uint32_t crc, const uint8_t *data, uint32_t size)
+{
+  crc = ~crc;
+  while (size--)
+  {
+    crc ^= *data++;
+    crc = (crc >> 4) ^ dump_check_crc_table[crc & 0x0F];
+    crc = (crc >> 4) ^ dump_check_crc_table[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+// parse hex number, returns pointer after it or NULL
+static const char* dump_check_parse_hex(const char *s, uint8_t *out, int size)
+{
+  int i, v;
+  char c;
+
+  for (i = 0; i < size * 2; i++)
+  {
+    c = *s++;
+    if (c >= '0' && c <= '9')
+      v = c - '0';
+    else if (c >= 'A' && c <= 'F')
+      v = c - 'A' + 10;
+    else if (c >= 'a' && c <= 'f')
+      v = c - 'a' + 10;
+    else
+      return NULL;
+    if (i % 2 == 0)
+      out[i / 2] = v << 4;
+    else
+      out[i / 2] |= v;
+  }
+  return s;
+}
+
+// check single database line, returns 0 if the line is not about this disk
+static DUMP_CHECK_RESULT dump_check_line(const char *line, const uint8_t *disk_id, uint32_t crc)
+{
+  uint8_t id[DUMP_CHECK_ID_SIZE];
+  uint8_t crc_bytes[4];
+
+  while (*line == ' ' || *line == '\t') line++;
+  line = dump_check_parse_hex(line, id, sizeof(id));
+  if (!line || (*line != ' ' && *line != '\t'))
+    return DUMP_CHECK_NONE;
+  if (memcmp(id, disk_id, sizeof(id)) != 0)
+    return DUMP_CHECK_NONE;
+  while (*line == ' ' || *line == '\t') line++;
+  if (!dump_check_parse_hex(line, crc_bytes, sizeof(crc_bytes)))
+    return DUMP_CHECK_NONE;
+  if (((uint32_t)crc_bytes[0] << 24 | (uint32_t)crc_bytes[1] << 16 | (uint32_t)crc_bytes[2] << 8 | crc_bytes[3]) == crc)
+    return DUMP_CHECK_MATCH;
+  return DUMP_CHECK_MISMATCH;
+}
+
+// search the database for the side, disk can be listed multiple times for different revisions of the dump
+DUMP_CHECK_RESULT dump_check_lookup(const uint8_t *disk_id, uint32_t crc)
+{
+  FRESULT fr;
+  FIL fp;
+  UINT br, i;
+  char buff[256];
+  char line[DUMP_CHECK_MAX_LINE + 1];
+  int l = 0;
+  DUMP_CHECK_RESULT result = DUMP_CHECK_UNKNOWN, r;
+
+  // nothing to compare with, no result is shown
+  fr = f_open(&fp, DUMP_CHECK_FILE, FA_READ);
+  if (fr != FR_OK)
+    return DUMP_CHECK_NONE;
+  while (result != DUMP_CHECK_MATCH)
+  {
+    fr = f_read(&fp, buff, sizeof(buff), &br);
+    if (fr != FR_OK || !br)
+      break;
+    for (i = 0; i < br; i++)
+    {
+      if (buff[i] != '\r' && buff[i] != '\n')
+      {
+        if (l < DUMP_CHECK_MAX_LINE)
+          line[l++] = buff[i];
+        continue;
+      }
+      line[l] = 0;
+      l = 0;
+      r = dump_check_line(line, disk_id, crc);
+      if (r > result)
+        result = r;
+    }
+  }
+  f_close(&fp);
+  // last line can be without line break
+  line[l] = 0;
+  r = dump_check_line(line, disk_id, crc);
+  if (r > result)
+    result = r;
+  return result;
+}
@@ -10,13 +10,42 @@
 #include "ff.h"			/* Obtains integer types */
 #include "diskio.h"		/* Declarations of disk functions */
 #include "sdcard.h"
+#include "sdprofile.h"
 #include "splash.h"
+#include "arbiter.h"
+#include "iosched.h"
+#include "perf.h"
+#include "generation.h"
+#include "brownout.h"
 
 /* Definitions of physical drive number for each drive */
 #define DEV_RAM		0	/* Example: Map Ramdisk to physical drive 0 */
 #define DEV_MMC		1	/* Example: Map MMC/SD card to physical drive 1 */
 #define DEV_USB		2	/* Example: Map USB MSD to physical drive 2 */
 
+// transfer retries before the card reinit
+#define DISK_RETRIES 2
+// whole recovery ladder time limit, milliseconds, single reinit is not interrupted
+#define DISK_RECOVERY_TIMEOUT 2000
+
+// non-zero while SD card transfer is in progress
+static volatile BYTE disk_busy = 0;
+// function to call from the main thread right after the current transfer
+static void (* volatile disk_idle_callback)(void) = 0;
+
+static void disk_release()
+{
+  void (*callback)(void);
+
+  disk_busy = 0;
+  callback = disk_idle_callback;
+  if (callback)
+  {
+    disk_idle_callback = 0;
+    callback();
+  }
+}
+
 
 /*-----------------------------------------------------------------------*/
 /* Get Drive Status                                                      */
@@ -39,7 +68,7 @@ DSTATUS disk_initialize (
 	BYTE pdrv				/* Physical drive nmuber to identify the drive */
 )
 {
-  SD_RESULT r = SD_init_try_speed();
+  SD_RESULT r = sd_profile_init();
   if (r != SD_RES_OK)
     show_error_screen_sd(r, 1);
   return RES_OK;
@@ -47,6 +76,139 @@ DSTATUS disk_initialize (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* SD card error recovery                                                */
+/*-----------------------------------------------------------------------*/
+
+static DISK_ERROR_STATS disk_error_stats;
+
+static SD_RESULT disk_read_try(BYTE *buff, LBA_t sector, UINT count)
+{
+  SD_RESULT r;
+
+  if (count == 1)
+    return SD_read_single_block(sector, buff);
+  r = SD_read_begin(sector);
+  if (r != SD_RES_OK)
+    return r;
+  while (count) {
+    r = SD_read_data(buff);
+    if (r != SD_RES_OK)
+    {
+      // stop transmission, so the card is ready for the retry
+      SD_read_end();
+      return r;
+    }
+    buff += FF_MIN_SS;
+    count--;
+  }
+  return SD_read_end();
+}
+
+#if FF_FS_READONLY == 0
+static SD_RESULT disk_write_try(const BYTE *buff, LBA_t sector, UINT count)
+{
+  SD_RESULT r;
+
+  if (count == 1)
+    return SD_write_single_block(sector, buff);
+  r = SD_write_begin(sector);
+  if (r != SD_RES_OK)
+    return r;
+  while (count) {
+    r = SD_write_data(buff);
+    if (r != SD_RES_OK)
+    {
+      SD_write_end();
+      return r;
+    }
+    buff += FF_MIN_SS;
+    count--;
+  }
+  return SD_write_end();
+}
+#endif
+
+static SD_RESULT disk_try(BYTE *rbuff, const BYTE *wbuff, LBA_t sector, UINT count)
+{
+#if FF_FS_READONLY == 0
+  if (wbuff)
+    return disk_write_try(wbuff, sector, count);
+#endif
+  return disk_read_try(rbuff, sector, count);
+}
+
+// power is failing and the journal waits for the card, or card is removed
+static uint8_t disk_recovery_interrupted()
+{
+  return disk_idle_callback || brownout_is_low()
+      || HAL_GPIO_ReadPin(SD_DTCT_GPIO_Port, SD_DTCT_Pin);
+}
+
+static uint8_t disk_recovery_aborted(uint32_t start_time)
+{
+  return HAL_GetTick() - start_time >= DISK_RECOVERY_TIMEOUT || disk_recovery_interrupted();
+}
+
+// transfer with the recovery ladder: retry, reinit at the same speed, reinit at lower speeds,
+// rewriting the same blocks again is harmless so the whole transfer is repeated every time
+static DRESULT disk_transfer(BYTE *rbuff, const BYTE *wbuff, LBA_t sector, UINT count)
+{
+  SD_RESULT r;
+  int i;
+  uint32_t start_time;
+
+  r = disk_try(rbuff, wbuff, sector, count);
+  if (r == SD_RES_OK)
+    return RES_OK;
+
+  start_time = HAL_GetTick();
+  for (i = 0; i < DISK_RETRIES && !disk_recovery_aborted(start_time); i++)
+  {
+    disk_error_stats.retries++;
+    r = disk_try(rbuff, wbuff, sector, count);
+    if (r == SD_RES_OK)
+      return RES_OK;
+  }
+
+  if (!disk_recovery_aborted(start_time))
+  {
+    disk_error_stats.reinits++;
+    r = SD_init_at_speed(SD_get_spi_speed(), SD_INIT_FAST_TRIES);
+    if (r == SD_RES_OK)
+      r = disk_try(rbuff, wbuff, sector, count);
+    if (r == SD_RES_OK)
+      return RES_OK;
+  }
+
+  // card stays at the lower speed until the next power cycle
+  while (SD_get_spi_speed() != SD_LOWEST_SPEED && !disk_recovery_aborted(start_time))
+  {
+    disk_error_stats.slowdowns++;
+    r = SD_init_at_speed(SD_get_slower_speed(SD_get_spi_speed()), SD_INIT_FAST_TRIES);
+    if (r == SD_RES_OK)
+      r = disk_try(rbuff, wbuff, sector, count);
+    if (r == SD_RES_OK)
+      return RES_OK;
+  }
+
+  disk_error_stats.failures++;
+  disk_error_stats.last_error = r;
+  // remembered parameters may be the reason, do the full search next time,
+  // but flash is not erased when power is failing
+  if (!disk_recovery_interrupted())
+    sd_profile_forget();
+  return RES_ERROR;
+}
+
+// SD card error counters since power on
+const DISK_ERROR_STATS* disk_get_error_stats (void)
+{
+  return &disk_error_stats;
+}
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Read Sector(s)                                                        */
 /*-----------------------------------------------------------------------*/
@@ -58,28 +220,17 @@ DRESULT disk_read (
 	UINT count		/* Number of sectors to read */
 )
 {
-  SD_RESULT r;
-  if (count == 1)
-  {
-    r = SD_read_single_block(sector, buff);
-    if (r != SD_RES_OK)
-      show_error_screen_sd(r, 1);
-  } else {
-    r = SD_read_begin(sector);
-    if (r != SD_RES_OK)
-      show_error_screen_sd(r, 1);
-    while (count) {
-      r = SD_read_data(buff);
-      if (r != SD_RES_OK)
-        show_error_screen_sd(r, 1);
-      buff += FF_MIN_SS;
-      count--;
-    }
-    r = SD_read_end();
-    if (r != SD_RES_OK)
-      show_error_screen_sd(r, 1);
-  }
-  return RES_OK;
+  DRESULT res;
+  // emulator's own transfers are never deferred, the others wait for it
+  if (iosched_get_class() != IOSCHED_EMULATOR)
+    arbiter_wait(ARBITER_SD);
+  PERF_START();
+  disk_busy = 1;
+  res = disk_transfer(buff, 0, sector, count);
+  PERF_STOP(PERF_IO_EMULATOR + iosched_get_class());
+  iosched_transfer_done();
+  disk_release();
+  return res;
 }
 
 
@@ -97,28 +248,16 @@ DRESULT disk_write (
 	UINT count			/* Number of sectors to write */
 )
 {
-  SD_RESULT r;
-  if (count == 1)
-  {
-    r = SD_write_single_block(sector, buff);
-    if (r != SD_RES_OK)
-      show_error_screen_sd(r, 1);
-  } else {
-    r = SD_write_begin(sector);
-    if (r != SD_RES_OK)
-      show_error_screen_sd(r, 1);
-    while (count) {
-      r = SD_write_data(buff);
-      if (r != SD_RES_OK)
-        show_error_screen_sd(r, 1);
-      buff += FF_MIN_SS;
-      count--;
-    }
-    r = SD_write_end();
-    if (r != SD_RES_OK)
-      show_error_screen_sd(r, 1);
-  }
-  return RES_OK;
+  DRESULT res;
+  if (iosched_get_class() != IOSCHED_EMULATOR)
+    arbiter_wait(ARBITER_SD);
+  PERF_START();
+  disk_busy = 1;
+  res = disk_transfer(0, buff, sector, count);
+  PERF_STOP(PERF_IO_EMULATOR + iosched_get_class());
+  iosched_transfer_done();
+  disk_release();
+  return res;
 }
 
 #endif
@@ -145,7 +284,25 @@ DRESULT disk_ioctl (
   return RES_ERROR;
 }
 
+/*-----------------------------------------------------------------------*/
+/* SD card access from interrupts                                        */
+/*-----------------------------------------------------------------------*/
+
+// returns non-zero if SD card is being accessed by the main thread
+BYTE disk_is_busy (void)
+{
+  return disk_busy;
+}
+
+// schedule callback to be called when the current transfer is finished,
+// it allows interrupt handler to access SD card without breaking main thread transfer
+void disk_call_when_idle (void (*callback)(void))
+{
+  disk_idle_callback = callback;
+}
+
+// there is no RTC, monotonic generation is used instead of time
 DWORD get_fattime (void) /* Get current time */
 {
-  return 0;
+  return generation_to_fattime(generation_next());
 }
@@ -278,6 +278,11 @@ FATFS USERFatFs;
 #endif
 
 
+/* Path cache controls */
+#if FF_PATH_CACHE && FF_USE_LFN == 0
+#error FF_PATH_CACHE requires LFN
+#endif
+
 /* File lock controls */
 #if FF_FS_LOCK
 #if FF_FS_READONLY
@@ -2460,6 +2465,102 @@ static FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 
 
 
+#if FF_PATH_CACHE
+/*-----------------------------------------------------------------------*/
+/* Path cache - Locations of the recently resolved objects               */
+/*-----------------------------------------------------------------------*/
+
+typedef struct {
+	DWORD	hash;		/* Hash of the path string (0:Empty slot) */
+	UINT	len;		/* Length of the path string */
+	WORD	id;			/* Volume mount ID */
+	FFOBJID	obj;		/* Containing directory */
+	DWORD	ofs;		/* Offset of the entry block in the containing directory */
+	DWORD	clust;		/* Cluster of the entry block (valid if sect != 0) */
+	LBA_t	sect;		/* Sector of the entry block (0:Not known yet) */
+	TCHAR	path[FF_PATH_CACHE_LEN];	/* Path string, hash collisions must not match */
+} PATHCACHE;
+
+static PATHCACHE PathCache[FF_PATH_CACHE];
+static UINT PathCacheNext;	/* Next slot to replace */
+
+
+static void path_cache_clear (void)
+{
+	memset(PathCache, 0, sizeof PathCache);
+}
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Check the object at the known location           */
+/*-----------------------------------------------------------------------*/
+/* Same name matching as dir_find() but only the single entry block at the
+/  current position is tested. */
+
+static FRESULT dir_find_at (	/* FR_OK(0):matched, FR_NO_FILE:the entry has been changed, other:error */
+	DIR* dp					/* Pointer to the directory object with the file name */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	DWORD ofs = dp->dptr;
+	BYTE c, a, ord, sum;
+
+#if FF_FS_EXFAT
+	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
+		BYTE nc;
+		UINT di, ni;
+
+		res = DIR_READ_FILE(dp);
+		if (res != FR_OK) return res;
+		if (dp->blk_ofs != ofs) return FR_NO_FILE;	/* The entry block has been removed */
+#if FF_MAX_LFN < 255
+		if (fs->dirbuf[XDIR_NumName] > FF_MAX_LFN) return FR_NO_FILE;
+#endif
+		if (ld_word(fs->dirbuf + XDIR_NameHash) != xname_sum(fs->lfnbuf)) return FR_NO_FILE;
+		for (nc = fs->dirbuf[XDIR_NumName], di = SZDIRE * 2, ni = 0; nc; nc--, di += 2, ni++) {	/* Compare the name */
+			if ((di % SZDIRE) == 0) di += 2;
+			if (ff_wtoupper(ld_word(fs->dirbuf + di)) != ff_wtoupper(fs->lfnbuf[ni])) break;
+		}
+		return (nc == 0 && !fs->lfnbuf[ni]) ? FR_OK : FR_NO_FILE;
+	}
+#endif
+	/* On the FAT/FAT32 volume */
+	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;
+	do {
+		res = move_window(fs, dp->sect);
+		if (res != FR_OK) break;
+		c = dp->dir[DIR_Name];
+		dp->obj.attr = a = dp->dir[DIR_Attr] & AM_MASK;
+		if (c == 0 || c == DDEM || ((a & AM_VOL) && a != AM_LFN)) return FR_NO_FILE;	/* The entry block has been removed */
+		if (a == AM_LFN) {			/* An LFN entry is found */
+			if (dp->fn[NSFLAG] & NS_NOLFN) return FR_NO_FILE;
+			if (c & LLEF) {		/* Is it start of LFN sequence? */
+				sum = dp->dir[LDIR_Chksum];
+				c &= (BYTE)~LLEF; ord = c;
+				dp->blk_ofs = dp->dptr;
+			}
+			ord = (c == ord && sum == dp->dir[LDIR_Chksum] && cmp_lfn(fs->lfnbuf, dp->dir)) ? ord - 1 : 0xFF;
+			if (ord == 0xFF) return FR_NO_FILE;
+		} else {					/* An SFN entry terminates the block */
+			if (ord == 0 && sum == sum_sfn(dp->dir)) break;	/* LFN matched? */
+			if (!(dp->fn[NSFLAG] & NS_LOSS) && !memcmp(dp->dir, dp->fn, 11)) {	/* SFN matched? */
+				dp->blk_ofs = 0xFFFFFFFF;
+				break;
+			}
+			return FR_NO_FILE;
+		}
+		res = dir_next(dp, 0);	/* Next entry */
+	} while (res == FR_OK);
+
+	return res;
+}
+
+#endif /* FF_PATH_CACHE */
+
+
+
+
 #if !FF_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Register an object to the directory                                   */
@@ -2478,6 +2579,9 @@ static FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too
 
 	if (dp->fn[NSFLAG] & (NS_DOT | NS_NONAME)) return FR_INVALID_NAME;	/* Check name validity */
 	for (len = 0; fs->lfnbuf[len]; len++) ;	/* Get lfn length */
+#if FF_PATH_CACHE
+	path_cache_clear();	/* The directory may be stretched */
+#endif
 
 #if FF_FS_EXFAT
 	if (fs->fs_type == FS_EXFAT) {	/* On the exFAT volume */
@@ -2580,6 +2684,10 @@ static FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 #if FF_USE_LFN		/* LFN configuration */
 	DWORD last = dp->dptr;
 
+#if FF_PATH_CACHE
+	path_cache_clear();
+#endif
+
 	res = (dp->blk_ofs == 0xFFFFFFFF) ? FR_OK : dir_sdi(dp, dp->blk_ofs);	/* Goto top of the entry block if LFN is exist */
 	if (res == FR_OK) {
 		do {
@@ -3047,6 +3155,98 @@ static FRESULT create_name (	/* FR_OK: successful, FR_INVALID_NAME: could not cr
 
 
 
+#if FF_PATH_CACHE
+/*-----------------------------------------------------------------------*/
+/* Path cache - Find and remember the object location                    */
+/*-----------------------------------------------------------------------*/
+
+static DWORD path_hash (	/* Returns FNV-1a hash of the path, never 0 */
+	const TCHAR* path,		/* Path without heading separators */
+	UINT* len				/* Returns length of the path */
+)
+{
+	DWORD hash = 2166136261UL;
+	UINT n;
+
+	for (n = 0; (UINT)path[n] >= ' '; n++) {
+		hash = (hash ^ (DWORD)path[n]) * 16777619UL;
+	}
+	*len = n;
+	return hash ? hash : 1;
+}
+
+
+static FRESULT path_cache_find (	/* FR_OK(0):found, !=0:not cached or changed */
+	DIR* dp,						/* Directory object to return the found object */
+	const TCHAR* path				/* Path without heading separators */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	PATHCACHE *pc;
+	DWORD hash;
+	UINT len, i;
+
+	hash = path_hash(path, &len);
+	for (i = 0; i < FF_PATH_CACHE; i++) {
+		pc = &PathCache[i];
+		if (pc->hash != hash || pc->len != len || pc->obj.fs != fs || pc->id != fs->id) continue;
+		if (memcmp(pc->path, path, len * sizeof (TCHAR))) continue;
+		do {	/* Get the last segment name, directories are not searched */
+			res = create_name(dp, &path);
+			if (res != FR_OK) return res;
+		} while (!(dp->fn[NSFLAG] & NS_LAST));
+		dp->obj = pc->obj;
+		if (pc->sect) {		/* Go to the entry block without following the cluster chain */
+			dp->dptr = pc->ofs;
+			dp->clust = pc->clust;
+			dp->sect = pc->sect;
+			dp->dir = fs->win + pc->ofs % SS(fs);
+			res = FR_OK;
+		} else {
+			res = dir_sdi(dp, pc->ofs);
+			pc->clust = dp->clust;
+			pc->sect = dp->sect;
+		}
+		if (res == FR_OK) res = dir_find_at(dp);
+		if (res != FR_OK) pc->hash = 0;	/* The location is not valid anymore */
+		return res;
+	}
+	return FR_NO_FILE;
+}
+
+
+static void path_cache_store (
+	DIR* dp,				/* Directory object pointing the found object */
+	const TCHAR* path		/* Path without heading separators */
+)
+{
+	PATHCACHE *pc;
+	DWORD hash;
+	UINT len, i;
+
+	hash = path_hash(path, &len);
+	if (len > FF_PATH_CACHE_LEN) return;	/* Too long to be stored */
+	for (i = 0; i < FF_PATH_CACHE && (PathCache[i].hash != hash || PathCache[i].len != len || memcmp(PathCache[i].path, path, len * sizeof (TCHAR))); i++) ;
+	if (i == FF_PATH_CACHE) {	/* Not cached yet, replace the oldest one */
+		i = PathCacheNext;
+		PathCacheNext = (PathCacheNext + 1) % FF_PATH_CACHE;
+	}
+	pc = &PathCache[i];
+	pc->hash = hash;
+	pc->len = len;
+	memcpy(pc->path, path, len * sizeof (TCHAR));
+	pc->id = dp->obj.fs->id;
+	pc->obj = dp->obj;
+	pc->ofs = (dp->blk_ofs != 0xFFFFFFFF) ? dp->blk_ofs : dp->dptr;
+	pc->sect = 0;	/* Sector is resolved on the first use, the window must not be moved here */
+}
+
+#endif /* FF_PATH_CACHE */
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Follow a file path                                                    */
 /*-----------------------------------------------------------------------*/
@@ -3092,6 +3292,13 @@ static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 		res = dir_sdi(dp, 0);
 
 	} else {								/* Follow path */
+#if FF_PATH_CACHE
+		const TCHAR* full_path = path;
+		FFOBJID origin = dp->obj;
+
+		if (path_cache_find(dp, path) == FR_OK) return FR_OK;	/* Known location is still valid */
+		dp->obj = origin;	/* Walk from the origin directory */
+#endif
 		for (;;) {
 			res = create_name(dp, &path);	/* Get a segment name of the path */
 			if (res != FR_OK) break;
@@ -3126,6 +3333,9 @@ static FRESULT follow_path (	/* FR_OK(0): successful, !=0: error code */
 				dp->obj.sclust = ld_clust(fs, fs->win + dp->dptr % SS(fs));	/* Open next directory */
 			}
 		}
+#if FF_PATH_CACHE
+		if (res == FR_OK && !(dp->fn[NSFLAG] & NS_NONAME)) path_cache_store(dp, full_path);
+#endif
 	}
 
 	return res;
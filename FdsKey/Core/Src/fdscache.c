@@ -0,0 +1,150 @@
+#include <stddef.h>
+#include <string.h>
+#include "fdscache.h"
+
+// size of the key part of the entry
+#define FDS_CACHE_KEY_SIZE offsetof(FDS_CACHE_ENTRY, block_count)
+
+// FNV-1a hash of the file path,
+// case insensitive and without leading slash, so "\\Game.fds" and "game.fds" are the same file
+uint32_t fds_cache_path_hash(char *path)
+{
+  uint32_t hash = 2166136261UL;
+  uint8_t c;
+  while (*path == '\\' || *path == '/')
+    path++;
+  while (*path)
+  {
+    c = *path++;
+    if (c >= 'a' && c <= 'z')
+      c -= 'a' - 'A';
+    hash ^= c;
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+// every path/side pair has its own slot in the cache file
+static FSIZE_t fds_cache_slot_offset(FDS_CACHE_ENTRY *entry)
+{
+  return (FSIZE_t)((entry->path_hash + entry->side) % FDS_CACHE_ENTRIES) * sizeof(FDS_CACHE_ENTRY);
+}
+
+// fill cache entry key
+void fds_cache_set_key(FDS_CACHE_ENTRY *entry, char *path, FILINFO *fno, uint8_t side)
+{
+  memset(entry, 0, FDS_CACHE_KEY_SIZE);
+  entry->magic = FDS_CACHE_MAGIC;
+  entry->path_hash = fds_cache_path_hash(path);
+  entry->fsize = fno->fsize;
+  entry->fdate = fno->fdate;
+  entry->ftime = fno->ftime;
+  entry->side = side;
+}
+
+// search for the entry with the same key,
+// returns FR_OK and fills cached data if found, FR_NO_FILE if not
+FRESULT fds_cache_find(FDS_CACHE_ENTRY *entry)
+{
+  FRESULT fr;
+  FIL fp;
+  UINT br;
+  FDS_CACHE_ENTRY key;
+
+  memcpy(&key, entry, FDS_CACHE_KEY_SIZE);
+  fr = f_open(&fp, FDS_CACHE_FILE, FA_READ);
+  if (fr != FR_OK)
+    return fr;
+  fr = f_lseek(&fp, fds_cache_slot_offset(entry));
+  if (fr == FR_OK)
+    fr = f_read(&fp, entry, sizeof(FDS_CACHE_ENTRY), &br);
+  f_close(&fp);
+  if (fr == FR_OK && (br != sizeof(FDS_CACHE_ENTRY)
+      || memcmp(&key, entry, FDS_CACHE_KEY_SIZE) != 0
+      || entry->block_count > FDS_MAX_BLOCKS))
+    fr = FR_NO_FILE;
+  if (fr != FR_OK)
+  {
+    // restore key, cached data is invalid
+    memcpy(entry, &key, FDS_CACHE_KEY_SIZE);
+    entry->block_count = 0;
+  }
+  return fr;
+}
+
+// write entry to its slot, create cache file if need
+FRESULT fds_cache_store(FDS_CACHE_ENTRY *entry)
+{
+  FRESULT fr;
+  FIL fp;
+  UINT bw;
+  uint8_t created = 0;
+
+  fr = f_open(&fp, FDS_CACHE_FILE, FA_OPEN_EXISTING | FA_READ | FA_WRITE);
+  if (fr == FR_NO_FILE)
+  {
+    fr = f_open(&fp, FDS_CACHE_FILE, FA_CREATE_NEW | FA_READ | FA_WRITE);
+    created = 1;
+  }
+  if (fr != FR_OK)
+    return fr;
+  // file is expanded if slot is beyond the end, magic value protects from garbage
+  fr = f_lseek(&fp, fds_cache_slot_offset(entry));
+  if (fr == FR_OK)
+    fr = f_write(&fp, entry, sizeof(FDS_CACHE_ENTRY), &bw);
+  if (fr == FR_OK && bw != sizeof(FDS_CACHE_ENTRY))
+    fr = FR_DENIED;
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    return fr;
+  }
+  fr = f_close(&fp);
+  if (fr != FR_OK)
+    return fr;
+  // hide it from the file browser
+  if (created)
+    fr = f_chmod(FDS_CACHE_FILE, AM_HID, AM_HID);
+  return fr;
+}
+
+// remove all entries for the file, call it every time file is modified
+FRESULT fds_cache_invalidate(char *path)
+{
+  FRESULT fr;
+  FIL fp;
+  UINT br, bw;
+  int i;
+  uint32_t hash = fds_cache_path_hash(path);
+  FDS_CACHE_ENTRY key;
+  const uint16_t empty = 0;
+
+  fr = f_open(&fp, FDS_CACHE_FILE, FA_OPEN_EXISTING | FA_READ | FA_WRITE);
+  if (fr == FR_NO_FILE)
+    return FR_OK; // nothing to invalidate
+  if (fr != FR_OK)
+    return fr;
+  for (i = 0; i < FDS_CACHE_ENTRIES; i++)
+  {
+    fr = f_lseek(&fp, (FSIZE_t)i * sizeof(FDS_CACHE_ENTRY));
+    if (fr != FR_OK)
+      break;
+    fr = f_read(&fp, &key, FDS_CACHE_KEY_SIZE, &br);
+    if (fr != FR_OK || br != FDS_CACHE_KEY_SIZE)
+      break;
+    if (key.magic != FDS_CACHE_MAGIC || key.path_hash != hash)
+      continue;
+    // clear magic value
+    fr = f_lseek(&fp, (FSIZE_t)i * sizeof(FDS_CACHE_ENTRY));
+    if (fr == FR_OK)
+      fr = f_write(&fp, &empty, sizeof(empty), &bw);
+    if (fr != FR_OK)
+      break;
+  }
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    return fr;
+  }
+  return f_close(&fp);
+}
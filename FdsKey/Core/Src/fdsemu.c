@@ -1,18 +1,26 @@
-#include <stdlib.h>
 #include <string.h>
 #include "main.h"
 #include "fdsemu.h"
 #include "settings.h"
 #include "ff.h"
+#include "perf.h"
+#include "fdscache.h"
+#include "fdssidecar.h"
+#include "blockstore.h"
+#include "sdcard.h"
+#include "diskio.h"
+#include "brownout.h"
+#include "fdsimage.h"
+#include "iosched.h"
+#include "generation.h"
+#include "dumpcheck.h"
+
+#if FDS_MAX_SIDE_SIZE % FF_MIN_SS != 0
+#error FDS_MAX_SIDE_SIZE must be multiple of sector size
+#endif
 
 static char fds_filename[FF_MAX_LFN + 1];
 static uint8_t fds_side;
-// loaded FDS data
-#ifdef FDS_USE_DYNAMIC_MEMORY
-static uint8_t * volatile fds_raw_data;
-#else
-static uint8_t volatile fds_raw_data[FDS_MAX_SIDE_SIZE];
-#endif
 static volatile uint8_t fds_read_buffer[FDS_READ_BUFFER_SIZE];
 static volatile int fds_used_space = 0;
 static volatile int fds_block_count = 0;
@@ -33,6 +41,48 @@ static volatile uint16_t fds_write_gap_skip = 0;
 static volatile uint8_t fds_changed = 0;
 static volatile uint32_t fds_last_action_time = 0;
 static volatile uint8_t fds_readonly = 0;
+// transfer rate
+static volatile FDS_TRANSFER_RATE fds_rate = FDS_RATE_NORMAL;
+static volatile uint8_t fds_rate_fallback = 0;
+static volatile uint8_t fds_read_failures = 0;
+// block content snapshot to ignore writes of the same data,
+// length and CRC are compared too, so hash collision alone can't drop a save
+static uint32_t fds_block_hashes[FDS_MAX_BLOCKS];
+static uint16_t fds_block_sizes[FDS_MAX_BLOCKS];
+static uint16_t fds_block_crcs[FDS_MAX_BLOCKS];
+static int fds_snapshot_block_count = 0;
+static volatile uint32_t fds_write_generation = 0;
+// power failure journal
+static LBA_t fds_journal_sector = 0;
+static FDS_JOURNAL fds_journal;
+// streaming load variables
+static FIL fds_load_fp;
+static volatile uint8_t fds_loading = 0;
+static int fds_min_blocks = 0;
+#ifdef FDS_USE_CACHE
+// cached CRCs of the loading image
+static FDS_CACHE_ENTRY fds_cache_entry;
+static uint8_t fds_cache_hit = 0;
+#endif
+#ifdef FDS_USE_SIDECAR
+static FDS_SIDECAR_HEADER fds_sidecar;
+static uint8_t fds_sidecar_loading = 0;
+static int fds_sidecar_written = 0;
+static uint32_t fds_sidecar_generation = 0;
+#endif
+#ifdef BLOCK_STORE
+static BLOCK_STORE_SIDE fds_store_side;
+static uint8_t fds_store_mode = 0;
+#endif
+#ifdef DUMP_CHECK
+// CRC32 of the side in the .fds layout, extended block by block behind the copier
+static uint32_t fds_side_crc = 0;
+static int fds_side_crc_blocks = 0;
+static volatile int fds_side_crc_restart = FDS_MAX_BLOCKS; // first block rewritten since the last update
+static volatile uint8_t fds_side_written = 0;
+// disk info block was rewritten in this session, copiers do it, games don't
+static volatile uint8_t fds_side_info_written = 0;
+#endif
 
 static void fds_start_reading();
 static void fds_start_writing();
@@ -41,6 +91,11 @@ static void fds_stop_reading();
 static void fds_stop_writing();
 static void fds_reset_reading();
 static void fds_stop();
+static void fds_schedule_deadline();
+#ifdef FDS_USE_SIDECAR
+static void fds_schedule_sidecar();
+static void fds_cancel_sidecar();
+#endif
 
 // calculate block CRC
 // source: https://forums.nesdev.org/viewtopic.php?p=194867#p194867
@@ -70,6 +125,18 @@ static uint16_t fds_crc(uint8_t *data, unsigned size)
   return sum;
 }
 
+// FNV-1a hash of block data and CRC
+static uint32_t fds_hash(uint8_t *data, int size)
+{
+  uint32_t hash = 2166136261UL;
+  while (size--)
+  {
+    hash ^= *data++;
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
 // calculate block size
 static uint16_t fds_get_block_size(int i, uint8_t include_gap, uint8_t include_crc)
 {
@@ -81,7 +148,7 @@ static uint16_t fds_get_block_size(int i, uint8_t include_gap, uint8_t include_c
     return (include_gap ? FDS_NEXT_GAPS_READ_BITS / 8 : 0) + 16 + (include_crc ? 2 : 0); // file header block
   // file data block - size stored in previous block
   return (include_gap ? FDS_NEXT_GAPS_READ_BITS / 8 : 0) + 1
-      + (fds_raw_data[fds_block_offsets[i - 1] + FDS_NEXT_GAPS_READ_BITS / 8 + 0x0D] | (fds_raw_data[fds_block_offsets[i - 1] + FDS_NEXT_GAPS_READ_BITS / 8 + 0x0E] << 8)) + (include_crc ? 2 : 0);
+      + (fds_image_read(fds_block_offsets[i - 1] + FDS_NEXT_GAPS_READ_BITS / 8 + 0x0D) | (fds_image_read(fds_block_offsets[i - 1] + FDS_NEXT_GAPS_READ_BITS / 8 + 0x0E) << 8)) + (include_crc ? 2 : 0);
 }
 
 static void fds_dma_fill_read_buffer(int pos, int length)
@@ -99,7 +166,7 @@ static void fds_dma_fill_read_buffer(int pos, int length)
   while (length)
   {
     fds_clock ^= 1; // carrier state
-    bit = (fds_raw_data[fds_current_byte] >> (fds_current_bit / 2)) & 1;
+    bit = (fds_image_read(fds_current_byte) >> (fds_current_bit / 2)) & 1;
     value = bit ^ fds_clock;
     // send impulse when low to high transition
     if (value && !fds_last_value)
@@ -112,16 +179,19 @@ static void fds_dma_fill_read_buffer(int pos, int length)
     {
       // next byte
       fds_current_bit = 0;
-      fds_current_byte = (fds_current_byte + 1) % FDS_MAX_SIDE_SIZE;
+      // head caught up with the loader? replay zero gap byte until next block is loaded
+      if (!fds_loading || fds_current_byte < fds_used_space)
+        fds_current_byte = (fds_current_byte + 1) % FDS_MAX_SIDE_SIZE;
       // check if drive is rewinded
       if ((fds_current_byte == 0) ||
           (fdskey_settings.rewind_speed == REWIND_SPEED_TURBO && fds_current_byte > fds_used_space + FDS_NOT_READY_BYTES))
       {
         // pause before ready
-        HAL_GPIO_WritePin(FDS_READY_GPIO_Port, FDS_READY_Pin, GPIO_PIN_SET);
+        FDS_PIN_SET(FDS_READY_GPIO_Port, FDS_READY_Pin);
         fds_not_ready_time = HAL_GetTick();
         fds_state = FDS_READ_WAIT_READY_TIMER;
         fds_reset_reading();
+        fds_schedule_deadline();
       }
     }
     pos++;
@@ -129,20 +199,30 @@ static void fds_dma_fill_read_buffer(int pos, int length)
   }
 }
 
-static void fds_dma_read_half_callback(DMA_HandleTypeDef *hdma)
-{
-  fds_dma_fill_read_buffer(0, FDS_READ_BUFFER_SIZE / 2);
-}
-
-static void fds_dma_read_full_callback(DMA_HandleTypeDef *hdma)
+// read DMA interrupt, called directly from the IRQ handler without HAL dispatching
+void fds_read_dma_irq_handler()
 {
-  fds_dma_fill_read_buffer(FDS_READ_BUFFER_SIZE / 2, FDS_READ_BUFFER_SIZE / 2);
+  PERF_START();
+  uint32_t isr = DMA1->ISR;
+  if (isr & FDS_DMA_FLAG(DMA_ISR_HTIF, FDS_READ_DMA_CHANNEL))
+  {
+    DMA1->IFCR = FDS_DMA_FLAG(DMA_IFCR_CHTIF, FDS_READ_DMA_CHANNEL);
+    fds_dma_fill_read_buffer(0, FDS_READ_BUFFER_SIZE / 2);
+  }
+  if (isr & FDS_DMA_FLAG(DMA_ISR_TCIF, FDS_READ_DMA_CHANNEL))
+  {
+    DMA1->IFCR = FDS_DMA_FLAG(DMA_IFCR_CTCIF, FDS_READ_DMA_CHANNEL);
+    fds_dma_fill_read_buffer(FDS_READ_BUFFER_SIZE / 2, FDS_READ_BUFFER_SIZE / 2);
+  }
+  if (isr & FDS_DMA_FLAG(DMA_ISR_TEIF, FDS_READ_DMA_CHANNEL))
+    DMA1->IFCR = FDS_DMA_FLAG(DMA_IFCR_CGIF, FDS_READ_DMA_CHANNEL);
+  PERF_STOP(PERF_FDS_READ_DMA);
 }
 
 // add single bit of written data
 static void fds_write_bit(uint8_t bit)
 {
-  fds_raw_data[fds_current_byte] = (fds_raw_data[fds_current_byte] >> 1) | (bit << 7);
+  fds_image_write(fds_current_byte, (fds_image_read(fds_current_byte) >> 1) | (bit << 7));
   fds_current_bit++;
   if (fds_current_bit > 7)
   {
@@ -153,11 +233,11 @@ static void fds_write_bit(uint8_t bit)
     if (fds_current_byte >= fds_current_block_end)
     {
       // end of block
-      if (!HAL_GPIO_ReadPin(FDS_SCAN_MEDIA_GPIO_Port, FDS_SCAN_MEDIA_Pin))
+      if (!FDS_PIN_READ(FDS_SCAN_MEDIA_GPIO_Port, FDS_SCAN_MEDIA_Pin))
       {
         fds_state = FDS_WRITING_STOPPING;
         // still spinning disk
-        if (HAL_GPIO_ReadPin(FDS_WRITE_GPIO_Port, FDS_WRITE_Pin))
+        if (FDS_PIN_READ(FDS_WRITE_GPIO_Port, FDS_WRITE_Pin))
         {
           // reading
           fds_stop_writing();
@@ -268,25 +348,65 @@ static void fds_dma_parse_write_buffer(int pos, int length)
   }
 }
 
-static void fds_dma_write_half_callback(DMA_HandleTypeDef *hdma)
+// write DMA interrupt, called directly from the IRQ handler without HAL dispatching
+void fds_write_dma_irq_handler()
+{
+  PERF_START();
+  uint32_t isr = DMA1->ISR;
+  if (isr & FDS_DMA_FLAG(DMA_ISR_HTIF, FDS_WRITE_DMA_CHANNEL))
+  {
+    DMA1->IFCR = FDS_DMA_FLAG(DMA_IFCR_CHTIF, FDS_WRITE_DMA_CHANNEL);
+    fds_dma_parse_write_buffer(0, FDS_WRITE_BUFFER_SIZE / 2);
+  }
+  if (isr & FDS_DMA_FLAG(DMA_ISR_TCIF, FDS_WRITE_DMA_CHANNEL))
+  {
+    DMA1->IFCR = FDS_DMA_FLAG(DMA_IFCR_CTCIF, FDS_WRITE_DMA_CHANNEL);
+    fds_dma_parse_write_buffer(FDS_WRITE_BUFFER_SIZE / 2, FDS_WRITE_BUFFER_SIZE / 2);
+  }
+  if (isr & FDS_DMA_FLAG(DMA_ISR_TEIF, FDS_WRITE_DMA_CHANNEL))
+    DMA1->IFCR = FDS_DMA_FLAG(DMA_IFCR_CGIF, FDS_WRITE_DMA_CHANNEL);
+  PERF_STOP(PERF_FDS_WRITE_DMA);
+}
+
+// start circular DMA transfer with half and full transfer interrupts,
+// channel is configured by HAL on init, only addresses and counter are set here
+static void fds_dma_start(DMA_Channel_TypeDef *channel, uint32_t clear_flags, volatile void *periph, volatile void *memory, uint32_t length)
 {
-  fds_dma_parse_write_buffer(0, FDS_WRITE_BUFFER_SIZE / 2);
+  channel->CCR &= ~DMA_CCR_EN;
+  DMA1->IFCR = clear_flags;
+  channel->CNDTR = length;
+  channel->CPAR = (uint32_t)periph;
+  channel->CMAR = (uint32_t)memory;
+  channel->CCR |= DMA_CCR_HTIE | DMA_CCR_TCIE | DMA_CCR_TEIE | DMA_CCR_EN;
 }
 
-static void fds_dma_write_full_callback(DMA_HandleTypeDef *hdma)
+// stop DMA transfer and clear pending flags
+static void fds_dma_stop(DMA_Channel_TypeDef *channel, uint32_t clear_flags)
 {
-  fds_dma_parse_write_buffer(FDS_WRITE_BUFFER_SIZE / 2, FDS_WRITE_BUFFER_SIZE / 2);
+  channel->CCR &= ~(DMA_CCR_HTIE | DMA_CCR_TCIE | DMA_CCR_TEIE | DMA_CCR_EN);
+  DMA1->IFCR = clear_flags;
 }
 
 // start FDS reading: timer, PWM and DMA
 static void fds_start_reading()
 {
+  switch (fds_rate)
+  {
+  case FDS_RATE_FAST:
+    __HAL_TIM_SET_AUTORELOAD(&FDS_READ_PWM_TIMER, FDS_READ_PERIOD_FAST);
+    break;
+  case FDS_RATE_FASTER:
+    __HAL_TIM_SET_AUTORELOAD(&FDS_READ_PWM_TIMER, FDS_READ_PERIOD_FASTER);
+    break;
+  default:
+    __HAL_TIM_SET_AUTORELOAD(&FDS_READ_PWM_TIMER, FDS_READ_PERIOD_NORMAL);
+    break;
+  }
   fds_current_bit = 0;
   fds_dma_fill_read_buffer(0, FDS_READ_BUFFER_SIZE);
-  HAL_DMA_RegisterCallback(&FDS_READ_DMA, HAL_DMA_XFER_HALFCPLT_CB_ID, fds_dma_read_half_callback);
-  HAL_DMA_RegisterCallback(&FDS_READ_DMA, HAL_DMA_XFER_CPLT_CB_ID, fds_dma_read_full_callback);
   __HAL_TIM_ENABLE_DMA(&FDS_READ_PWM_TIMER, TIM_DMA_UPDATE);
-  HAL_DMA_Start_IT(&FDS_READ_DMA, (uint32_t)&fds_read_buffer, (uint32_t)&FDS_READ_PWM_TIMER.Instance->FDS_READ_PWM_TIMER_CHANNEL_REG, FDS_READ_BUFFER_SIZE);
+  fds_dma_start(FDS_READ_DMA_INSTANCE, FDS_DMA_FLAG(DMA_IFCR_CGIF, FDS_READ_DMA_CHANNEL),
+      &FDS_READ_PWM_TIMER.Instance->FDS_READ_PWM_TIMER_CHANNEL_REG, fds_read_buffer, FDS_READ_BUFFER_SIZE);
   HAL_TIM_PWM_Start(&FDS_READ_PWM_TIMER, FDS_READ_PWM_TIMER_CHANNEL_CONST);
   fds_state = FDS_READING;
 }
@@ -294,7 +414,7 @@ static void fds_start_reading()
 // stop reading
 static void fds_stop_reading()
 {
-  HAL_DMA_Abort_IT(&FDS_READ_DMA);
+  fds_dma_stop(FDS_READ_DMA_INSTANCE, FDS_DMA_FLAG(DMA_IFCR_CGIF, FDS_READ_DMA_CHANNEL));
   HAL_TIM_PWM_Stop(&FDS_READ_PWM_TIMER, FDS_READ_PWM_TIMER_CHANNEL_CONST);
 }
 
@@ -350,7 +470,7 @@ static void fds_reset_writing()
   if (fds_current_block_end < fds_current_byte)
   {
     // this should not happen
-    HAL_GPIO_WritePin(FDS_READY_GPIO_Port, FDS_READY_Pin, GPIO_PIN_SET);
+    FDS_PIN_SET(FDS_READY_GPIO_Port, FDS_READY_Pin);
     return;
   }
   if (fds_current_block + 1 < fds_block_count && fds_current_block_end != fds_block_offsets[fds_current_block + 1])
@@ -358,14 +478,24 @@ static void fds_reset_writing()
     // oops, next block overwrited or disaligned
     // trimming and erasing
     fds_block_count = fds_current_block + 1;
-    memset((uint8_t*)fds_raw_data + fds_block_offsets[fds_current_block + 1], 0, FDS_MAX_SIDE_SIZE - fds_block_offsets[fds_current_block + 1]);
+    memset(fds_image_ptr(fds_block_offsets[fds_current_block + 1]), 0, FDS_MAX_SIDE_SIZE - fds_block_offsets[fds_current_block + 1]);
+    fds_image_mark_dirty(fds_block_offsets[fds_current_block + 1], FDS_MAX_SIDE_SIZE);
   }
+  fds_image_mark_dirty(fds_current_byte, fds_current_block_end);
   // gap before data
   for (i = 0; i < gap_length - 1; i++)
-    fds_raw_data[fds_current_byte++] = 0;
-  fds_raw_data[fds_current_byte++] = 0x80; // gap terminator
+    fds_image_write(fds_current_byte++, 0);
+  fds_image_write(fds_current_byte++, 0x80); // gap terminator
   fds_write_gap_skip = 0;
+  fds_write_generation++;
   fds_changed = 1; // flag that ROM changed
+#ifdef DUMP_CHECK
+  if (fds_current_block < fds_side_crc_restart)
+    fds_side_crc_restart = fds_current_block;
+  if (fds_current_block == 0)
+    fds_side_info_written = 1;
+  fds_side_written = 1;
+#endif
 }
 
 // start writing: timer, PWM and DMA
@@ -374,17 +504,16 @@ static void fds_start_writing()
   fds_reset_writing();
   // start and reset timer
   fds_state = FDS_WRITING_GAP;
-  HAL_DMA_RegisterCallback(&FDS_WRITE_DMA, HAL_DMA_XFER_HALFCPLT_CB_ID, fds_dma_write_half_callback);
-  HAL_DMA_RegisterCallback(&FDS_WRITE_DMA, HAL_DMA_XFER_CPLT_CB_ID, fds_dma_write_full_callback);
   __HAL_TIM_ENABLE_DMA(&FDS_WRITE_CAPTURE_TIMER, FDS_WRITE_CAPTURE_DMA_TRIGGER_CONST);
-  HAL_DMA_Start_IT(&FDS_WRITE_DMA, (uint32_t)&(FDS_WRITE_CAPTURE_TIMER.Instance->FDS_WRITE_CAPTURE_TIMER_CHANNEL_REG), (uint32_t)&fds_write_buffer, FDS_WRITE_BUFFER_SIZE);
+  fds_dma_start(FDS_WRITE_DMA_INSTANCE, FDS_DMA_FLAG(DMA_IFCR_CGIF, FDS_WRITE_DMA_CHANNEL),
+      &FDS_WRITE_CAPTURE_TIMER.Instance->FDS_WRITE_CAPTURE_TIMER_CHANNEL_REG, fds_write_buffer, FDS_WRITE_BUFFER_SIZE);
   HAL_TIM_IC_Start_IT(&FDS_WRITE_CAPTURE_TIMER, FDS_WRITE_CAPTURE_TIMER_CHANNEL_CONST);
 }
 
 // stop writing
 static void fds_stop_writing()
 {
-  HAL_DMA_Abort_IT(&FDS_WRITE_DMA);
+  fds_dma_stop(FDS_WRITE_DMA_INSTANCE, FDS_DMA_FLAG(DMA_IFCR_CGIF, FDS_WRITE_DMA_CHANNEL));
   HAL_TIM_IC_Stop_IT(&FDS_WRITE_CAPTURE_TIMER, FDS_WRITE_CAPTURE_TIMER_CHANNEL_CONST);
 }
 
@@ -393,15 +522,79 @@ static void fds_stop()
 {
   fds_stop_reading();
   fds_stop_writing();
-  HAL_GPIO_WritePin(FDS_READY_GPIO_Port, FDS_READY_Pin, GPIO_PIN_SET);
+  FDS_PIN_SET(FDS_READY_GPIO_Port, FDS_READY_Pin);
   fds_state = FDS_IDLE;
+  // autosave delay starts when disk stops
+  fds_last_action_time = HAL_GetTick();
+  fds_schedule_deadline();
+}
+
+// program one-shot timer to call fds_check_pins() exactly when
+// the not-ready pause or the autosave delay expires, stop it if nothing to wait
+static void fds_schedule_deadline()
+{
+  uint32_t primask = __get_PRIMASK();
+  uint32_t due, now;
+  int32_t delay;
+  TIM_TypeDef *tim = FDS_DEADLINE_TIMER.Instance;
+
+  __disable_irq();
+  tim->CR1 &= ~TIM_CR1_CEN;
+  __HAL_TIM_CLEAR_FLAG(&FDS_DEADLINE_TIMER, TIM_FLAG_UPDATE);
+  if (fds_state == FDS_READ_WAIT_READY_TIMER)
+    due = fds_not_ready_time + (fdskey_settings.rewind_speed == REWIND_SPEED_ORIGINAL ? FDS_NOT_READY_TIME_ORIGINAL : FDS_NOT_READY_TIME) + 1;
+  else if (fds_state == FDS_IDLE && fds_changed)
+    due = fds_last_action_time + FDS_AUTOSAVE_DELAY + 1;
+  else
+  {
+    __set_PRIMASK(primask);
+    return;
+  }
+  now = HAL_GetTick();
+  delay = (int32_t)(due - now);
+  // counter is blocked when ARR is zero
+  if (delay < 2)
+    delay = 2;
+  if (delay > 0x10000)
+    delay = 0x10000;
+  tim->ARR = delay - 1;
+  // reset counter and prescaler, URS is set so no interrupt here
+  tim->EGR = TIM_EGR_UG;
+  tim->CR1 |= TIM_CR1_CEN;
+  __set_PRIMASK(primask);
+}
+
+// motor stopped while reading, check for signs of read failure at accelerated transfer rate
+static void fds_check_read_failure()
+{
+  int block;
+  int data_start;
+
+  if (fds_rate == FDS_RATE_NORMAL)
+    return;
+  block = fds_get_block();
+  if (block < 0)
+    return;
+  data_start = fds_block_offsets[block] + (block == 0 ? FDS_FIRST_GAP_READ_BITS : FDS_NEXT_GAPS_READ_BITS) / 8;
+  // BIOS stops in the gap after the last needed block,
+  // stopping in the middle of the block data means that it gave up reading,
+  // stopping on the same block is not counted, BIOS retries and games re-read files
+  if (fds_current_byte <= data_start)
+    return;
+  if (++fds_read_failures >= FDS_RATE_MAX_FAILURES)
+  {
+    // step back to the normal rate
+    fds_rate = FDS_RATE_NORMAL;
+    fds_rate_fallback = 1;
+  }
 }
 
 // check for /SCAN_MEDIA and /WRITE pins
-// call it every pin state change and every ~100ms
+// call it every pin state change and when deadline timer expires
 void fds_check_pins()
 {
-  if (HAL_GPIO_ReadPin(FDS_SCAN_MEDIA_GPIO_Port, FDS_SCAN_MEDIA_Pin))
+  PERF_START();
+  if (FDS_PIN_READ(FDS_SCAN_MEDIA_GPIO_Port, FDS_SCAN_MEDIA_Pin))
   {
     // motor stop
     // HAL_GPIO_WritePin(FDS_MOTOR_ON_GPIO_Port, FDS_MOTOR_ON_Pin, GPIO_PIN_RESET); // do i really need this?
@@ -422,6 +615,8 @@ void fds_check_pins()
       break;
     default:
       // just full stop
+      if (fds_state == FDS_READING)
+        fds_check_read_failure();
       fds_stop();
       if (fdskey_settings.rewind_speed == REWIND_SPEED_TURBO)
         fds_reset_reading();
@@ -432,7 +627,7 @@ void fds_check_pins()
     // HAL_GPIO_WritePin(FDS_MOTOR_ON_GPIO_Port, FDS_MOTOR_ON_Pin, GPIO_PIN_SET);
     // return from saving state if saved
     if ((fds_state == FDS_SAVE_PENDING) && !fds_changed) fds_state = FDS_IDLE;
-    if (HAL_GPIO_ReadPin(FDS_WRITE_GPIO_Port, FDS_WRITE_Pin))
+    if (FDS_PIN_READ(FDS_WRITE_GPIO_Port, FDS_WRITE_Pin))
     {
       // reading
       switch (fds_state)
@@ -456,7 +651,7 @@ void fds_check_pins()
         // check if "not-ready" pause expired
         if (fds_not_ready_time + (fdskey_settings.rewind_speed == REWIND_SPEED_ORIGINAL ? FDS_NOT_READY_TIME_ORIGINAL : FDS_NOT_READY_TIME) < HAL_GetTick())
         {
-          HAL_GPIO_WritePin(FDS_READY_GPIO_Port, FDS_READY_Pin, GPIO_PIN_RESET);
+          FDS_PIN_RESET(FDS_READY_GPIO_Port, FDS_READY_Pin);
           fds_start_reading();
         }
         break;
@@ -478,6 +673,9 @@ void fds_check_pins()
       case FDS_READING:
       case FDS_READ_WAIT_READY:
       case FDS_READ_WAIT_READY_TIMER:
+        // block table is incomplete while loading, writing will be started by fds_load_continue()
+        if (fds_loading)
+          break;
         // start writing if not yet
         fds_stop_reading();
         fds_start_writing();
@@ -489,21 +687,474 @@ void fds_check_pins()
     }
     fds_last_action_time = HAL_GetTick();
   }
+  fds_schedule_deadline();
+  PERF_STOP(PERF_FDS_CHECK_PINS);
 }
 
-// load .fds file and start drive emulation
-FRESULT fds_load_side(char *filename, uint8_t side, uint8_t ro)
+// CRC stored after the block data, size includes it
+static uint16_t fds_stored_crc(int offset, int size)
+{
+  return *fds_image_ptr(offset + size - 2) | (*fds_image_ptr(offset + size - 1) << 8);
+}
+
+// remember block content, size includes CRC
+static void fds_snapshot_block(int i, int offset, int size)
+{
+  fds_block_hashes[i] = fds_hash(fds_image_ptr(offset), size);
+  fds_block_sizes[i] = size;
+  fds_block_crcs[i] = fds_stored_crc(offset, size);
+}
+
+// compare block with the snapshot
+static uint8_t fds_block_matches_snapshot(int i)
+{
+  int offset = fds_block_offsets[i] + (i == 0 ? FDS_FIRST_GAP_READ_BITS : FDS_NEXT_GAPS_READ_BITS) / 8;
+  int size = fds_get_block_size(i, 0, 1);
+  if (offset + size > FDS_MAX_SIDE_SIZE)
+    return 0;
+  if (size != fds_block_sizes[i] || fds_stored_crc(offset, size) != fds_block_crcs[i])
+    return 0;
+  return fds_hash(fds_image_ptr(offset), size) == fds_block_hashes[i];
+}
+
+// take snapshot of the current disk content
+static void fds_take_snapshot()
 {
   int i;
+  for (i = 0; i < fds_block_count; i++)
+  {
+    int offset = fds_block_offsets[i] + (i == 0 ? FDS_FIRST_GAP_READ_BITS : FDS_NEXT_GAPS_READ_BITS) / 8;
+    int size = fds_get_block_size(i, 0, 1);
+    if (offset + size > FDS_MAX_SIDE_SIZE)
+      fds_block_sizes[i] = 0; // never matches
+    else
+      fds_snapshot_block(i, offset, size);
+  }
+  fds_snapshot_block_count = fds_block_count;
+}
+
+#ifdef FDS_USE_SIDECAR
+// load next block from the opened sidecar file,
+// gaps and CRCs are already there, so there is nothing to parse or calculate
+static FRESULT fds_load_next_sidecar_block(uint8_t *done)
+{
   FRESULT fr;
-  FIL fp;
-  FSIZE_t f_size;
+  int i = fds_block_count;
+  int pos = fds_sidecar.block_offsets[i];
+  int end = (i + 1 < fds_sidecar.block_count) ? fds_sidecar.block_offsets[i + 1] : fds_sidecar.used_space;
+  int gap_length = i == 0 ? FDS_FIRST_GAP_READ_BITS / 8 : FDS_NEXT_GAPS_READ_BITS / 8;
+  UINT br;
+
+  *done = 0;
+  if (i >= fds_sidecar.block_count)
+  {
+    *done = 1;
+    return FR_OK;
+  }
+  fr = fds_image_load(&fds_load_fp, pos, end - pos, &br);
+  if (fr != FR_OK)
+    return fr; // SD card error?
+  fds_block_offsets[i] = pos;
+  // block table must match data
+  if ((br != end - pos) || (fds_get_block_size(i, 1, 1) != end - pos))
+    return FDSR_INVALID_ROM;
+  // remember loaded content
+  fds_snapshot_block(i, pos + gap_length, end - pos - gap_length);
+  fds_snapshot_block_count = i + 1;
+  // make sure that data is in memory before the block is published
+  __DMB();
+  fds_block_count++;
+  fds_used_space = end;
+  return FR_OK;
+}
+#endif
+
+// load next block from the opened image file,
+// block becomes visible for the reading state machine only when it's fully loaded
+static FRESULT fds_load_next_block(uint8_t *done)
+{
+  FRESULT fr;
+  int pos = fds_used_space;
   int gap_length;
   int block_size;
   uint8_t block_type;
   UINT br;
   uint16_t crc;
-  int min_blocks = 0;
+
+#ifdef FDS_USE_SIDECAR
+  if (fds_sidecar_loading)
+    return fds_load_next_sidecar_block(done);
+#endif
+  *done = 0;
+  // calculate total number of blocks based on file amount block
+  if (fds_block_count == 2)
+    fds_min_blocks = fds_image_read(fds_block_offsets[1] + FDS_NEXT_GAPS_READ_BITS / 8 + 1) * 2 + 2; // files * 2 + header blocks;
+  if (fds_block_count >= FDS_MAX_BLOCKS)
+  {
+    if (fds_block_count < fds_min_blocks)
+      return FDSR_ROM_TOO_LARGE;
+    *done = 1;
+    return FR_OK;
+  }
+#ifdef BLOCK_STORE
+  // manifest lists all the blocks
+  if (fds_store_mode && fds_block_count >= fds_store_side.block_count)
+  {
+    if (fds_block_count < fds_min_blocks)
+      return FDSR_INVALID_ROM;
+    *done = 1;
+    return FR_OK;
+  }
+#endif
+  fds_block_offsets[fds_block_count] = pos;
+  gap_length = fds_block_count == 0 ? FDS_FIRST_GAP_READ_BITS / 8 : FDS_NEXT_GAPS_READ_BITS / 8;
+  if (pos + gap_length > FDS_MAX_SIDE_SIZE)
+  {
+    if (fds_block_count + 1 < fds_min_blocks)
+      return FDSR_ROM_TOO_LARGE;
+    *done = 1;
+    return FR_OK;
+  }
+  // gap before data, memory is already zeroed
+  pos += gap_length;
+  fds_image_write(pos - 1, 0x80); // gap terminator
+
+  if (fds_block_count == 0)
+    // disk info block
+    block_type = 1;
+  else if (fds_block_count == 1)
+    // file amount block
+    block_type = 2;
+  else if (fds_block_count % 2 == 0)
+    // file header block
+    block_type = 3;
+  else
+    // file data block
+    block_type = 4;
+  block_size = fds_get_block_size(fds_block_count, 0, 0);
+
+  // check size
+  if (pos + block_size + 2 /*CRC*/> FDS_MAX_SIDE_SIZE)
+  {
+    fds_image_write(pos - 1, 0); // remove terminator
+    if (fds_block_count + 1 < fds_min_blocks)
+      return FDSR_ROM_TOO_LARGE;
+    *done = 1;
+    return FR_OK;
+  }
+
+#ifdef BLOCK_STORE
+  if (fds_store_mode)
+  {
+    // blocks are scattered over the pack file
+    if (fds_store_side.blocks[fds_block_count].size != block_size)
+      return FDSR_INVALID_ROM;
+    fr = f_lseek(&fds_load_fp, fds_store_side.blocks[fds_block_count].offset);
+    if (fr != FR_OK)
+      return fr;
+  }
+#endif
+  // reading
+  fr = fds_image_load(&fds_load_fp, pos, block_size, &br);
+  if (fr != FR_OK)
+    return fr; // SD card error?
+  if ((br != block_size) /*end of file?*/ || (fds_image_read(pos) != block_type) /* invalid block? */)
+  {
+    memset(fds_image_ptr(pos - 1), 0, br + 1); // remove terminator and garbage
+    if (fds_block_count + 1 < fds_min_blocks)
+      return FDSR_INVALID_ROM;
+    *done = 1;
+    return FR_OK;
+  }
+#ifdef FDS_USE_CACHE
+  if (fds_cache_hit && fds_block_count < fds_cache_entry.block_count)
+  {
+    // image is not changed since last load, header is valid and CRC is known
+    crc = fds_cache_entry.crc[fds_block_count];
+  } else
+#endif
+  {
+    if (fds_block_count == 0)
+    {
+      // check header
+      const char signature[] = "*NINTENDO-HVC*";
+      char verify[sizeof(signature)];
+      memcpy(verify, fds_image_ptr(pos + 1), sizeof(signature) - 1);
+      verify[sizeof(signature) - 1] = 0;
+      if (strcmp(verify, signature) != 0)
+        return FDSR_INVALID_ROM;
+    }
+    crc = fds_crc(fds_image_ptr(pos), block_size);
+  }
+#ifdef FDS_USE_CACHE
+  fds_cache_entry.crc[fds_block_count] = crc;
+#endif
+  fds_image_write(pos + block_size, crc & 0xFF);
+  fds_image_write(pos + block_size + 1, (crc >> 8) & 0xFF);
+  // remember loaded content
+  fds_snapshot_block(fds_block_count, pos, block_size + 2);
+  fds_snapshot_block_count = fds_block_count + 1;
+  pos += block_size + 2;
+  // make sure that data is in memory before the block is published
+  __DMB();
+  fds_block_count++;
+  fds_used_space = pos;
+  return FR_OK;
+}
+
+// all blocks are loaded, close file and update cache
+static void fds_load_finish()
+{
+  f_close(&fds_load_fp);
+  fds_loading = 0;
+#ifdef FDS_USE_CACHE
+  if (fds_cache_entry.magic == FDS_CACHE_MAGIC
+      && (!fds_cache_hit || fds_cache_entry.block_count != fds_block_count))
+  {
+    fds_cache_entry.block_count = fds_block_count;
+    fds_cache_store(&fds_cache_entry); // ignore errors, it's just a cache
+  }
+#endif
+#ifdef FDS_USE_SIDECAR
+  // expanded side is in memory now, it will be stored in background
+  if (!fds_sidecar_loading && fds_sidecar.magic == FDS_SIDECAR_MAGIC)
+    fds_schedule_sidecar();
+  fds_sidecar_loading = 0;
+#endif
+}
+
+#ifdef FDS_USE_SIDECAR
+// background job, store expanded side chunk by chunk, so next time it's loaded without parsing,
+// memory must match the file all this time
+static FRESULT fds_store_sidecar_job()
+{
+  FRESULT fr;
+  int i;
+  uint8_t done;
+
+  if (fds_changed || fds_sidecar_generation != fds_write_generation)
+  {
+    // console was writing meanwhile, stored copy can be inconsistent
+    fds_cancel_sidecar();
+    return FR_OK;
+  }
+  if (!fds_sidecar_written)
+  {
+    if (fds_block_count == 0)
+    {
+      fds_cancel_sidecar();
+      return FR_OK;
+    }
+    for (i = 0; i < fds_block_count; i++)
+      fds_sidecar.block_offsets[i] = fds_block_offsets[i];
+    fds_sidecar.block_count = fds_block_count;
+    fds_sidecar.used_space = fds_block_offsets[fds_block_count - 1] + fds_get_block_size(fds_block_count - 1, 1, 1);
+    if (fds_sidecar.used_space > FDS_MAX_SIDE_SIZE)
+    {
+      fds_cancel_sidecar();
+      return FR_OK;
+    }
+  }
+  fr = fds_sidecar_store_step(&fds_sidecar, &fds_sidecar_written, &done);
+  if (fr != FR_OK)
+  {
+    // ignore errors, it's just a cache, incomplete file is already removed
+    fds_sidecar_written = 0;
+    fds_cancel_sidecar();
+    return FR_OK;
+  }
+  if (done)
+  {
+    fds_sidecar_written = 0;
+    iosched_cancel(fds_store_sidecar_job);
+    if (fds_changed || fds_sidecar_generation != fds_write_generation)
+      fds_sidecar_remove(fds_sidecar.path_hash, fds_sidecar.side);
+  }
+  return FR_OK;
+}
+
+// memory matches the file, store it when SD card is not used
+static void fds_schedule_sidecar()
+{
+  fds_sidecar_written = 0;
+  fds_sidecar_generation = fds_write_generation;
+  iosched_post(fds_store_sidecar_job);
+}
+
+// stop storing and remove incomplete copy
+static void fds_cancel_sidecar()
+{
+  iosched_cancel(fds_store_sidecar_job);
+  if (fds_sidecar_written)
+    fds_sidecar_remove(fds_sidecar.path_hash, fds_sidecar.side);
+  fds_sidecar_written = 0;
+}
+#endif
+
+// open or create contiguous journal file and remember its location,
+// data is written there by sectors without file system on power failure
+static FRESULT fds_journal_prepare()
+{
+  FRESULT fr;
+  FIL fp;
+  UINT bw;
+  DWORD clmt[8];
+  FATFS *fs;
+  int attempt;
+  uint8_t created = 0;
+
+  for (attempt = 0; attempt < 2; attempt++)
+  {
+    fds_journal_sector = 0;
+    fr = f_open(&fp, FDS_JOURNAL_FILE, FA_OPEN_EXISTING | FA_READ);
+    if (fr == FR_OK && f_size(&fp) != FDS_JOURNAL_SIZE)
+    {
+      // invalid size, recreate
+      f_close(&fp);
+      fr = f_unlink(FDS_JOURNAL_FILE);
+      if (fr != FR_OK)
+        return fr;
+      fr = FR_NO_FILE;
+    }
+    if (fr == FR_NO_FILE)
+    {
+      fr = f_open(&fp, FDS_JOURNAL_FILE, FA_CREATE_NEW | FA_READ | FA_WRITE);
+      if (fr != FR_OK)
+        return fr;
+      created = 1;
+      // allocate contiguous space
+      fr = f_expand(&fp, FDS_JOURNAL_SIZE, 1);
+      if (fr == FR_DENIED)
+      {
+        // no contiguous free space, it's not fatal, just no journal
+        f_close(&fp);
+        return f_unlink(FDS_JOURNAL_FILE);
+      }
+      // empty header
+      memset(&fds_journal, 0, sizeof(fds_journal));
+      if (fr == FR_OK)
+        fr = f_write(&fp, &fds_journal, sizeof(fds_journal), &bw);
+      if (fr == FR_OK && bw != sizeof(fds_journal))
+        fr = FR_DENIED;
+    }
+    if (fr != FR_OK)
+    {
+      f_close(&fp);
+      return fr;
+    }
+    // file must be contiguous: single fragment in the cluster link map
+    fp.cltbl = clmt;
+    clmt[0] = sizeof(clmt) / sizeof(clmt[0]);
+    fr = f_lseek(&fp, CREATE_LINKMAP);
+    if (fr == FR_OK && clmt[0] == 4)
+    {
+      fs = fp.obj.fs;
+      fds_journal_sector = fs->database + (LBA_t)(clmt[2] - 2) * fs->csize;
+    }
+    if (fr == FR_NOT_ENOUGH_CORE)
+      fr = FR_OK; // fragmented
+    if (fr != FR_OK)
+    {
+      f_close(&fp);
+      return fr;
+    }
+    fr = f_close(&fp);
+    if (fr != FR_OK)
+      return fr;
+    if (fds_journal_sector)
+      break;
+    // fragmented file, recreate it
+    fr = f_unlink(FDS_JOURNAL_FILE);
+    if (fr != FR_OK)
+      return fr;
+  }
+
+  // hide it from the file browser
+  if (created && fds_journal_sector)
+    return f_chmod(FDS_JOURNAL_FILE, AM_HID, AM_HID);
+  return FR_OK;
+}
+
+// write unsaved sectors and then header to the journal using raw SD card access,
+// header is written last, so interrupted flush never leaves valid journal
+static void fds_journal_flush()
+{
+  int i;
+  uint16_t count = 0;
+  uint32_t hash = 0;
+
+  // changed sectors
+  for (i = fds_image_next_dirty(-1); i >= 0; i = fds_image_next_dirty(i))
+  {
+    if (!count && SD_write_begin(fds_journal_sector + FDS_JOURNAL_HEADER_SECTORS) != SD_RES_OK)
+      return;
+    if (SD_write_data(fds_image_ptr(i * FF_MIN_SS)) != SD_RES_OK)
+      return;
+    hash = (hash * 16777619UL) ^ fds_hash(fds_image_ptr(i * FF_MIN_SS), FF_MIN_SS);
+    count++;
+  }
+  if (count && SD_write_end() != SD_RES_OK)
+    return;
+
+  // header
+  memset(&fds_journal, 0, sizeof(fds_journal));
+  fds_journal.header.magic = FDS_JOURNAL_MAGIC;
+  fds_journal.header.sector_count = count;
+  fds_journal.header.side = fds_side;
+  fds_journal.header.used_space = fds_used_space;
+  fds_journal.header.block_count = fds_block_count;
+  fds_image_get_dirty_map(fds_journal.header.dirty_sectors);
+  for (i = 0; i < fds_block_count; i++)
+    fds_journal.header.block_offsets[i] = fds_block_offsets[i];
+  strlcpy(fds_journal.header.filename, fds_filename, sizeof(fds_journal.header.filename));
+  // header is hashed too with zero hash field
+  fds_journal.header.payload_hash = (hash * 16777619UL) ^ fds_hash((uint8_t*)&fds_journal.header, sizeof(fds_journal.header));
+  if (SD_write_begin(fds_journal_sector) != SD_RES_OK)
+    return;
+  for (i = 0; i < FDS_JOURNAL_HEADER_SECTORS; i++)
+    if (SD_write_data(fds_journal.sectors[i]) != SD_RES_OK)
+      return;
+  SD_write_end();
+}
+
+static void fds_journal_flush_and_reset()
+{
+  fds_journal_flush();
+  // still alive? it was just a voltage drop,
+  // restart when power is good, journal will be replayed on start
+  brownout_wait_recovery();
+  NVIC_SystemReset();
+}
+
+// called on power failure from the interrupt,
+// writes unsaved data to the journal and waits for reset,
+// returns only if there is nothing to save
+void fds_power_fail()
+{
+  if (!fds_changed || fds_readonly || !fds_journal_sector)
+    return;
+  // freeze disk content
+  fds_stop();
+  fds_state = FDS_OFF;
+  // SD card timeouts need SysTick which has the same priority as the caller
+  NVIC_SetPriority(SysTick_IRQn, 0);
+  if (disk_is_busy())
+    disk_call_when_idle(fds_journal_flush_and_reset); // main thread will do it right after the current transfer
+  else
+    fds_journal_flush_and_reset();
+}
+
+// open .fds file, load first blocks and start drive emulation,
+// other blocks are loaded by fds_load_continue() while console reads the first gap
+FRESULT fds_load_side(char *filename, uint8_t side, uint8_t ro)
+{
+  FRESULT fr;
+  FSIZE_t f_size;
+  uint8_t done = 0;
+  char alt_filename[FF_MAX_LFN + 1];
+  char *load_filename = filename;
+  FILINFO fno;
+  IOSCHED_CLASS cls;
 
   fds_close(0);
   fds_reset_reading();
@@ -521,13 +1172,15 @@ FRESULT fds_load_side(char *filename, uint8_t side, uint8_t ro)
   strlcpy(fds_filename, filename, sizeof(fds_filename));
   fds_side = side;
 
-  if (fdskey_settings.backup_original != SAVES_EVERDRIVE)
+  // there will be no saving for read-only image
+  // journal is only a safety net, image works without it
+  fds_journal_sector = 0;
+  if (!ro && fds_journal_prepare() != FR_OK)
+    fds_journal_sector = 0;
+
+  if (fdskey_settings.backup_original == SAVES_EVERDRIVE)
   {
-    fr = f_open(&fp, filename, FA_READ);
-  } else {
     // everdrive-style saves
-    char alt_filename[FF_MAX_LFN + 1];
-    FILINFO fno;
     char* filename_no_path = fds_filename + strlen(fds_filename);
     while (filename_no_path >= fds_filename)
     {
@@ -544,153 +1197,104 @@ FRESULT fds_load_side(char *filename, uint8_t side, uint8_t ro)
     strlcat(alt_filename, "\\bram.srm", sizeof(alt_filename));
     fr = f_stat(alt_filename, &fno);
     if (fr == FR_OK)
-      fr = f_open(&fp, alt_filename, FA_READ);
-    else
-      fr = f_open(&fp, filename, FA_READ);
+      load_filename = alt_filename;
   }
-  if (fr != FR_OK)
+#ifdef BLOCK_STORE
+  // manifest of blocks in the shared store?
+  fr = block_store_read_side(load_filename, side, &fds_store_side);
+  if (fr != FR_OK && fr != FR_NO_FILE)
   {
     fds_close(0);
     return fr;
   }
-  f_size = f_size(&fp);
-  if (f_size % FDS_ROM_SIDE_SIZE != 0 && f_size % FDS_ROM_SIDE_SIZE != 16)
+  fds_store_mode = fr == FR_OK;
+#endif
+#ifdef FDS_USE_SIDECAR
+  // search for pre-expanded copy of this side
+  fds_sidecar_loading = 0;
+  fds_sidecar.magic = 0; // no key - nothing to store
+  if (f_stat(load_filename, &fno) == FR_OK)
   {
-    f_close(&fp);
-    fds_close(0);
-    return FDSR_INVALID_ROM;
+    fds_sidecar_set_key(&fds_sidecar, load_filename, &fno, side);
+    fds_sidecar_loading = fds_sidecar_open(&fds_load_fp, &fds_sidecar) == FR_OK;
   }
-  fr = f_lseek(&fp, ((f_size % FDS_ROM_SIDE_SIZE == FDS_ROM_HEADER_SIZE) ? FDS_ROM_HEADER_SIZE : 0) + side * FDS_ROM_SIDE_SIZE);
-  if (fr != FR_OK)
-    return fr;
-
-#ifdef FDS_USE_DYNAMIC_MEMORY
-  fds_raw_data = malloc(FDS_MAX_SIDE_SIZE * sizeof(uint8_t));
-  if (!fds_raw_data) return FDSR_OUT_OF_MEMORY;
+  if (fds_sidecar_loading)
+    fds_loading = 1; // sidecar is open now, fds_close() will close it
+  else
 #endif
-
-  memset((uint8_t*)fds_raw_data, 0, FDS_MAX_SIDE_SIZE);
-
-  while (1)
+#ifdef BLOCK_STORE
+  if (fds_store_mode)
   {
-    // calculate total number of blocks based on file amount block
-    if (fds_block_count == 2)
-      min_blocks = fds_raw_data[fds_block_offsets[1] + FDS_NEXT_GAPS_READ_BITS / 8 + 1] * 2 + 2; // files * 2 + header blocks;
-    fds_block_offsets[fds_block_count] = fds_used_space;
-    gap_length = fds_block_count == 0 ? FDS_FIRST_GAP_READ_BITS / 8 : FDS_NEXT_GAPS_READ_BITS / 8;
-    if (fds_used_space + gap_length > FDS_MAX_SIDE_SIZE)
+    fr = block_store_open_pack(&fds_load_fp);
+    if (fr != FR_OK)
     {
-      if (fds_block_count + 1 < min_blocks)
-      {
-        f_close(&fp);
-        fds_close(0);
-        return FDSR_ROM_TOO_LARGE;
-      }
-      break;
+      fds_close(0);
+      return fr;
     }
-    // gap before data
-    for (i = 0; i < gap_length - 1; i++)
-    {
-      fds_raw_data[fds_used_space++] = 0;
-      // check size
-      if (fds_used_space - 1 >= FDS_MAX_SIDE_SIZE)
-      {
-        if (fds_block_count + 1 < min_blocks)
-        {
-          f_close(&fp);
-          fds_close(0);
-          return FDSR_ROM_TOO_LARGE;
-        }
-        fds_used_space -= i;
-        break;
-      }
-    }
-    fds_raw_data[fds_used_space++] = 0x80; // gap terminator
-
-    if (fds_block_count == 0)
-      // disk info block
-      block_type = 1;
-    else if (fds_block_count == 1)
-      // file amount block
-      block_type = 2;
-    else if (fds_block_count % 2 == 0)
-      // file header block
-      block_type = 3;
-    else
-      // file data block
-      block_type = 4;
-    block_size = fds_get_block_size(fds_block_count, 0, 0);
-
-    // check size
-    if (fds_used_space + block_size + 2 /*CRC*/> FDS_MAX_SIDE_SIZE)
-    {
-      if (fds_block_count + 1 < min_blocks)
-      {
-        f_close(&fp);
-        fds_close(0);
-        return FDSR_ROM_TOO_LARGE;
-      }
-      fds_raw_data[fds_used_space - 1] = 0; // remove terminator
-      fds_used_space -= gap_length; // rollback last gap
-      break;
-    }
-
-    // reading
-    fr = f_read(&fp, (uint8_t*) fds_raw_data + fds_used_space, block_size, &br);
+    fds_loading = 1; // pack is open now, fds_close() will close it
+  } else
+#endif
+  {
+    fr = f_open(&fds_load_fp, load_filename, FA_READ);
     if (fr != FR_OK)
     {
-      // SD card error?
-      f_close(&fp);
       fds_close(0);
       return fr;
     }
-    if (br != block_size)
+    // file is open now, fds_close() will close it
+    fds_loading = 1;
+    f_size = f_size(&fds_load_fp);
+    if (f_size % FDS_ROM_SIDE_SIZE != 0 && f_size % FDS_ROM_SIDE_SIZE != 16)
     {
-      // end of file?
-      if (fds_block_count + 1 < min_blocks)
-      {
-        f_close(&fp);
-        fds_close(0);
-        return FDSR_INVALID_ROM;
-      }
-      fds_raw_data[fds_used_space - 1] = 0; // remove terminator
-      fds_used_space -= gap_length; // rollback last gap
-      break;
+      fds_close(0);
+      return FDSR_INVALID_ROM;
     }
-    if (fds_raw_data[fds_used_space] != block_type)
+    fr = f_lseek(&fds_load_fp, ((f_size % FDS_ROM_SIDE_SIZE == FDS_ROM_HEADER_SIZE) ? FDS_ROM_HEADER_SIZE : 0) + side * FDS_ROM_SIDE_SIZE);
+    if (fr != FR_OK)
     {
-      // invalid block?
-      if (fds_block_count + 1 < min_blocks)
-      {
-        f_close(&fp);
-        fds_close(0);
-        return FDSR_INVALID_ROM;
-      }
-      fds_raw_data[fds_used_space - 1] = 0; // remove terminator
-      fds_used_space -= gap_length; // rollback last gap
-      break;
+      fds_close(0);
+      return fr;
     }
-    if (fds_block_count == 0)
+  }
+
+  fr = fds_image_alloc();
+  if (fr != FR_OK)
+  {
+    fds_close(0);
+    return fr;
+  }
+  fds_min_blocks = 0;
+
+#ifdef FDS_USE_CACHE
+  // search for CRCs calculated on previous load of this image
+  fds_cache_hit = 0;
+  fds_cache_entry.magic = 0; // no key - nothing to store
+#ifdef FDS_USE_SIDECAR
+  // CRCs are stored in the sidecar
+  if (!fds_sidecar_loading && f_stat(load_filename, &fno) == FR_OK)
+#else
+  if (f_stat(load_filename, &fno) == FR_OK)
+#endif
+  {
+    fds_cache_set_key(&fds_cache_entry, load_filename, &fno, side);
+    fds_cache_hit = fds_cache_find(&fds_cache_entry) == FR_OK;
+  }
+#endif
+
+  // disk info and file amount blocks are required to start
+  while (!done && fds_block_count < FDS_LOAD_FIRST_BLOCKS)
+  {
+    cls = iosched_set_class(IOSCHED_EMULATOR);
+    fr = fds_load_next_block(&done);
+    iosched_set_class(cls);
+    if (fr != FR_OK)
     {
-      // check header
-      const char signature[] = "*NINTENDO-HVC*";
-      char verify[sizeof(signature)];
-      memcpy(verify, fds_raw_data + fds_used_space + 1, sizeof(signature) - 1);
-      verify[sizeof(signature) - 1] = 0;
-      if (strcmp(verify, signature) != 0)
-      {
-        f_close(&fp);
-        fds_close(0);
-        return FDSR_INVALID_ROM;
-      }
+      fds_close(0);
+      return fr;
     }
-    crc = fds_crc((uint8_t*) fds_raw_data + fds_used_space, block_size);
-    fds_used_space += block_size;
-    fds_raw_data[fds_used_space++] = crc & 0xFF;
-    fds_raw_data[fds_used_space++] = (crc >> 8) & 0xFF;
-    fds_block_count++;
   }
-  f_close(&fp);
+  if (done)
+    fds_load_finish();
 
 //  strcat(filename, ".good.bin");
 //  fds_dump(filename);
@@ -704,8 +1308,70 @@ FRESULT fds_load_side(char *filename, uint8_t side, uint8_t ro)
   return FR_OK;
 }
 
+// load remaining blocks, call it from the main loop until loading is finished
+FRESULT fds_load_continue()
+{
+  FRESULT fr;
+  uint8_t done = 0;
+  uint32_t start_time = HAL_GetTick();
+  IOSCHED_CLASS cls;
+
+  if (!fds_loading)
+    return FR_OK;
+
+  while (!done && (HAL_GetTick() - start_time < FDS_LOAD_TIME_SLICE))
+  {
+    // console may be reading already, these reads must not wait for it
+    cls = iosched_set_class(IOSCHED_EMULATOR);
+    fr = fds_load_next_block(&done);
+    iosched_set_class(cls);
+    if (fr != FR_OK)
+    {
+      fds_close(0);
+      return fr;
+    }
+  }
+  if (done)
+  {
+    fds_load_finish();
+    // start writing if it was postponed
+    fds_check_pins();
+  }
+
+  return FR_OK;
+}
+
+#ifdef BLOCK_STORE
+// put every block to the store and update the manifest
+static FRESULT fds_store_save(char *path)
+{
+  FRESULT fr;
+  BLOCK_STORE_FILES store;
+  int i;
+
+  fr = block_store_open(&store);
+  if (fr != FR_OK)
+    return fr;
+  for (i = 0; i < fds_block_count; i++)
+  {
+    fr = block_store_put(&store, fds_image_ptr(fds_block_offsets[i] + (i == 0 ? FDS_FIRST_GAP_READ_BITS : FDS_NEXT_GAPS_READ_BITS) / 8),
+        fds_get_block_size(i, 0, 0), &fds_store_side.blocks[i]);
+    if (fr != FR_OK)
+    {
+      block_store_close(&store);
+      return fr;
+    }
+  }
+  fr = block_store_close(&store);
+  if (fr != FR_OK)
+    return fr;
+  fds_store_side.block_count = fds_block_count;
+  return block_store_write_side(path, fds_side, &fds_store_side);
+}
+#endif
+
 // save disk changes to file
-FRESULT fds_save()
+static FRESULT fds_save_image()
 {
   FRESULT fr;
   FIL fp, fp_backup;
@@ -714,8 +1380,15 @@ FRESULT fds_save()
   UINT br, bw;
   int i;
 
-  if (!fds_changed)
+  if (!fds_is_changed())
+  {
+    // same data was written, nothing to save, leave saving state
+    __disable_irq();
+    if (fds_state == FDS_SAVE_PENDING)
+      fds_state = FDS_IDLE;
+    __enable_irq();
     return FR_OK;
+  }
 
   if (fds_readonly)
     return FDSR_READ_ONLY;
@@ -724,8 +1397,8 @@ FRESULT fds_save()
   for (i = 0; i < fds_block_count; i++)
   {
     int block_size = fds_get_block_size(i, 0, 0);
-    uint16_t valid_crc = fds_crc((uint8_t*)(fds_raw_data + fds_block_offsets[i] + (i == 0 ? FDS_FIRST_GAP_READ_BITS : FDS_NEXT_GAPS_READ_BITS) / 8), block_size);
-    uint8_t* crc = (uint8_t*)(fds_raw_data + fds_block_offsets[i] + (i == 0 ? FDS_FIRST_GAP_READ_BITS : FDS_NEXT_GAPS_READ_BITS) / 8 + block_size);
+    uint16_t valid_crc = fds_crc(fds_image_ptr(fds_block_offsets[i] + (i == 0 ? FDS_FIRST_GAP_READ_BITS : FDS_NEXT_GAPS_READ_BITS) / 8), block_size);
+    uint8_t* crc = fds_image_ptr(fds_block_offsets[i] + (i == 0 ? FDS_FIRST_GAP_READ_BITS : FDS_NEXT_GAPS_READ_BITS) / 8 + block_size);
     if (valid_crc != (*crc | (*(crc + 1) << 8)))
       return FDSR_WRONG_CRC;
   }
@@ -846,55 +1519,98 @@ FRESULT fds_save()
     }
   }
 
-  // open file
-  if (fdskey_settings.backup_original != SAVES_EVERDRIVE)
-    fr = f_open(&fp, fds_filename, FA_WRITE);
-  else
-    fr = f_open(&fp, alt_filename, FA_WRITE);
+#ifdef FDS_USE_CACHE
+  // cached CRCs will not be valid anymore
+  fr = fds_cache_invalidate(fdskey_settings.backup_original != SAVES_EVERDRIVE ? fds_filename : alt_filename);
   if (fr != FR_OK)
   {
     fds_state = FDS_IDLE;
     return fr;
   }
-  // calculating size offset
-  if (fdskey_settings.backup_original != SAVES_EVERDRIVE)
-    fr = f_stat(fds_filename, &fno);
-  else
-    fr = f_stat(alt_filename, &fno);
+#endif
+#ifdef FDS_USE_SIDECAR
+  // and expanded copies too
+  fds_cancel_sidecar();
+  fr = fds_sidecar_invalidate(fdskey_settings.backup_original != SAVES_EVERDRIVE ? fds_filename : alt_filename);
   if (fr != FR_OK)
   {
     fds_state = FDS_IDLE;
     return fr;
   }
-  int header_offset = fno.fsize % FDS_ROM_SIDE_SIZE;
-  fr = f_lseek(&fp, header_offset + fds_side * FDS_ROM_SIDE_SIZE);
-  if (fr != FR_OK)
+#endif
+
+#ifdef BLOCK_STORE
+  if (fds_store_mode)
   {
-    fds_state = FDS_IDLE;
-    return fr;
-  }
-  // save every block
-  for (i = 0; i < fds_block_count; i++)
+    // only new blocks are appended to the store
+    fr = fds_store_save(fdskey_settings.backup_original != SAVES_EVERDRIVE ? fds_filename : alt_filename);
+    if (fr != FR_OK)
+    {
+      fds_state = FDS_IDLE;
+      return fr;
+    }
+  } else
+#endif
   {
-    fr = f_write(&fp, (uint8_t*) fds_raw_data + fds_block_offsets[i] + (i == 0 ? FDS_FIRST_GAP_READ_BITS : FDS_NEXT_GAPS_READ_BITS) / 8, fds_get_block_size(i, 0, 0), &bw);
+    // open file
+    if (fdskey_settings.backup_original != SAVES_EVERDRIVE)
+      fr = f_open(&fp, fds_filename, FA_WRITE);
+    else
+      fr = f_open(&fp, alt_filename, FA_WRITE);
+    if (fr != FR_OK)
+    {
+      fds_state = FDS_IDLE;
+      return fr;
+    }
+    // calculating size offset
+    if (fdskey_settings.backup_original != SAVES_EVERDRIVE)
+      fr = f_stat(fds_filename, &fno);
+    else
+      fr = f_stat(alt_filename, &fno);
     if (fr != FR_OK)
     {
       fds_state = FDS_IDLE;
       return fr;
     }
-    if (bw != fds_get_block_size(i, 0, 0))
+    int header_offset = fno.fsize % FDS_ROM_SIDE_SIZE;
+    fr = f_lseek(&fp, header_offset + fds_side * FDS_ROM_SIDE_SIZE);
+    if (fr != FR_OK)
     {
       fds_state = FDS_IDLE;
-      return FR_DISK_ERR;
+      return fr;
+    }
+    // save every block
+    for (i = 0; i < fds_block_count; i++)
+    {
+      fr = fds_image_flush(&fp, fds_block_offsets[i] + (i == 0 ? FDS_FIRST_GAP_READ_BITS : FDS_NEXT_GAPS_READ_BITS) / 8, fds_get_block_size(i, 0, 0));
+      if (fr != FR_OK)
+      {
+        fds_state = FDS_IDLE;
+        return fr;
+      }
+    }
+    fr = f_close(&fp);
+    if (fr != FR_OK)
+    {
+      fds_state = FDS_IDLE;
+      return fr;
     }
   }
-  fr = f_close(&fp);
-  if (fr != FR_OK)
+
+  // directory caches must see the change, data is already saved so stamp failure is not fatal
+  generation_touch_dir(fdskey_settings.backup_original != SAVES_EVERDRIVE ? fds_filename : alt_filename);
+
+  // saved content is the new reference
+  fds_take_snapshot();
+  fds_image_clear_dirty();
+#ifdef FDS_USE_SIDECAR
+  // file matches memory again, new copy will be stored when disk is idle
+  if (f_stat(fdskey_settings.backup_original != SAVES_EVERDRIVE ? fds_filename : alt_filename, &fno) == FR_OK)
   {
-    fds_state = FDS_IDLE;
-    return fr;
+    fds_sidecar_set_key(&fds_sidecar, fdskey_settings.backup_original != SAVES_EVERDRIVE ? fds_filename : alt_filename, &fno, fds_side);
+    fds_schedule_sidecar();
   }
-
+#endif
   // clear changed flag
   fds_changed = 0;
   // resume idle state
@@ -903,6 +1619,140 @@ FRESULT fds_save()
   return FR_OK;
 }
 
+// save image if it's changed
+FRESULT fds_save()
+{
+  FRESULT fr;
+  IOSCHED_CLASS cls = iosched_set_class(IOSCHED_EMULATOR);
+
+  fr = fds_save_image();
+  iosched_set_class(cls);
+  return fr;
+}
+
+// clear journal header
+static FRESULT fds_journal_clear()
+{
+  FRESULT fr;
+  FIL fp;
+  UINT bw;
+  const uint32_t empty = 0;
+
+  fr = f_open(&fp, FDS_JOURNAL_FILE, FA_OPEN_EXISTING | FA_WRITE);
+  if (fr != FR_OK)
+    return fr;
+  fr = f_write(&fp, &empty, sizeof(empty), &bw);
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    return fr;
+  }
+  return f_close(&fp);
+}
+
+// save data written to the journal on power failure, call it on start
+FRESULT fds_journal_replay(uint8_t *restored)
+{
+  FRESULT fr;
+  FIL fp;
+  UINT br;
+  int i;
+  uint16_t count = 0;
+  uint32_t hash = 0;
+  uint32_t stored_hash, header_hash;
+
+  *restored = 0;
+  fr = f_open(&fp, FDS_JOURNAL_FILE, FA_OPEN_EXISTING | FA_READ);
+  if (fr == FR_NO_FILE)
+    return FR_OK;
+  if (fr != FR_OK)
+    return fr;
+  fr = f_read(&fp, &fds_journal, sizeof(fds_journal), &br);
+  f_close(&fp);
+  if (fr != FR_OK)
+    return fr;
+  if (br != sizeof(fds_journal) || fds_journal.header.magic != FDS_JOURNAL_MAGIC)
+    return FR_OK; // nothing to replay
+  stored_hash = fds_journal.header.payload_hash;
+  fds_journal.header.payload_hash = 0;
+  header_hash = fds_hash((uint8_t*)&fds_journal.header, sizeof(fds_journal.header));
+  fds_journal.header.filename[sizeof(fds_journal.header.filename) - 1] = 0;
+  if (fds_journal.header.block_count < 0 || fds_journal.header.block_count > FDS_MAX_BLOCKS
+      || fds_journal.header.used_space < 0 || fds_journal.header.used_space > FDS_MAX_SIDE_SIZE
+      || fds_journal.header.sector_count > FDS_IMAGE_SECTORS)
+    return fds_journal_clear();
+  // block offsets must be ascending and inside the image
+  for (i = 0; i < fds_journal.header.block_count; i++)
+  {
+    if (fds_journal.header.block_offsets[i] < (i ? fds_journal.header.block_offsets[i - 1] + 1 : 0)
+        || fds_journal.header.block_offsets[i] >= FDS_MAX_SIDE_SIZE
+        || fds_journal.header.block_offsets[i] > fds_journal.header.used_space)
+      return fds_journal_clear();
+  }
+
+  // load original image completely
+  fr = fds_load_side(fds_journal.header.filename, fds_journal.header.side, 0);
+  while (fr == FR_OK && fds_loading)
+    fr = fds_load_continue();
+  if (fr != FR_OK)
+  {
+    // original image is not available anymore
+    fds_close(0);
+    fds_journal_clear();
+    return fr;
+  }
+  // image must not be changed by the console now
+  fds_stop();
+  fds_state = FDS_OFF;
+
+  // apply changed sectors
+  fr = f_open(&fp, FDS_JOURNAL_FILE, FA_OPEN_EXISTING | FA_READ);
+  if (fr == FR_OK)
+    fr = f_lseek(&fp, FDS_JOURNAL_HEADER_SECTORS * FF_MIN_SS);
+  for (i = 0; fr == FR_OK && i < FDS_IMAGE_SECTORS; i++)
+  {
+    if (!(fds_journal.header.dirty_sectors[i / 32] & (1UL << (i % 32))))
+      continue;
+    fr = fds_image_load(&fp, i * FF_MIN_SS, FF_MIN_SS, &br);
+    if (fr == FR_OK && br != FF_MIN_SS)
+      fr = FR_INT_ERR;
+    hash = (hash * 16777619UL) ^ fds_hash(fds_image_ptr(i * FF_MIN_SS), FF_MIN_SS);
+    count++;
+  }
+  f_close(&fp);
+  hash = (hash * 16777619UL) ^ header_hash;
+  if (fr == FR_OK && (count != fds_journal.header.sector_count || hash != stored_hash))
+  {
+    // incomplete journal, original file is untouched
+    fds_close(0);
+    return fds_journal_clear();
+  }
+  if (fr != FR_OK)
+  {
+    fds_close(0);
+    return fr;
+  }
+  fds_used_space = fds_journal.header.used_space;
+  fds_block_count = fds_journal.header.block_count;
+  for (i = 0; i < fds_block_count; i++)
+    fds_block_offsets[i] = fds_journal.header.block_offsets[i];
+  fds_changed = 1;
+
+  // save it as usual
+  fr = fds_save();
+  fds_close(0);
+  if (fr == FR_OK)
+    *restored = 1;
+  // don't try again, file is saved or can't be saved at all
+  if (fr == FR_OK || fr == FDSR_WRONG_CRC || fr == FDSR_READ_ONLY || fr == FR_DENIED)
+  {
+    FRESULT fr_clear = fds_journal_clear();
+    if (fr == FR_OK)
+      fr = fr_clear;
+  }
+  return fr;
+}
+
 // stop drive emulation
 FRESULT fds_close(uint8_t save)
 {
@@ -920,16 +1770,33 @@ FRESULT fds_close(uint8_t save)
   fds_stop();
   fds_state = FDS_OFF;
 
+  // abort loading
+  if (fds_loading)
+  {
+    f_close(&fds_load_fp);
+    fds_loading = 0;
+  }
+#ifdef FDS_USE_SIDECAR
+  fds_sidecar_loading = 0;
+  fds_cancel_sidecar();
+#endif
+#ifdef BLOCK_STORE
+  fds_store_mode = 0;
+#endif
+
   // reset state variables
   fds_used_space = 0;
   fds_block_count = 0;
+  fds_snapshot_block_count = 0;
   fds_changed = 0;
-#ifdef FDS_USE_DYNAMIC_MEMORY
-  // free memory if need
-  if (fds_raw_data)
-    free(fds_raw_data);
-  fds_raw_data = 0;
+#ifdef DUMP_CHECK
+  fds_side_crc = 0;
+  fds_side_crc_blocks = 0;
+  fds_side_crc_restart = FDS_MAX_BLOCKS;
+  fds_side_written = 0;
+  fds_side_info_written = 0;
 #endif
+  fds_image_free();
 
   return fr;
 }
@@ -940,12 +1807,196 @@ FDS_STATE fds_get_state()
   return fds_state;
 }
 
-// return non-zero if disk content is changed and should be saved
+// return non-zero while console is writing or read head is near block boundary,
+// it's better to not start long SD or OLED transfers at this time
+uint8_t fds_is_timing_critical()
+{
+  int block;
+  int pos;
+
+  switch (fds_state)
+  {
+  case FDS_WRITING_GAP:
+  case FDS_WRITING:
+  case FDS_WRITING_STOPPING:
+    return 1;
+  case FDS_READING:
+    // head is waiting for the loader, nothing to protect
+    if (fds_loading)
+      return 0;
+    block = fds_get_block();
+    if (block < 0)
+      return 0;
+    pos = fds_current_byte - fds_block_offsets[block];
+    // just after previous block end, console may start writing here
+    if (pos < FDS_BOUNDARY_GUARD_BYTES)
+      return 1;
+    // just before block data
+    if (pos + FDS_BOUNDARY_GUARD_BYTES >= (block == 0 ? FDS_FIRST_GAP_READ_BITS : FDS_NEXT_GAPS_READ_BITS) / 8
+        && pos < (block == 0 ? FDS_FIRST_GAP_READ_BITS : FDS_NEXT_GAPS_READ_BITS) / 8)
+      return 1;
+    return 0;
+  default:
+    return 0;
+  }
+}
+
+// set transfer rate, it's applied on next reading start
+void fds_set_transfer_rate(FDS_TRANSFER_RATE rate)
+{
+  fds_rate = rate;
+  fds_rate_fallback = 0;
+  fds_read_failures = 0;
+}
+
+// return current transfer rate
+FDS_TRANSFER_RATE fds_get_transfer_rate()
+{
+  return fds_rate;
+}
+
+// return non-zero once if transfer rate was reset to normal because of read failures
+uint8_t fds_transfer_rate_fallback()
+{
+  uint8_t r = fds_rate_fallback;
+  fds_rate_fallback = 0;
+  return r;
+}
+
+// return non-zero if disk content is changed and should be saved,
+// clears changed flag if all the blocks were rewritten with the same data
 uint8_t fds_is_changed()
 {
+  int i;
+  uint32_t generation;
+
+  if (!fds_changed)
+    return 0;
+
+  generation = fds_write_generation;
+  switch (fds_state)
+  {
+  case FDS_WRITING_GAP:
+  case FDS_WRITING:
+  case FDS_WRITING_STOPPING:
+    // writing in progress
+    return 1;
+  default:
+    break;
+  }
+  if (fds_block_count != fds_snapshot_block_count)
+    return 1;
+  for (i = 0; i < fds_block_count; i++)
+    if (!fds_block_matches_snapshot(i))
+      return 1;
+
+  // nothing changed actually, but make sure that there was no new writing
+  __disable_irq();
+  if (generation == fds_write_generation)
+  {
+    fds_changed = 0;
+    fds_image_clear_dirty();
+  }
+  __enable_irq();
   return fds_changed;
 }
 
+// search for the file by its 8-character name,
+// returns index of the file header block or -1 if not found, call it only when disk is not used
+int fds_find_file(const char *name)
+{
+  int i;
+
+  for (i = 2; i + 1 < fds_block_count; i += 2)
+    if (memcmp(fds_image_ptr(fds_block_offsets[i] + FDS_NEXT_GAPS_READ_BITS / 8 + 3), name, 8) == 0)
+      return i;
+  return -1;
+}
+
+// return pointer to the data of the file and its size
+uint8_t *fds_get_file_data(int header_block, uint16_t *size)
+{
+  *size = fds_get_block_size(header_block + 1, 0, 0) - 1;
+  return fds_image_ptr(fds_block_offsets[header_block + 1] + FDS_NEXT_GAPS_READ_BITS / 8 + 1);
+}
+
+// write block with gap and CRC, returns position after it
+static int fds_put_block(int pos, const uint8_t *data, int size)
+{
+  uint16_t crc;
+
+  memset(fds_image_ptr(pos), 0, FDS_NEXT_GAPS_READ_BITS / 8 - 1);
+  pos += FDS_NEXT_GAPS_READ_BITS / 8;
+  fds_image_write(pos - 1, 0x80); // gap terminator
+  memmove(fds_image_ptr(pos), data, size); // data can be already in place
+  crc = fds_crc(fds_image_ptr(pos), size);
+  fds_image_write(pos + size, crc & 0xFF);
+  fds_image_write(pos + size + 1, (crc >> 8) & 0xFF);
+  return pos + size + 2;
+}
+
+// replace file at the header block and all the files after it with the new file,
+// call it only when disk is not used (FDS_SAVE_PENDING or FDS_IDLE state)
+FRESULT fds_put_file(int header_block, const char *name, uint16_t address, uint8_t type, const uint8_t *data, uint16_t size)
+{
+  uint8_t header[16];
+  int pos;
+  int end;
+  uint8_t file_number = (header_block - 2) / 2;
+
+  // existing file only, both its blocks must be loaded
+  if (header_block < 2 || header_block % 2 != 0 || header_block + 1 >= fds_block_count || fds_loading)
+    return FDSR_INVALID_ROM;
+  pos = fds_block_offsets[header_block];
+  end = pos + (FDS_NEXT_GAPS_READ_BITS / 8 + sizeof(header) + 2) + (FDS_NEXT_GAPS_READ_BITS / 8 + 1 + size + 2);
+  if (end > FDS_MAX_SIDE_SIZE)
+    return FDSR_ROM_TOO_LARGE;
+
+  header[0] = 3;
+  header[1] = file_number;
+  header[2] = file_number; // file ID
+  memcpy(&header[3], name, 8);
+  header[11] = address & 0xFF;
+  header[12] = (address >> 8) & 0xFF;
+  header[13] = size & 0xFF;
+  header[14] = (size >> 8) & 0xFF;
+  header[15] = type;
+
+  // remove old files
+  if (fds_used_space > pos)
+    memset(fds_image_ptr(pos), 0, fds_used_space - pos);
+  fds_block_count = header_block;
+  // header block
+  fds_block_offsets[header_block] = pos;
+  pos = fds_put_block(pos, header, sizeof(header));
+  // data block
+  fds_block_offsets[header_block + 1] = pos;
+  fds_image_write(pos + FDS_NEXT_GAPS_READ_BITS / 8, 4);
+  memcpy(fds_image_ptr(pos + FDS_NEXT_GAPS_READ_BITS / 8 + 1), data, size);
+  pos = fds_put_block(pos, fds_image_ptr(pos + FDS_NEXT_GAPS_READ_BITS / 8), size + 1);
+  // update file amount block
+  fds_image_write(fds_block_offsets[1] + FDS_NEXT_GAPS_READ_BITS / 8 + 1, file_number + 1);
+  fds_put_block(fds_block_offsets[1], fds_image_ptr(fds_block_offsets[1] + FDS_NEXT_GAPS_READ_BITS / 8), 2);
+  fds_image_mark_dirty(fds_block_offsets[1], pos > fds_used_space ? pos : fds_used_space);
+  fds_used_space = pos;
+  fds_block_count = header_block + 2;
+  fds_write_generation++;
+  fds_changed = 1;
+#ifdef DUMP_CHECK
+  fds_side_crc_restart = 1; // file amount block is changed too
+#endif
+  return FR_OK;
+}
+
+// forget changes without saving, current content becomes the new reference
+void fds_discard_changes()
+{
+  fds_take_snapshot();
+  fds_image_clear_dirty();
+  fds_changed = 0;
+  fds_check_pins();
+}
+
 // calculate and return current block number
 int fds_get_block()
 {
@@ -966,6 +2017,81 @@ int fds_get_block()
   }
 }
 
+#ifdef DUMP_CHECK
+// extend the side CRC over the blocks completed by the copier,
+// call it from the main loop, only the new blocks are hashed
+void fds_update_side_crc()
+{
+  int i, last, offset, size, restart;
+
+  if (fds_loading)
+    return;
+  __disable_irq();
+  restart = fds_side_crc_restart;
+  fds_side_crc_restart = FDS_MAX_BLOCKS;
+  __enable_irq();
+  if (restart < fds_side_crc_blocks)
+  {
+    // hashed block was rewritten
+    fds_side_crc = 0;
+    fds_side_crc_blocks = 0;
+  }
+  switch (fds_state)
+  {
+  case FDS_WRITING_GAP:
+  case FDS_WRITING:
+  case FDS_WRITING_STOPPING:
+    // block under the head is not finished yet
+    last = fds_get_block();
+    break;
+  default:
+    last = fds_block_count;
+    break;
+  }
+  for (i = fds_side_crc_blocks; i < last; i++)
+  {
+    offset = fds_block_offsets[i] + (i == 0 ? FDS_FIRST_GAP_READ_BITS : FDS_NEXT_GAPS_READ_BITS) / 8;
+    size = fds_get_block_size(i, 0, 0);
+    if (offset + size > FDS_MAX_SIDE_SIZE)
+      break;
+    fds_side_crc = dump_check_crc32(fds_side_crc, fds_image_ptr(offset), size);
+    fds_side_crc_blocks = i + 1;
+  }
+}
+
+// get CRC32 and disk ID of the side once after the copier finished writing it,
+// returns 0 if the side was not written by a copier or writing is in progress
+uint8_t fds_take_written_side(uint32_t *crc, uint8_t *disk_id)
+{
+  switch (fds_state)
+  {
+  case FDS_IDLE:
+  case FDS_SAVE_PENDING:
+    break;
+  default:
+    return 0;
+  }
+  __disable_irq();
+  if (!fds_side_written)
+  {
+    __enable_irq();
+    return 0;
+  }
+  fds_side_written = 0;
+  __enable_irq();
+  // game saves don't need verification
+  if (!fds_side_info_written)
+    return 0;
+  fds_update_side_crc();
+  // whole side must be hashed
+  if (fds_side_crc_blocks != fds_block_count || !fds_side_crc_blocks)
+    return 0;
+  *crc = fds_side_crc;
+  memcpy(disk_id, fds_image_ptr(fds_block_offsets[0] + FDS_FIRST_GAP_READ_BITS / 8 + DUMP_CHECK_ID_OFFSET), DUMP_CHECK_ID_SIZE);
+  return 1;
+}
+#endif
+
 // return current amount of blocks
 int fds_get_block_count()
 {
@@ -7,6 +7,18 @@
 #include "buttons.h"
 #include "sideselect.h"
 #include "splash.h"
+#include "fdsprofile.h"
+#include "launcher.h"
+#include "iosched.h"
+#include "dumpcheck.h"
+#include "browser.h"
+
+#ifdef DUMP_CHECK
+static DUMP_CHECK_RESULT fds_gui_dump_result = DUMP_CHECK_NONE;
+#endif
+// message is shown instead of the disk screen until timeout, the main loop keeps running
+static uint8_t fds_gui_message_shown = 0;
+static uint32_t fds_gui_message_time = 0;
 
 void fds_gui_draw(uint8_t side, uint8_t side_count, char *game_name, int text_scroll)
 {
@@ -106,6 +118,27 @@ void fds_gui_draw(uint8_t side, uint8_t side_count, char *game_name, int text_sc
   if (file_count < 0) file_count = 0;
   sprintf(file_str, "%02d", file_count);
   oled_draw_text(&FDS_GUI_FILE_NUMBER_FONT, file_str, 80, line + 22, 0, 0);
+#ifdef DUMP_CHECK
+  // verification result of the side written by the copier
+  switch (fds_gui_dump_result)
+  {
+  case DUMP_CHECK_MATCH:
+    strcpy(file_str, "OK");
+    break;
+  case DUMP_CHECK_MISMATCH:
+    strcpy(file_str, "BAD");
+    break;
+  case DUMP_CHECK_UNKNOWN:
+    strcpy(file_str, "??");
+    break;
+  default:
+    *file_str = 0;
+    break;
+  }
+  if (*file_str)
+    oled_draw_text(&FDS_GUI_FILE_NUMBER_FONT, file_str,
+        OLED_WIDTH - oled_get_text_length(&FDS_GUI_FILE_NUMBER_FONT, file_str), line + 22, 0, 0);
+#endif
   if (state_image != (DotMatrixImage*)&IMAGE_STATE_PAUSE) // lol
   {
     static int spinning = 0;
@@ -185,34 +218,149 @@ void fds_gui_draw_side_changing(uint8_t swap, int frame)
   oled_draw_image(image, OLED_WIDTH - image->width - 20, line + OLED_HEIGHT / 2 - image->height / 2, 0, 0);
 }
 
+static void fds_gui_show_transfer_rate(char *title)
+{
+  char text[64];
+  char *rate;
+
+  switch (fds_get_transfer_rate())
+  {
+  case FDS_RATE_FAST:
+    rate = "fast (+11%)";
+    break;
+  case FDS_RATE_FASTER:
+    rate = "faster (+25%)";
+    break;
+  default:
+    rate = "normal";
+    break;
+  }
+  sprintf(text, "%s\nTransfer rate: %s", title, rate);
+  show_message(text, 0);
+  fds_gui_message_shown = 1;
+  fds_gui_message_time = HAL_GetTick();
+}
+
 FRESULT fds_gui_load_side(char *filename, char *game_name, uint8_t *side, uint8_t side_count, uint8_t ro)
 {
   FRESULT fr;
   int i, text_scroll = 0;
   uint8_t cmd;
   uint8_t zero_side = 0;
+#ifdef DUMP_CHECK
+  uint32_t side_crc;
+  uint8_t disk_id[DUMP_CHECK_ID_SIZE];
+#endif
+#ifdef LAUNCHER_ENABLED
+  LAUNCHER_RESULT launcher_result;
+#endif
 
   show_loading_screen();
+  // side memory needs the heap more than the browser cache
+  browser_free();
+  fds_gui_message_shown = 0;
 
   if (!side) side = &zero_side;
+  fds_set_transfer_rate(fds_profile_get_rate(filename));
   fr = fds_load_side(filename, *side, ro);
   if (fr != FR_OK)
     return fr;
+#ifdef DUMP_CHECK
+  fds_gui_dump_result = DUMP_CHECK_NONE;
+#endif
 
   while (1)
   {
+    // load remaining blocks while console reads the first gap
+    fr = fds_load_continue();
+    if (fr != FR_OK)
+      return fr;
+    // caches are written when neither console nor user needs the card
+    fr = iosched_run_pending();
+    if (fr != FR_OK)
+      return fr;
+
+#ifdef LAUNCHER_ENABLED
     if (fds_get_state() == FDS_SAVE_PENDING)
     {
-      show_saving_screen();
+      // launcher disk writes commands instead of the game data
+      fr = launcher_process(&launcher_result);
+      if (fr != FR_OK)
+        return fr;
+      if (launcher_result == LAUNCHER_SELECTED)
+      {
+        // replace launcher with the selected image, launcher disk is never saved
+        fr = fds_close(0);
+        if (fr != FR_OK)
+          return fr;
+        show_loading_screen();
+        filename = launcher_get_path();
+        game_name = launcher_get_name();
+        side_count = launcher_get_side_count();
+        ro = launcher_get_readonly();
+        *side = 0;
+        fds_set_transfer_rate(fds_profile_get_rate(filename));
+        fr = fds_load_side(filename, *side, ro);
+        if (fr != FR_OK)
+          return fr;
+#ifdef DUMP_CHECK
+        fds_gui_dump_result = DUMP_CHECK_NONE;
+#endif
+        text_scroll = 0;
+        continue;
+      }
+    }
+#endif
+
+#ifdef DUMP_CHECK
+    // hash new blocks while the copier writes, verify the side when it stops
+    fds_update_side_crc();
+    switch (fds_get_state())
+    {
+    case FDS_WRITING_GAP:
+    case FDS_WRITING:
+    case FDS_WRITING_STOPPING:
+      fds_gui_dump_result = DUMP_CHECK_NONE;
+      break;
+    case FDS_SAVE_PENDING:
+      if (fds_take_written_side(&side_crc, disk_id))
+        fds_gui_dump_result = dump_check_lookup(disk_id, side_crc);
+      break;
+    default:
+      break;
+    }
+#endif
+
+    if (fds_get_state() == FDS_SAVE_PENDING)
+    {
+      // no saving screen if the same data was written
+      if (fds_is_changed()) show_saving_screen();
       fr = fds_save();
       if (fr != FR_OK)
         return fr;
     }
 
+    if (fds_transfer_rate_fallback())
+    {
+      // too many read errors, remember normal rate for this title
+      fr = fds_profile_set_rate(filename, FDS_RATE_NORMAL);
+      if (fr != FR_OK)
+        return fr;
+      fds_gui_show_transfer_rate("Read errors");
+    }
+
     cmd = 0;
     if (button_left_newpress())
         break;
-    button_right_newpress(); // to reset
+    if (button_right_newpress())
+    {
+      // switch transfer rate for this title
+      fds_set_transfer_rate((fds_get_transfer_rate() + 1) % (FDS_RATE_FASTER + 1));
+      fr = fds_profile_set_rate(filename, fds_get_transfer_rate());
+      if (fr != FR_OK)
+        return fr;
+      fds_gui_show_transfer_rate("Saved");
+    }
     if (button_up_newpress() && *side > 0)
       cmd = 1;
     if (button_down_newpress() && *side + 1 < side_count)
@@ -220,6 +368,7 @@ FRESULT fds_gui_load_side(char *filename, char *game_name, uint8_t *side, uint8_
     if (cmd)
     {
       // need to change side
+      fds_gui_message_shown = 0;
       if (fds_is_changed()) show_saving_screen();
       fr = fds_close(1);
       if (fr != FR_OK)
@@ -246,6 +395,9 @@ FRESULT fds_gui_load_side(char *filename, char *game_name, uint8_t *side, uint8_
       fr = fds_load_side(filename, *side, ro);
       if (fr != FR_OK)
         return fr;
+#ifdef DUMP_CHECK
+      fds_gui_dump_result = DUMP_CHECK_NONE;
+#endif
       fds_gui_draw(*side, side_count, game_name, text_scroll);
       oled_update_invisible();
       for (i = 0; i < OLED_HEIGHT; i++)
@@ -255,9 +407,14 @@ FRESULT fds_gui_load_side(char *filename, char *game_name, uint8_t *side, uint8_
       }
     }
 
-    fds_gui_draw(*side, side_count, game_name, text_scroll);
-    oled_update_invisible();
-    oled_switch_to_invisible();
+    if (fds_gui_message_shown && HAL_GetTick() - fds_gui_message_time >= FDS_GUI_MESSAGE_DELAY)
+      fds_gui_message_shown = 0;
+    if (!fds_gui_message_shown)
+    {
+      fds_gui_draw(*side, side_count, game_name, text_scroll);
+      oled_update_invisible();
+      oled_switch_to_invisible();
+    }
 //    if (!text_scroll)
 //      oled_screenshot("ss_fds_emu_gui.bmp");
     button_check_screen_off();
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+#include "fdsimage.h"
+
+#ifdef FDS_IMAGE_BACKEND_GAPPED
+
+#ifdef FDS_USE_DYNAMIC_MEMORY
+uint8_t * volatile fds_image_data = 0;
+#else
+volatile uint8_t fds_image_data[FDS_MAX_SIDE_SIZE];
+#endif
+// sectors changed since last save
+static volatile uint32_t fds_image_dirty[(FDS_IMAGE_SECTORS + 31) / 32];
+
+// allocate and clear side memory
+FRESULT fds_image_alloc()
+{
+#ifdef FDS_USE_DYNAMIC_MEMORY
+  if (!fds_image_data)
+    fds_image_data = malloc(FDS_MAX_SIDE_SIZE * sizeof(uint8_t));
+  if (!fds_image_data)
+    return FDSR_OUT_OF_MEMORY;
+#endif
+  memset((uint8_t*)fds_image_data, 0, FDS_MAX_SIDE_SIZE);
+  fds_image_clear_dirty();
+  return FR_OK;
+}
+
+// free memory if need
+void fds_image_free()
+{
+  fds_image_clear_dirty();
+#ifdef FDS_USE_DYNAMIC_MEMORY
+  if (fds_image_data)
+    free(fds_image_data);
+  fds_image_data = 0;
+#endif
+}
+
+// read data from the image file directly into the side memory
+FRESULT fds_image_load(FIL *fp, int offset, UINT size, UINT *br)
+{
+  return f_read(fp, (uint8_t*)fds_image_data + offset, size, br);
+}
+
+// write data from the side memory to the image file
+FRESULT fds_image_flush(FIL *fp, int offset, UINT size)
+{
+  FRESULT fr;
+  UINT bw;
+
+  fr = f_write(fp, (uint8_t*)fds_image_data + offset, size, &bw);
+  if (fr != FR_OK)
+    return fr;
+  if (bw != size)
+    return FR_DISK_ERR;
+  return FR_OK;
+}
+
+// mark side memory range as changed since last save
+void fds_image_mark_dirty(int start, int end)
+{
+  int i;
+  if (end > FDS_MAX_SIDE_SIZE)
+    end = FDS_MAX_SIDE_SIZE;
+  for (i = start / FF_MIN_SS; i * FF_MIN_SS < end; i++)
+    fds_image_dirty[i / 32] |= 1UL << (i % 32);
+}
+
+// side memory is the same as the file
+void fds_image_clear_dirty()
+{
+  memset((void*)fds_image_dirty, 0, sizeof(fds_image_dirty));
+}
+
+// enumerate changed sectors, start with -1
+int fds_image_next_dirty(int sector)
+{
+  for (sector++; sector < FDS_IMAGE_SECTORS; sector++)
+    if (fds_image_dirty[sector / 32] & (1UL << (sector % 32)))
+      return sector;
+  return -1;
+}
+
+// copy changed sectors bitmap, bytewise because destination can be a packed structure
+void fds_image_get_dirty_map(void *map)
+{
+  memcpy(map, (void*)fds_image_dirty, sizeof(fds_image_dirty));
+}
+
+#endif
@@ -0,0 +1,71 @@
+#include <string.h>
+#include "fdsprofile.h"
+#include "fdscache.h"
+
+// every title has its own slot in the profile file
+static FSIZE_t fds_profile_slot_offset(uint32_t path_hash)
+{
+  return (FSIZE_t)(path_hash % FDS_PROFILE_ENTRIES) * sizeof(FDS_PROFILE_ENTRY);
+}
+
+// read title transfer rate, normal by default
+FDS_TRANSFER_RATE fds_profile_get_rate(char *path)
+{
+  FRESULT fr;
+  FIL fp;
+  UINT br;
+  FDS_PROFILE_ENTRY entry;
+  uint32_t hash = fds_cache_path_hash(path);
+
+  fr = f_open(&fp, FDS_PROFILE_FILE, FA_READ);
+  if (fr != FR_OK)
+    return FDS_RATE_NORMAL;
+  fr = f_lseek(&fp, fds_profile_slot_offset(hash));
+  if (fr == FR_OK)
+    fr = f_read(&fp, &entry, sizeof(entry), &br);
+  f_close(&fp);
+  if (fr != FR_OK || br != sizeof(entry) || entry.magic != FDS_PROFILE_MAGIC
+      || entry.path_hash != hash || entry.rate > FDS_RATE_FASTER)
+    return FDS_RATE_NORMAL;
+  return entry.rate;
+}
+
+// store title transfer rate, create profile file if need
+FRESULT fds_profile_set_rate(char *path, FDS_TRANSFER_RATE rate)
+{
+  FRESULT fr;
+  FIL fp;
+  UINT bw;
+  FDS_PROFILE_ENTRY entry;
+  uint8_t created = 0;
+
+  entry.magic = FDS_PROFILE_MAGIC;
+  entry.path_hash = fds_cache_path_hash(path);
+  entry.rate = rate;
+
+  fr = f_open(&fp, FDS_PROFILE_FILE, FA_OPEN_EXISTING | FA_WRITE);
+  if (fr == FR_NO_FILE)
+  {
+    fr = f_open(&fp, FDS_PROFILE_FILE, FA_CREATE_NEW | FA_WRITE);
+    created = 1;
+  }
+  if (fr != FR_OK)
+    return fr;
+  fr = f_lseek(&fp, fds_profile_slot_offset(entry.path_hash));
+  if (fr == FR_OK)
+    fr = f_write(&fp, &entry, sizeof(entry), &bw);
+  if (fr == FR_OK && bw != sizeof(entry))
+    fr = FR_DENIED;
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    return fr;
+  }
+  fr = f_close(&fp);
+  if (fr != FR_OK)
+    return fr;
+  // hide it from the file browser
+  if (created)
+    fr = f_chmod(FDS_PROFILE_FILE, AM_HID, AM_HID);
+  return fr;
+}
@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include "fdssidecar.h"
+#include "fdscache.h"
+#include "fdsimage.h"
+
+// size of the key part of the header
+#define FDS_SIDECAR_KEY_SIZE offsetof(FDS_SIDECAR_HEADER, used_space)
+
+// one file per path/side pair: "fdskey.sc\\XXXXXXXX.N"
+static void fds_sidecar_path(char *path, uint32_t path_hash, uint8_t side)
+{
+  sprintf(path, FDS_SIDECAR_DIR "\\%08lX.%d", (unsigned long)path_hash, side);
+}
+
+// fill header key
+void fds_sidecar_set_key(FDS_SIDECAR_HEADER *header, char *path, FILINFO *fno, uint8_t side)
+{
+  memset(header, 0, FDS_SIDECAR_KEY_SIZE);
+  header->magic = FDS_SIDECAR_MAGIC;
+  header->path_hash = fds_cache_path_hash(path);
+  header->fsize = fno->fsize;
+  header->fdate = fno->fdate;
+  header->ftime = fno->ftime;
+  header->side = side;
+}
+
+// open sidecar with the same key and read its block table,
+// returns FR_OK and leaves file open at the image data if found, FR_NO_FILE if not
+FRESULT fds_sidecar_open(FIL *fp, FDS_SIDECAR_HEADER *header)
+{
+  FRESULT fr;
+  UINT br;
+  int i;
+  char path[32];
+  FDS_SIDECAR_HEADER key;
+
+  memcpy(&key, header, FDS_SIDECAR_KEY_SIZE);
+  fds_sidecar_path(path, header->path_hash, header->side);
+  fr = f_open(fp, path, FA_READ);
+  if (fr == FR_NO_PATH)
+    fr = FR_NO_FILE;
+  if (fr != FR_OK)
+    return fr;
+  fr = f_read(fp, header, sizeof(FDS_SIDECAR_HEADER), &br);
+  if (fr == FR_OK && (br != sizeof(FDS_SIDECAR_HEADER)
+      || memcmp(&key, header, FDS_SIDECAR_KEY_SIZE) != 0
+      || header->block_count <= 0 || header->block_count > FDS_MAX_BLOCKS
+      || header->used_space <= 0 || header->used_space > FDS_MAX_SIDE_SIZE
+      || f_size(fp) != sizeof(FDS_SIDECAR_HEADER) + header->used_space
+      || header->block_offsets[0] != 0))
+    fr = FR_NO_FILE;
+  // blocks must follow each other
+  for (i = 1; fr == FR_OK && i < header->block_count; i++)
+    if (header->block_offsets[i] <= header->block_offsets[i - 1] || header->block_offsets[i] >= header->used_space)
+      fr = FR_NO_FILE;
+  if (fr != FR_OK)
+  {
+    f_close(fp);
+    // restore key, sidecar is stale or broken
+    memcpy(header, &key, FDS_SIDECAR_KEY_SIZE);
+  }
+  return fr;
+}
+
+// write image from memory by chunks, so it can be interrupted by more important SD access,
+// header is written last, so incomplete sidecar is never loaded,
+// start with written = 0, done is set after the header is written
+FRESULT fds_sidecar_store_step(FDS_SIDECAR_HEADER *header, int *written, uint8_t *done)
+{
+  FRESULT fr;
+  FIL fp;
+  UINT bw;
+  int size;
+  char path[32];
+  FDS_SIDECAR_HEADER empty;
+
+  *done = 0;
+  fds_sidecar_path(path, header->path_hash, header->side);
+  if (!*written)
+  {
+    fr = f_mkdir(FDS_SIDECAR_DIR);
+    if (fr == FR_OK)
+      // hide it from the file browser
+      fr = f_chmod(FDS_SIDECAR_DIR, AM_HID, AM_HID);
+    else if (fr == FR_EXIST)
+      fr = FR_OK;
+    if (fr != FR_OK)
+      return fr;
+    fr = f_open(&fp, path, FA_CREATE_ALWAYS | FA_WRITE);
+    if (fr != FR_OK)
+      return fr;
+    // reserve space at once, so loading is a single contiguous read
+    fr = f_expand(&fp, sizeof(FDS_SIDECAR_HEADER) + header->used_space, 0);
+    if (fr == FR_DENIED)
+      fr = FR_OK; // no contiguous space, fragmented file is still fine
+    // invalid header until all the data is written
+    memset(&empty, 0, sizeof(empty));
+    if (fr == FR_OK)
+      fr = f_write(&fp, &empty, sizeof(FDS_SIDECAR_HEADER), &bw);
+  } else {
+    fr = f_open(&fp, path, FA_OPEN_EXISTING | FA_WRITE);
+    if (fr != FR_OK)
+      return fr;
+    fr = f_lseek(&fp, sizeof(FDS_SIDECAR_HEADER) + *written);
+  }
+  if (fr == FR_OK && *written < header->used_space)
+  {
+    size = header->used_space - *written;
+    if (size > FDS_SIDECAR_CHUNK_SIZE)
+      size = FDS_SIDECAR_CHUNK_SIZE;
+    fr = fds_image_flush(&fp, *written, size);
+    if (fr == FR_OK)
+      *written += size;
+  } else if (fr == FR_OK)
+  {
+    // all the data is there
+    fr = f_lseek(&fp, 0);
+    if (fr == FR_OK)
+      fr = f_write(&fp, header, sizeof(FDS_SIDECAR_HEADER), &bw);
+    if (fr == FR_OK && bw != sizeof(FDS_SIDECAR_HEADER))
+      fr = FR_DENIED;
+    if (fr == FR_OK)
+      *done = 1;
+  }
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    f_unlink(path);
+    return fr;
+  }
+  return f_close(&fp);
+}
+
+// remove sidecar of the single side
+FRESULT fds_sidecar_remove(uint32_t path_hash, uint8_t side)
+{
+  FRESULT fr;
+  char path[32];
+
+  fds_sidecar_path(path, path_hash, side);
+  fr = f_unlink(path);
+  if (fr == FR_NO_FILE || fr == FR_NO_PATH)
+    fr = FR_OK; // nothing to remove
+  return fr;
+}
+
+// remove sidecars of all sides, call it every time file is modified
+FRESULT fds_sidecar_invalidate(char *path)
+{
+  FRESULT fr = FR_OK;
+  uint32_t hash = fds_cache_path_hash(path);
+  int side;
+
+  for (side = 0; fr == FR_OK && side < FDS_SIDECAR_MAX_SIDES; side++)
+    fr = fds_sidecar_remove(hash, side);
+  return fr;
+}
@@ -6,34 +6,40 @@
 #include "buttons.h"
 #include "splash.h"
 #include "confirm.h"
+#include "fdscache.h"
+#include "fdssidecar.h"
+#include "blockstore.h"
+#include "generation.h"
 
-static void file_properties_draw(uint8_t selection, uint8_t wp)
+static void file_properties_draw(uint8_t selection, uint8_t wp, uint8_t item_count)
 {
   int line = oled_get_line() + OLED_HEIGHT;
   char* off = "\x86";
   char* on = "\x87";
   const int y_offset = 2;
   const int x_offset = 15;
+  char *items[] = { "Write protect", "Restore backup", "Delete file", "Move to block store" };
+  // three items fit the screen
+  int top = selection >= FILE_PROPERTIES_VISIBLE_ITEMS ? selection - FILE_PROPERTIES_VISIBLE_ITEMS + 1 : 0;
+  int i;
 
   // clear screen
   oled_draw_rectangle(0, line, OLED_WIDTH - 1, line + OLED_HEIGHT - 1, 1, 0);
 
   // draw menu items
-  oled_draw_text(&FONT_SLIMFONT_8, "Write protect",
-      IMAGE_MEDIUM_CURSOR.width + x_offset + 2, line + 2,
-      0, 0);
-  oled_draw_text(&FONT_SLIMFONT_8, wp ? on : off,
-      OLED_WIDTH - FONT_SLIMFONT_8.char_width - x_offset, line + y_offset,
-      0, 0);
-  oled_draw_text(&FONT_SLIMFONT_8, "Restore backup",
-      IMAGE_MEDIUM_CURSOR.width + x_offset + 2, line + 10 + y_offset,
-      0, 0);
-  oled_draw_text(&FONT_SLIMFONT_8, "Delete file",
-      IMAGE_MEDIUM_CURSOR.width + x_offset + 2, line + 20 + y_offset,
-      0, 0);
+  for (i = 0; i < FILE_PROPERTIES_VISIBLE_ITEMS && top + i < item_count; i++)
+  {
+    oled_draw_text(&FONT_SLIMFONT_8, items[top + i],
+        IMAGE_MEDIUM_CURSOR.width + x_offset + 2, line + 10 * i + y_offset,
+        0, 0);
+    if (top + i == FILE_PROPERTIES_WRITE_PROTECT)
+      oled_draw_text(&FONT_SLIMFONT_8, wp ? on : off,
+          OLED_WIDTH - FONT_SLIMFONT_8.char_width - x_offset, line + 10 * i + y_offset,
+          0, 0);
+  }
 
   // cursor
-  oled_draw_image(&IMAGE_MEDIUM_CURSOR, x_offset, line + 10 * selection + y_offset + 1, 0, 0);
+  oled_draw_image(&IMAGE_MEDIUM_CURSOR, x_offset, line + 10 * (selection - top) + y_offset + 1, 0, 0);
 
   oled_update_invisible();
   oled_switch_to_invisible();
@@ -41,8 +47,15 @@ static void file_properties_draw(uint8_t selection, uint8_t wp)
 
 FRESULT file_write_protect(char *path, uint8_t rdo)
 {
+  FRESULT fr;
+
   show_saving_screen();
-  return f_chmod(path, rdo ? AM_RDO : 0, AM_RDO);
+  fr = f_chmod(path, rdo ? AM_RDO : 0, AM_RDO);
+  if (fr != FR_OK)
+    return fr;
+  // attributes are listed by the browser
+  generation_touch_dir(path);
+  return FR_OK;
 }
 
 FRESULT file_restore_backup(char *path)
@@ -71,6 +84,14 @@ FRESULT file_restore_backup(char *path)
     return FR_OK;
 
   show_saving_screen();
+#ifdef FDS_USE_CACHE
+  fr = fds_cache_invalidate(path);
+  if (fr != FR_OK) return fr;
+#endif
+#ifdef FDS_USE_SIDECAR
+  fr = fds_sidecar_invalidate(path);
+  if (fr != FR_OK) return fr;
+#endif
   fr = f_open(&fp_backup, backup_path, FA_READ);
   if (fr != FR_OK) return fr;
   fr = f_open(&fp, path, FA_CREATE_ALWAYS | FA_WRITE);
@@ -99,6 +120,8 @@ FRESULT file_restore_backup(char *path)
   } while (br > 0);
   f_close(&fp);
   f_close(&fp_backup);
+  // backup is already restored, stamp failure is not fatal
+  generation_touch_dir(path);
 
   show_message("Backup restored", 1);
   return FR_OK;
@@ -122,21 +145,71 @@ FRESULT file_delete(char *path, uint8_t *deleted)
   if (fr != FR_OK)
     return fr;
   *deleted = 1;
+#ifdef FDS_USE_CACHE
+  fr = fds_cache_invalidate(path);
+  if (fr != FR_OK)
+    return fr;
+#endif
+#ifdef FDS_USE_SIDECAR
+  fr = fds_sidecar_invalidate(path);
+  if (fr != FR_OK)
+    return fr;
+#endif
 
   // check for backup
   strcpy(backup_path, path);
   strcat(backup_path, ".bak");
   fr = f_stat(backup_path, &fno);
-  if (fr == FR_NO_FILE)
-    return FR_OK;
-  if (!confirm("Delete backup?"))
+  if (fr == FR_OK && confirm("Delete backup?"))
+  {
+    show_saving_screen();
+    fr = f_chmod(backup_path, 0, AM_RDO);
+    if (fr == FR_OK)
+      fr = f_unlink(backup_path);
+  } else if (fr == FR_NO_FILE)
+    fr = FR_OK;
+
+  // file is gone anyway, stamp failure is not fatal
+  generation_touch_dir(path);
+  return fr;
+}
+
+#ifdef BLOCK_STORE
+FRESULT file_move_to_block_store(char *path, FILINFO *fno, uint8_t *moved)
+{
+  FRESULT fr;
+  int l = strlen(path);
+  char manifest_path[l + 1];
+
+  *moved = 0;
+
+  if (!confirm("Move to block store?"))
     return FR_OK;
   show_saving_screen();
-  fr = f_chmod(backup_path, 0, AM_RDO);
+  // same name but another extension
+  strcpy(manifest_path, path);
+  strcpy(manifest_path + l - 4, BLOCK_STORE_MANIFEST_EXT);
+#ifdef FDS_USE_CACHE
+  fr = fds_cache_invalidate(path);
+  if (fr != FR_OK)
+    return fr;
+#endif
+#ifdef FDS_USE_SIDECAR
+  fr = fds_sidecar_invalidate(path);
   if (fr != FR_OK)
     return fr;
-  return f_unlink(backup_path);
+#endif
+  fr = block_store_convert(path, manifest_path);
+  if (fr != FR_OK)
+    return fr;
+  *moved = 1;
+  // image is replaced anyway, stamp failure is not fatal
+  generation_touch_dir(path);
+  // select manifest in the browser
+  strcpy(fno->fname + strlen(fno->fname) - 4, BLOCK_STORE_MANIFEST_EXT);
+  return FR_OK;
 }
+#endif
 
 void file_properties(char *directory, FILINFO *fno)
 {
@@ -146,23 +219,29 @@ void file_properties(char *directory, FILINFO *fno)
   int fl = strlen(fno->fname);
   char full_path[dl + 1 /*slash*/ + fl + 1 /*zero terminator*/];
   uint8_t deleted = 0;
+  uint8_t item_count = FILE_PROPERTIES_DELETE + 1;
 
   strcpy(full_path, directory);
   strcat(full_path, "\\");
   strcat(full_path, fno->fname);
+#ifdef BLOCK_STORE
+  // only regular images can be moved
+  if (fl >= 4 && !strcasecmp(fno->fname + fl - 4, ".fds"))
+    item_count = FILE_PROPERTIES_MOVE_TO_STORE + 1;
+#endif
 
-  file_properties_draw(selection, fno->fattrib & AM_RDO);
+  file_properties_draw(selection, fno->fattrib & AM_RDO, item_count);
   while (1)
   {
     if (button_up_newpress() && selection > 0)
     {
       selection--;
-      file_properties_draw(selection, fno->fattrib & AM_RDO);
+      file_properties_draw(selection, fno->fattrib & AM_RDO, item_count);
     }
-    if (button_down_newpress() && selection < 2)
+    if (button_down_newpress() && selection + 1 < item_count)
     {
       selection++;
-      file_properties_draw(selection, fno->fattrib & AM_RDO);
+      file_properties_draw(selection, fno->fattrib & AM_RDO, item_count);
     }
     if (button_right_newpress())
     {
@@ -183,8 +262,17 @@ void file_properties(char *directory, FILINFO *fno)
         show_error_screen_fr(fr, 0);
         if (deleted)
           return;
+        break;
+#ifdef BLOCK_STORE
+      case FILE_PROPERTIES_MOVE_TO_STORE:
+        fr = file_move_to_block_store(full_path, fno, &deleted);
+        show_error_screen_fr(fr, 0);
+        if (deleted)
+          return;
+        break;
+#endif
       }
-      file_properties_draw(selection, fno->fattrib & AM_RDO);
+      file_properties_draw(selection, fno->fattrib & AM_RDO, item_count);
     }
     if (button_left_newpress())
       return;
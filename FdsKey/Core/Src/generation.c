@@ -0,0 +1,207 @@
+#include <string.h>
+#include "generation.h"
+#include "settings.h"
+
+static uint32_t generation_epoch = 0;
+static uint32_t generation_counter = 0;
+
+// the whole programmed settings buffer must stay clear of the boot counter log
+_Static_assert((sizeof(FDSKEY_SETTINGS) / sizeof(uint64_t) + 1) * sizeof(uint64_t) <= FLASH_PAGE_SIZE * 2 - GENERATION_LOG_SIZE,
+    "settings overlap the generation log");
+
+static HAL_StatusTypeDef generation_program(int slot)
+{
+  uint64_t entry = generation_epoch | ((uint64_t)~generation_epoch << 32);
+  return HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, GENERATION_FLASH_OFFSET + slot * sizeof(uint64_t), entry);
+}
+
+// append current epoch to the log,
+// flash page is erased only when the log is full
+static void generation_log()
+{
+  int slot;
+
+  for (slot = 0; slot < GENERATION_LOG_SLOTS; slot++)
+    if (((uint64_t*)GENERATION_FLASH_OFFSET)[slot] == 0xFFFFFFFFFFFFFFFFULL)
+      break;
+  if (slot < GENERATION_LOG_SLOTS)
+  {
+    if (HAL_FLASH_Unlock() != HAL_OK)
+      return;
+    generation_program(slot);
+    HAL_FLASH_Lock();
+  } else {
+    // erases the log and calls generation_store()
+    settings_save();
+  }
+}
+
+// start new epoch, called once after settings are loaded
+void generation_init()
+{
+  uint64_t entry;
+  uint32_t epoch = 0;
+  int slot;
+
+  for (slot = 0; slot < GENERATION_LOG_SLOTS; slot++)
+  {
+    entry = ((uint64_t*)GENERATION_FLASH_OFFSET)[slot];
+    if (entry == 0xFFFFFFFFFFFFFFFFULL)
+      break;
+    // ignore damaged entries
+    if ((uint32_t)(entry >> 32) == (uint32_t)~entry && (uint32_t)entry > epoch)
+      epoch = (uint32_t)entry;
+  }
+  // after the last epoch generations are not unique anymore but still not decreasing
+  generation_epoch = epoch < GENERATION_EPOCH_MAX ? epoch + 1 : GENERATION_EPOCH_MAX;
+  generation_counter = 0;
+  generation_log();
+}
+
+// the log is lost if power fails between settings erase and generation_store(),
+// so the epoch is mirrored to the card and the larger one wins,
+// called once after the card is mounted
+FRESULT generation_sync()
+{
+  FRESULT fr;
+  FIL fp;
+  UINT br, bw;
+  uint32_t entry[2];
+  uint8_t created = 0;
+
+  fr = f_open(&fp, GENERATION_FILE, FA_OPEN_EXISTING | FA_READ | FA_WRITE);
+  if (fr == FR_NO_FILE)
+  {
+    fr = f_open(&fp, GENERATION_FILE, FA_CREATE_NEW | FA_WRITE);
+    created = 1;
+  }
+  if (fr != FR_OK)
+    return fr;
+  if (!created)
+  {
+    fr = f_read(&fp, entry, sizeof(entry), &br);
+    if (fr != FR_OK)
+    {
+      f_close(&fp);
+      return fr;
+    }
+    // epoch from the card is newer, flash log was reset
+    if (br == sizeof(entry) && entry[1] == ~entry[0] && entry[0] >= generation_epoch)
+    {
+      generation_epoch = entry[0] < GENERATION_EPOCH_MAX ? entry[0] + 1 : GENERATION_EPOCH_MAX;
+      generation_counter = 0;
+      generation_log();
+    }
+    fr = f_lseek(&fp, 0);
+    if (fr != FR_OK)
+    {
+      f_close(&fp);
+      return fr;
+    }
+  }
+  entry[0] = generation_epoch;
+  entry[1] = ~generation_epoch;
+  fr = f_write(&fp, entry, sizeof(entry), &bw);
+  if (fr == FR_OK && bw != sizeof(entry))
+    fr = FR_DENIED;
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    return fr;
+  }
+  fr = f_close(&fp);
+  if (fr != FR_OK)
+    return fr;
+  // hide it from the file browser
+  if (created)
+    fr = f_chmod(GENERATION_FILE, AM_HID, AM_HID);
+  return fr;
+}
+
+// write current epoch to the first slot of the erased log, flash must be unlocked
+HAL_StatusTypeDef generation_store()
+{
+  if (!generation_epoch)
+    return HAL_OK;
+  return generation_program(0);
+}
+
+// next generation, never decreasing between power cycles
+uint32_t generation_next()
+{
+  if (generation_counter < (1 << GENERATION_SESSION_BITS) - 1)
+    generation_counter++;
+  return (generation_epoch << GENERATION_SESSION_BITS) | generation_counter;
+}
+
+// encode generation as valid FAT timestamp, so later generation is always later date,
+// months have 28 days, years start from 1980 as usual
+DWORD generation_to_fattime(uint32_t generation)
+{
+  DWORD sec2, min, hour, day, month;
+
+  sec2 = generation % 30;
+  generation /= 30;
+  min = generation % 60;
+  generation /= 60;
+  hour = generation % 24;
+  generation /= 24;
+  day = generation % 28 + 1;
+  generation /= 28;
+  month = generation % 12 + 1;
+  generation /= 12;
+  return ((DWORD)generation << 25) | (month << 21) | (day << 16) | (hour << 11) | (min << 5) | sec2;
+}
+
+// decode FAT timestamp back, files modified by other devices give meaningless values
+uint32_t generation_from_fattime(WORD fdate, WORD ftime)
+{
+  uint32_t generation;
+
+  generation = fdate >> 9;
+  generation = generation * 12 + (((fdate >> 5) & 0x0F) - 1) % 12;
+  generation = generation * 28 + ((fdate & 0x1F) - 1) % 28;
+  generation = generation * 24 + (ftime >> 11) % 24;
+  generation = generation * 60 + ((ftime >> 5) & 0x3F) % 60;
+  generation = generation * 30 + (ftime & 0x1F) % 30;
+  return generation;
+}
+
+// FAT doesn't update directory timestamps, so stamp the parent directory of the modified file,
+// path is restored before return
+FRESULT generation_touch_dir(char *path)
+{
+  FRESULT fr;
+  FILINFO fno;
+  DWORD fattime;
+  char *sep = 0, *p, c;
+
+  for (p = path; *p; p++)
+    if (*p == '\\' || *p == '/')
+      sep = p;
+  // root directory has no entry
+  if (!sep || sep == path)
+    return FR_OK;
+  fattime = generation_to_fattime(generation_next());
+  fno.fdate = fattime >> 16;
+  fno.ftime = fattime & 0xFFFF;
+  c = *sep;
+  *sep = 0;
+  fr = f_utime(path, &fno);
+  *sep = c;
+  return fr;
+}
+
+// generation of file or directory, directory generation changes every time
+// the firmware creates, deletes or writes a file inside it
+FRESULT generation_get(char *path, uint32_t *generation)
+{
+  FRESULT fr;
+  FILINFO fno;
+
+  fr = f_stat(path, &fno);
+  if (fr != FR_OK)
+    return fr;
+  *generation = generation_from_fattime(fno.fdate, fno.ftime);
+  return FR_OK;
+}
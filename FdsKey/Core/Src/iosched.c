@@ -0,0 +1,129 @@
+#include "iosched.h"
+#include "fdsemu.h"
+#include "buttons.h"
+#include "perf.h"
+
+static volatile IOSCHED_CLASS iosched_class = IOSCHED_UI;
+static volatile uint32_t iosched_last_foreground_time = 0;
+static IOSCHED_JOB iosched_jobs[IOSCHED_MAX_JOBS];
+static int iosched_next_job = 0;
+// foreground is waiting for the running background step since this time
+static PERF_TIMESTAMP iosched_wait_start;
+static uint8_t iosched_waiting = 0;
+
+// class of the current SD transfer, UI unless the caller marked it
+IOSCHED_CLASS iosched_get_class()
+{
+  return iosched_class;
+}
+
+// mark the following SD transfers, returns previous class to restore
+IOSCHED_CLASS iosched_set_class(IOSCHED_CLASS cls)
+{
+  IOSCHED_CLASS prev = iosched_class;
+  iosched_class = cls;
+  return prev;
+}
+
+// call it after every SD transfer
+void iosched_transfer_done()
+{
+  if (iosched_class != IOSCHED_BACKGROUND)
+    iosched_last_foreground_time = HAL_GetTick();
+}
+
+// console is using the drive or user is pressing buttons
+static uint8_t iosched_foreground_waiting()
+{
+  FDS_STATE state = fds_get_state();
+  if (state != FDS_OFF && state != FDS_IDLE)
+    return 1;
+  return button_up_holding() || button_down_holding() || button_left_holding() || button_right_holding();
+}
+
+// nobody else needs the card now
+uint8_t iosched_background_allowed()
+{
+  if (HAL_GetTick() - iosched_last_foreground_time < IOSCHED_QUIET_TIME)
+    return 0;
+  return !iosched_foreground_waiting();
+}
+
+// background job should stop at the current chunk boundary
+uint8_t iosched_should_yield()
+{
+  if (!iosched_foreground_waiting())
+    return 0;
+  if (!iosched_waiting)
+  {
+    // foreground waits for the current step from now
+    iosched_wait_start = perf_timestamp();
+    iosched_waiting = 1;
+  }
+  return 1;
+}
+
+// run single step of the job with background priority if the card is not needed by anyone else
+FRESULT iosched_run(IOSCHED_JOB job)
+{
+  FRESULT fr;
+  IOSCHED_CLASS cls;
+
+  if (!iosched_background_allowed())
+    return FR_OK;
+  cls = iosched_set_class(IOSCHED_BACKGROUND);
+  iosched_waiting = 0;
+  fr = job();
+  iosched_set_class(cls);
+#ifdef PERF_COUNTERS
+  // how long foreground request was delayed by this step
+  if (iosched_waiting)
+    perf_add(PERF_IO_PREEMPT_WAIT, iosched_wait_start);
+#endif
+  iosched_waiting = 0;
+  return fr;
+}
+
+// add job to run when device is idle, it stays until cancelled
+void iosched_post(IOSCHED_JOB job)
+{
+  int i, free_slot = -1;
+
+  for (i = 0; i < IOSCHED_MAX_JOBS; i++)
+  {
+    if (iosched_jobs[i] == job)
+      return;
+    if (!iosched_jobs[i] && free_slot < 0)
+      free_slot = i;
+  }
+  if (free_slot >= 0)
+    iosched_jobs[free_slot] = job;
+}
+
+void iosched_cancel(IOSCHED_JOB job)
+{
+  int i;
+
+  for (i = 0; i < IOSCHED_MAX_JOBS; i++)
+    if (iosched_jobs[i] == job)
+      iosched_jobs[i] = 0;
+}
+
+// run single step of the next posted job, call it from the main loop
+FRESULT iosched_run_pending()
+{
+  int i;
+  IOSCHED_JOB job;
+
+  for (i = 0; i < IOSCHED_MAX_JOBS; i++)
+  {
+    // round robin between jobs
+    job = iosched_jobs[(iosched_next_job + i) % IOSCHED_MAX_JOBS];
+    if (job)
+    {
+      iosched_next_job = (iosched_next_job + i + 1) % IOSCHED_MAX_JOBS;
+      return iosched_run(job);
+    }
+  }
+  return FR_OK;
+}
@@ -0,0 +1,266 @@
+#include <string.h>
+#include "launcher.h"
+#include "fdsemu.h"
+#include "settings.h"
+#include "sideselect.h"
+#include "blockstore.h"
+
+static char launcher_dir[LAUNCHER_MAX_PATH_LENGTH] = "";
+static uint8_t launcher_depth = 0;
+static char launcher_path[LAUNCHER_MAX_PATH_LENGTH];
+static char launcher_name[FF_MAX_LFN + 1];
+static uint8_t launcher_side_count;
+static uint8_t launcher_readonly;
+
+// same filter as in the file browser
+static uint8_t launcher_is_visible(FILINFO *fno)
+{
+  int l = strlen(fno->fname);
+  if (fno->fattrib & (AM_HID | AM_SYS))
+    return 0;
+  if (fno->fattrib & AM_DIR)
+    return strcmp(fno->fname, "EDN8") != 0;
+#ifdef BLOCK_STORE
+  if (block_store_is_manifest(fno->fname))
+    return 1;
+#endif
+  return l >= 4 && !strcasecmp(fno->fname + l - 4, ".fds");
+}
+
+// find visible entry by index
+static FRESULT launcher_find_entry(int index, FILINFO *fno)
+{
+  FRESULT fr;
+  DIR dir;
+  int n = 0;
+
+  fr = f_opendir(&dir, launcher_dir);
+  if (fr != FR_OK)
+    return fr;
+  while (1)
+  {
+    fr = f_readdir(&dir, fno);
+    if (fr != FR_OK || !fno->fname[0])
+      break;
+    if (!launcher_is_visible(fno))
+      continue;
+    if (n == index)
+    {
+      f_closedir(&dir);
+      return FR_OK;
+    }
+    n++;
+  }
+  f_closedir(&dir);
+  if (fr == FR_OK)
+    fr = FR_NO_FILE;
+  return fr;
+}
+
+// uppercase name without extension, Famicom fonts usually have no lowercase letters
+static void launcher_entry_name(char *out, FILINFO *fno)
+{
+  int i;
+  int l = strlen(fno->fname);
+
+  if (!(fno->fattrib & AM_DIR))
+    l -= 4; // remove ".fds" or ".fdm"
+  memset(out, 0, LAUNCHER_ENTRY_SIZE - 1);
+  for (i = 0; i < l && i < LAUNCHER_ENTRY_SIZE - 2; i++)
+    out[i] = (fno->fname[i] >= 'a' && fno->fname[i] <= 'z') ? fno->fname[i] - ('a' - 'A') : fno->fname[i];
+}
+
+// fill page of the current directory
+static FRESULT launcher_list(uint8_t *answer, uint16_t page, uint16_t *size)
+{
+  FRESULT fr;
+  DIR dir;
+  FILINFO fno;
+  int n = 0, count = 0;
+  uint8_t *entry = answer + LAUNCHER_HEADER_SIZE;
+
+  fr = f_opendir(&dir, launcher_dir);
+  if (fr != FR_OK)
+    return fr;
+  while (1)
+  {
+    fr = f_readdir(&dir, &fno);
+    if (fr != FR_OK || !fno.fname[0])
+      break;
+    if (!launcher_is_visible(&fno))
+      continue;
+    if (n >= page * LAUNCHER_PAGE_ENTRIES && count < LAUNCHER_PAGE_ENTRIES)
+    {
+      entry[0] = (fno.fattrib & AM_DIR) ? LAUNCHER_ENTRY_DIRECTORY : 0;
+      launcher_entry_name((char*)entry + 1, &fno);
+      entry += LAUNCHER_ENTRY_SIZE;
+      count++;
+    }
+    n++;
+  }
+  f_closedir(&dir);
+  if (fr != FR_OK)
+    return fr;
+  answer[2] = n & 0xFF;
+  answer[3] = (n >> 8) & 0xFF;
+  answer[4] = page & 0xFF;
+  answer[5] = (page >> 8) & 0xFF;
+  answer[6] = count;
+  answer[7] = launcher_depth;
+  *size = LAUNCHER_HEADER_SIZE + count * LAUNCHER_ENTRY_SIZE;
+  return FR_OK;
+}
+
+// enter directory or select image
+static FRESULT launcher_open(uint16_t index, uint8_t *selected)
+{
+  FRESULT fr;
+  FILINFO fno;
+  int l;
+  FSIZE_t fsize;
+
+  *selected = 0;
+  fr = launcher_find_entry(index, &fno);
+  if (fr != FR_OK)
+    return fr;
+  if (strlen(launcher_dir) + strlen(fno.fname) + 2 > sizeof(launcher_dir))
+    return FR_INVALID_NAME;
+  if (fno.fattrib & AM_DIR)
+  {
+    if (launcher_depth)
+      strcat(launcher_dir, "\\");
+    strcat(launcher_dir, fno.fname);
+    launcher_depth++;
+    return FR_OK;
+  }
+
+  strcpy(launcher_path, launcher_dir);
+  if (launcher_depth)
+    strcat(launcher_path, "\\");
+  strcat(launcher_path, fno.fname);
+#ifdef BLOCK_STORE
+  if (block_store_is_manifest(fno.fname))
+  {
+    // sides are listed in the manifest
+    fr = block_store_get_side_count(launcher_path, &launcher_side_count);
+    if (fr != FR_OK)
+      return fr;
+  } else
+#endif
+  {
+    fsize = fno.fsize;
+    if (fsize % FDS_ROM_SIDE_SIZE == FDS_ROM_HEADER_SIZE)
+      fsize -= FDS_ROM_HEADER_SIZE;
+    if (fsize % FDS_ROM_SIDE_SIZE != 0 || !fsize)
+      return FDSR_INVALID_ROM;
+    launcher_side_count = fsize / FDS_ROM_SIDE_SIZE;
+  }
+  strcpy(launcher_name, fno.fname);
+  l = strlen(launcher_name);
+  if (l >= 4)
+    launcher_name[l - 4] = 0; // remove extension
+  text_remove_brackets(launcher_name);
+  launcher_readonly = fno.fattrib & AM_RDO;
+  *selected = 1;
+  return FR_OK;
+}
+
+// go to the parent directory
+static void launcher_up()
+{
+  char *p = launcher_dir + strlen(launcher_dir);
+
+  if (!launcher_depth)
+    return;
+  while (p > launcher_dir && *p != '\\')
+    p--;
+  *p = 0;
+  launcher_depth--;
+}
+
+// check disk for the command file and answer it,
+// call it when emulator is in the FDS_SAVE_PENDING state instead of saving
+FRESULT launcher_process(LAUNCHER_RESULT *result)
+{
+  FRESULT fr;
+  int header_block;
+  uint8_t *command;
+  uint16_t command_size;
+  uint8_t sequence, cmd;
+  uint16_t arg;
+  uint8_t selected = 0;
+  uint8_t answer[LAUNCHER_HEADER_SIZE + LAUNCHER_PAGE_ENTRIES * LAUNCHER_ENTRY_SIZE];
+  uint16_t answer_size = LAUNCHER_HEADER_SIZE;
+
+  *result = LAUNCHER_NONE;
+  header_block = fds_find_file(LAUNCHER_COMMAND_FILE);
+  if (header_block < 0)
+    return FR_OK; // regular disk
+  command = fds_get_file_data(header_block, &command_size);
+  if (command_size < 4)
+    return FDSR_INVALID_ROM;
+  // command will be overwritten by the answer
+  sequence = command[0];
+  cmd = command[1];
+  arg = command[2] | (command[3] << 8);
+
+  memset(answer, 0, sizeof(answer));
+  switch (cmd)
+  {
+  case LAUNCHER_CMD_LIST:
+    fr = launcher_list(answer, arg, &answer_size);
+    break;
+  case LAUNCHER_CMD_OPEN:
+    fr = launcher_open(arg, &selected);
+    if (fr == FR_OK && !selected)
+      fr = launcher_list(answer, 0, &answer_size);
+    break;
+  case LAUNCHER_CMD_UP:
+    launcher_up();
+    fr = launcher_list(answer, 0, &answer_size);
+    break;
+  default:
+    fr = FR_INVALID_PARAMETER;
+    break;
+  }
+  if (selected)
+  {
+    *result = LAUNCHER_SELECTED;
+    return FR_OK;
+  }
+
+  // errors are reported to the console
+  answer[0] = sequence;
+  answer[1] = fr;
+  fr = fds_put_file(header_block, LAUNCHER_ANSWER_FILE, LAUNCHER_PAGE_ADDRESS, 0 /* PRG */, answer, answer_size);
+  if (fr != FR_OK)
+    return fr;
+  // launcher disk is never saved
+  fds_discard_changes();
+  *result = LAUNCHER_ANSWERED;
+  return FR_OK;
+}
+
+// selected image path
+char *launcher_get_path()
+{
+  return launcher_path;
+}
+
+// selected image name for the emulation screen
+char *launcher_get_name()
+{
+  return launcher_name;
+}
+
+// selected image side count
+uint8_t launcher_get_side_count()
+{
+  return launcher_side_count;
+}
+
+// non-zero if selected image is read-only
+uint8_t launcher_get_readonly()
+{
+  return launcher_readonly;
+}
@@ -24,9 +24,11 @@
 #include "oled.h"
 #include "mainmenu.h"
 #include "settings.h"
+#include "generation.h"
 #include "fdsemu.h"
 #include "splash.h"
 #include "servicemenu.h"
+#include "brownout.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -139,6 +141,7 @@ int main(void)
   HAL_Delay(100);
   service_settings_load();
   settings_load();
+  generation_init();
   /* USER CODE END SysInit */
 
   /* Initialize all configured peripherals */
@@ -152,10 +155,12 @@ int main(void)
   MX_TIM4_Init();
   /* USER CODE BEGIN 2 */
 
-  // pins check timer
-  HAL_TIM_Base_Start_IT(&htim1);
+  // emulator deadline timer, started on demand by fds_check_pins()
+  __HAL_TIM_ENABLE_IT(&htim1, TIM_IT_UPDATE);
   // us delay timer
   HAL_TIM_Base_Start_IT(&htim4);
+  // power failure detection
+  brownout_init();
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -349,6 +354,8 @@ static void MX_TIM1_Init(void)
     Error_Handler();
   }
   /* USER CODE BEGIN TIM1_Init 2 */
+  // one-shot mode, update interrupt on overflow only
+  htim1.Instance->CR1 |= TIM_CR1_OPM | TIM_CR1_URS;
 
   /* USER CODE END TIM1_Init 2 */
 
@@ -14,6 +14,10 @@
 #include "fileproperties.h"
 #include "servicemenu.h"
 #include "commit.h"
+#include "crashdump.h"
+#include "defrag.h"
+#include "blockstore.h"
+#include "generation.h"
 
 void main_menu_draw(uint8_t selection)
 {
@@ -101,6 +105,32 @@ void main_menu_loop()
   }
   show_error_screen_fr(fr, 1);
 
+  // restore boot counter if the flash log was lost, card can be write protected
+  generation_sync();
+
+  // finish interrupted defragmentation before any image is loaded
+  fr = defrag_recover();
+  show_error_screen_fr(fr, 0);
+#ifdef BLOCK_STORE
+  // and manifest update
+  fr = block_store_recover();
+  show_error_screen_fr(fr, 0);
+#endif
+
+  // save data rescued on power failure
+  uint8_t restored;
+  fr = fds_journal_replay(&restored);
+  show_error_screen_fr(fr, 0);
+  if (restored)
+    show_message("Unsaved data\nwas restored", 1);
+
+  // copy crash report from flash
+  uint8_t crashed;
+  fr = crash_dump_export(&crashed);
+  show_error_screen_fr(fr, 0);
+  if (crashed && fr == FR_OK)
+    show_message("Crash report was\nsaved to " CRASH_DUMP_FILE, 1);
+
   // failsafe
   // disable auto loading last state if holding left on power up
   if (button_left_holding())
@@ -7,6 +7,9 @@
 #include "settings.h"
 #include "splash.h"
 #include "confirm.h"
+#include "fdscache.h"
+#include "fdssidecar.h"
+#include "generation.h"
 
 static FRESULT new_disk_create(char *filename, int sides)
 {
@@ -31,6 +34,23 @@ static FRESULT new_disk_create(char *filename, int sides)
     }
   }
   if (fr != FR_OK) return fr;
+#ifdef FDS_USE_CACHE
+  // file can be overwritten
+  fr = fds_cache_invalidate(filename);
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    return fr;
+  }
+#endif
+#ifdef FDS_USE_SIDECAR
+  fr = fds_sidecar_invalidate(filename);
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    return fr;
+  }
+#endif
 
   // just fill file with zeros
   memset(buff, 0, sizeof(buff));
@@ -44,6 +64,8 @@ static FRESULT new_disk_create(char *filename, int sides)
     }
   }
   fr = f_close(&fp);
+  if (fr == FR_OK)
+    fr = generation_touch_dir(filename);
 
   if (fr == FR_OK)
     show_message("File successfully created", 1);
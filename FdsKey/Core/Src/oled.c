@@ -5,6 +5,7 @@
 #include <math.h>
 #include "main.h"
 #include "oled.h"
+#include "arbiter.h"
 
 static OLED_CONTROLLER controller;
 static uint8_t rotate = 0;
@@ -92,6 +93,7 @@ HAL_StatusTypeDef oled_update(uint8_t start_page, uint8_t end_page) {
 	if (end_page < start_page) end_page += (OLED_HEIGHT * 2 / 8);
 
 	for (p = start_page; p < end_page + 1; p++) {
+		arbiter_wait(ARBITER_OLED);
 		oled_send_commands(3, OLED_CMD_SET_PAGE(p % 8),
 				OLED_CMD_SET_COLUMN_LOW(padding_left),
 				OLED_CMD_SET_COLUMN_HIGH(padding_left));
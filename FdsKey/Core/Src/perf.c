@@ -0,0 +1,69 @@
+#include <string.h>
+#include <stdio.h>
+#include "perf.h"
+#include "ff.h"
+
+volatile PERF_COUNTER perf_counters[PERF_COUNTER_COUNT];
+
+static const char *perf_names[PERF_COUNTER_COUNT] = {
+  "fds_read_dma",
+  "fds_write_dma",
+  "fds_check_pins",
+  "sd_read_block",
+  "sd_write_block",
+  "sd_command",
+  "sd_deferred",
+  "oled_deferred",
+  "io_emulator",
+  "io_ui",
+  "io_background",
+  "io_preempt_wait"
+};
+
+// reset all counters
+void perf_reset()
+{
+  __disable_irq();
+  memset((void*)perf_counters, 0, sizeof(perf_counters));
+  __enable_irq();
+}
+
+// return counter name
+const char* perf_get_name(PERF_COUNTER_ID id)
+{
+  return perf_names[id];
+}
+
+// write counters to the text file, one line per path: name, calls, average and maximum cycles
+FRESULT perf_save(char *filename)
+{
+  FRESULT fr;
+  FIL fp;
+  UINT bw;
+  char line[96];
+  int i, l;
+  PERF_COUNTER counter;
+
+  fr = f_open(&fp, filename, FA_CREATE_ALWAYS | FA_WRITE);
+  if (fr != FR_OK)
+    return fr;
+  l = sprintf(line, "%-16s %10s %10s %10s\r\n", "path", "calls", "avg", "max");
+  fr = f_write(&fp, line, l, &bw);
+  for (i = 0; (fr == FR_OK) && (i < PERF_COUNTER_COUNT); i++)
+  {
+    __disable_irq();
+    counter = perf_counters[i];
+    __enable_irq();
+    l = sprintf(line, "%-16s %10lu %10lu %10lu\r\n", perf_names[i],
+        (unsigned long)counter.calls,
+        (unsigned long)(counter.calls ? counter.cycles / counter.calls : 0),
+        (unsigned long)counter.max);
+    fr = f_write(&fp, line, l, &bw);
+  }
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    return fr;
+  }
+  return f_close(&fp);
+}
@@ -0,0 +1,151 @@
+#include <string.h>
+#include <stdio.h>
+#include "profiler.h"
+#include "ff.h"
+
+#ifdef PROFILER
+
+static PROFILER_SLOT profiler_slots[PROFILER_SLOTS];
+static volatile uint32_t profiler_samples = 0;
+static volatile uint32_t profiler_dropped = 0;
+static volatile uint8_t profiler_running = 0;
+
+void profiler_sample(uint32_t *frame);
+
+// find which stack holds the exception frame, same as the crash dump handler
+__attribute__((naked)) void PROFILER_IRQ_HANDLER(void)
+{
+  __asm volatile(
+      "movs r0, #4\n"
+      "mov r1, lr\n"
+      "tst r0, r1\n"
+      "beq 1f\n"
+      "mrs r0, psp\n"
+      "b 2f\n"
+      "1:\n"
+      "mrs r0, msp\n"
+      "2:\n"
+      "ldr r2, =profiler_sample\n"
+      "bx r2\n"
+      ".ltorg\n");
+}
+
+// called from the timer interrupt with the stacked r0-r3, r12, lr, pc, xpsr
+void profiler_sample(uint32_t *frame)
+{
+  uint32_t pc = frame[6];
+  uint32_t lr = frame[5];
+  uint32_t h;
+  int i;
+
+  PROFILER_TIMER->SR = (uint32_t)~TIM_SR_UIF;
+  profiler_samples++;
+  h = (pc >> 1) ^ (lr * 31);
+  for (i = 0; i < PROFILER_MAX_PROBES; i++, h++)
+  {
+    PROFILER_SLOT *slot = &profiler_slots[h & (PROFILER_SLOTS - 1)];
+    if (!slot->count)
+    {
+      slot->pc = pc;
+      slot->lr = lr;
+      slot->count = 1;
+      return;
+    }
+    if (slot->pc == pc && slot->lr == lr)
+    {
+      slot->count++;
+      return;
+    }
+  }
+  // histogram is too crowded around this hash
+  profiler_dropped++;
+}
+
+// clear the histogram and start sampling
+void profiler_start()
+{
+  profiler_stop();
+  memset(profiler_slots, 0, sizeof(profiler_slots));
+  profiler_samples = 0;
+  profiler_dropped = 0;
+
+  __HAL_RCC_TIM14_CLK_ENABLE();
+  PROFILER_TIMER->CR1 = 0;
+  // APB is HCLK/2, so timers run at HCLK, 1MHz after the prescaler like htim4
+  PROFILER_TIMER->PSC = SystemCoreClock / 1000000 - 1;
+  PROFILER_TIMER->ARR = PROFILER_PERIOD_US - 1;
+  PROFILER_TIMER->CNT = 0;
+  PROFILER_TIMER->EGR = TIM_EGR_UG;
+  PROFILER_TIMER->SR = 0;
+  PROFILER_TIMER->DIER = TIM_DIER_UIE;
+  HAL_NVIC_SetPriority(PROFILER_IRQ, PROFILER_IRQ_PRIORITY, 0);
+  HAL_NVIC_EnableIRQ(PROFILER_IRQ);
+  profiler_running = 1;
+  PROFILER_TIMER->CR1 = TIM_CR1_CEN;
+}
+
+// stop sampling, the histogram is kept
+void profiler_stop()
+{
+  if (!profiler_running)
+    return;
+  PROFILER_TIMER->CR1 = 0;
+  PROFILER_TIMER->DIER = 0;
+  HAL_NVIC_DisableIRQ(PROFILER_IRQ);
+  profiler_running = 0;
+}
+
+uint8_t profiler_is_running()
+{
+  return profiler_running;
+}
+
+uint32_t profiler_get_samples()
+{
+  return profiler_samples;
+}
+
+// stop sampling and write the histogram to the text file, one line per pc/lr pair,
+// use tools/profsym to resolve addresses
+FRESULT profiler_save(char *filename)
+{
+  FRESULT fr;
+  FIL fp;
+  UINT bw;
+  char line[64];
+  int i, l;
+
+  profiler_stop();
+  fr = f_open(&fp, filename, FA_CREATE_ALWAYS | FA_WRITE);
+  if (fr != FR_OK)
+    return fr;
+  l = sprintf(line, "# samples %lu dropped %lu period_us %d\r\n",
+      (unsigned long)profiler_samples, (unsigned long)profiler_dropped, PROFILER_PERIOD_US);
+  fr = f_write(&fp, line, l, &bw);
+  for (i = 0; (fr == FR_OK) && (i < PROFILER_SLOTS); i++)
+  {
+    if (!profiler_slots[i].count)
+      continue;
+    l = sprintf(line, "%08lX %08lX %lu\r\n",
+        (unsigned long)profiler_slots[i].pc,
+        (unsigned long)profiler_slots[i].lr,
+        (unsigned long)profiler_slots[i].count);
+    fr = f_write(&fp, line, l, &bw);
+  }
+  if (fr != FR_OK)
+  {
+    f_close(&fp);
+    return fr;
+  }
+  return f_close(&fp);
+}
+
+#else
+
+void profiler_start() { }
+void profiler_stop() { }
+uint8_t profiler_is_running() { return 0; }
+uint32_t profiler_get_samples() { return 0; }
+FRESULT profiler_save(char *filename) { return FR_OK; }
+
+#endif
@@ -1,62 +1,101 @@
 #include "sdcard.h"
 #include "string.h"
+#include "perf.h"
+
+// 8-bit access to the data register, 16-bit access sends two frames
+#define SD_SPI_DR8 (*(__IO uint8_t*)&SD_SPI_INSTANCE->DR)
 
 static uint8_t sd_high_capacity;
+static uint8_t sd_version;
 static uint32_t sd_spi_speed;
 
-static void SPI_transmit_receive(uint8_t* tx, uint8_t* rx, size_t buff_size)
+// (re)init SPI using HAL and enable it for register-level transfers
+static void SPI_init(uint32_t prescaler)
+{
+  SD_SPI_PORT.Init.BaudRatePrescaler = prescaler;
+  sd_spi_speed = prescaler;
+  HAL_SPI_Init(&SD_SPI_PORT);
+  __HAL_SPI_ENABLE(&SD_SPI_PORT);
+}
+
+// exchange single byte, FIFO is always empty between transfers so no TXE check
+// it's the fast path for command/response phases, block data uses pipelined loops below
+static inline uint8_t SPI_exchange(uint8_t tx)
+{
+  SD_SPI_DR8 = tx;
+  while (!(SD_SPI_INSTANCE->SR & SPI_SR_RXNE));
+  return SD_SPI_DR8;
+}
+
+// receive single byte, make sure FF is transmitted during receive
+static inline uint8_t SPI_receive()
 {
-  HAL_SPI_TransmitReceive(&SD_SPI_PORT, tx, rx, buff_size, SD_TIMEOUT);
+  return SPI_exchange(0xFF);
 }
 
 static void SPI_transmit(uint8_t* tx, size_t buff_size)
 {
-  HAL_SPI_Transmit(&SD_SPI_PORT, tx, buff_size, SD_TIMEOUT);
+  if (!buff_size) return;
+  // keep one byte in the FIFO ahead, discard received data
+  SD_SPI_DR8 = *tx++;
+  while (--buff_size)
+  {
+    while (!(SD_SPI_INSTANCE->SR & SPI_SR_TXE));
+    SD_SPI_DR8 = *tx++;
+    while (!(SD_SPI_INSTANCE->SR & SPI_SR_RXNE));
+    (void)SD_SPI_DR8;
+  }
+  while (!(SD_SPI_INSTANCE->SR & SPI_SR_RXNE));
+  (void)SD_SPI_DR8;
 }
 
 static void SD_read_bytes(uint8_t *buff, size_t buff_size)
 {
-  // make sure FF is transmitted during receive
-  uint8_t tx = 0xFF;
-  while (buff_size > 0)
+  if (!buff_size) return;
+  // make sure FF is transmitted during receive,
+  // keep one byte in the FIFO ahead
+  SD_SPI_DR8 = 0xFF;
+  while (--buff_size)
   {
-    SPI_transmit_receive(&tx, buff, 1);
-    buff++;
-    buff_size--;
+    while (!(SD_SPI_INSTANCE->SR & SPI_SR_TXE));
+    SD_SPI_DR8 = 0xFF;
+    while (!(SD_SPI_INSTANCE->SR & SPI_SR_RXNE));
+    *buff++ = SD_SPI_DR8;
   }
+  while (!(SD_SPI_INSTANCE->SR & SPI_SR_RXNE));
+  *buff = SD_SPI_DR8;
 }
 
 static void SD_select()
 {
-  HAL_GPIO_WritePin(SD_CS_GPIO_Port, SD_CS_Pin, GPIO_PIN_RESET);
+  SD_CS_GPIO_Port->BRR = SD_CS_Pin;
   delay_us(10); // entry guard time for some SD cards
 }
 
 static void SD_unselect()
 {
-  HAL_GPIO_WritePin(SD_CS_GPIO_Port, SD_CS_Pin, GPIO_PIN_SET);
+  // wait for the last byte to be clocked out
+  while (SD_SPI_INSTANCE->SR & SPI_SR_BSY);
+  SD_CS_GPIO_Port->BSRR = SD_CS_Pin;
   delay_us(10); // exit guard time for some SD cards
 }
 
 static void SD_unselect_purge()
 {
   SD_unselect();
-  uint8_t tx = 0xFF;
-  SPI_transmit(&tx, 1);
+  SPI_receive();
 }
 
 static SD_RESULT SD_wait_not_busy()
 {
   uint32_t start_time = HAL_GetTick();
-  uint8_t busy;
   do
   {
     if (HAL_GetTick() >= start_time + SD_TIMEOUT)
       return SD_RES_BUSY_TIMEOUT;
     SD_unselect();
     SD_select();
-    SD_read_bytes(&busy, sizeof(busy));
-  } while (busy != 0xFF);
+  } while (SPI_receive() != 0xFF);
   return SD_RES_OK;
 }
 
@@ -73,11 +112,10 @@ static SD_RESULT SD_read_r1(uint8_t *r1)
    *     |+------- 6th bit (a): Command argument outside allowed range
    *     +-------- 7th bit is always zero
    */
-  uint8_t tx = 0xFF;
   int i = 0;
   for (i = 0; i < SD_R1_ANSWER_RETRY_COUNT; i++)
   {
-    SPI_transmit_receive(&tx, r1, sizeof(uint8_t));
+    *r1 = SPI_receive();
     if (!(*r1 & (1 << 7)))
       return SD_RES_OK;
   }
@@ -88,14 +126,13 @@ static SD_RESULT SD_read_rx(uint8_t *rx, uint8_t x)
 {
   SD_RESULT r;
   int i;
-  uint8_t tx = 0xFF;
   r = SD_read_r1(rx);
   if (r != SD_RES_OK)
     return SD_R1_FAILED;
   rx++;
   for (i = 0; i < x; i++, rx++)
   {
-    SPI_transmit_receive(&tx, rx, sizeof(uint8_t));
+    *rx = SPI_receive();
   }
   return SD_RES_OK;
 }
@@ -113,18 +150,19 @@ static SD_RESULT SD_read_r7(uint8_t *r7)
 static void SD_send_cmd(uint8_t command, uint32_t arg, uint8_t crc)
 {
   uint8_t cmd[] = { 0x40 | command, (arg >> 24) & 0xFF, (arg >> 16) & 0xFF, (arg >> 8) & 0xFF, arg & 0xFF, (crc << 1) | 1 };
+  PERF_START();
   SD_select();
   SPI_transmit((uint8_t*) cmd, sizeof(cmd));
+  PERF_STOP(PERF_SD_COMMAND);
 }
 
 static SD_RESULT SD_wait_data_token()
 {
   uint8_t fb;
-  uint8_t tx = 0xFF; // make sure FF is transmitted during receive
   uint32_t start_time = HAL_GetTick();
   while (1)
   {
-    SPI_transmit_receive(&tx, &fb, sizeof(fb));
+    fb = SPI_receive();
     if (fb == SD_DATA_TOKEN)
       break;
     if (fb != 0xFF)
@@ -176,10 +214,9 @@ SD_RESULT SD_init()
   HAL_Delay(1);
 
   // 80 clock pulses to enter SPI mode
-  uint8_t high = 0xFF;
   for (i = 0; i < 10; i++)
   {
-    SPI_transmit(&high, sizeof(high));
+    SPI_receive();
   }
 
   // CMD0 - reset card
@@ -234,6 +271,7 @@ SD_RESULT SD_init()
   {
     // command not supported - old SD card version
     sd_high_capacity = 0;
+    sd_version = 1;
     r = SD_init_app_op_cond(0);
     if (r != SD_RES_OK)
       return r;
@@ -296,6 +334,7 @@ SD_RESULT SD_init()
     if (!(r3[2] & (0b00110000))) // 3.2-3.3V or 3.3-3.4V
       return SD_RES_CMD58_VOLTAGE_FAILED;
     sd_high_capacity = (r3[1] & 0x40) >> 6;
+    sd_version = 2;
   } else {
     return SD_RES_CMD8_GEN_FAILED;
   }
@@ -313,12 +352,12 @@ SD_RESULT SD_init()
 }
 
 // multiple init tries
-SD_RESULT SD_init_tries()
+static SD_RESULT SD_init_tries(int tries)
 {
-  SD_RESULT r;
+  SD_RESULT r = SD_RES_OK;
   int i;
 
-  for (i = 0; i < SD_INIT_TRIES; i++)
+  for (i = 0; i < tries; i++)
   {
     r = SD_init();
     if (r == SD_RES_OK)
@@ -332,28 +371,27 @@ SD_RESULT SD_init_try_speed()
 {
   SD_RESULT r;
 
-  SD_SPI_PORT.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_2;
-  sd_spi_speed = SPI_BAUDRATEPRESCALER_2;
-  HAL_SPI_Init(&SD_SPI_PORT);
-  r = SD_init_tries();
+  SPI_init(SPI_BAUDRATEPRESCALER_2);
+  r = SD_init_tries(SD_INIT_TRIES);
   if (r == SD_RES_OK)
     return r;
-  SD_SPI_PORT.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_4;
-  sd_spi_speed = SPI_BAUDRATEPRESCALER_4;
-  HAL_SPI_Init(&SD_SPI_PORT);
-  r = SD_init_tries();
+  SPI_init(SPI_BAUDRATEPRESCALER_4);
+  r = SD_init_tries(SD_INIT_TRIES);
   if (r == SD_RES_OK)
     return r;
-  SD_SPI_PORT.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_8;
-  sd_spi_speed = SPI_BAUDRATEPRESCALER_8;
-  HAL_SPI_Init(&SD_SPI_PORT);
-  r = SD_init_tries();
+  SPI_init(SPI_BAUDRATEPRESCALER_8);
+  r = SD_init_tries(SD_INIT_TRIES);
   if (r == SD_RES_OK)
     return r;
-  SD_SPI_PORT.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_16;
-  sd_spi_speed = SPI_BAUDRATEPRESCALER_16;
-  HAL_SPI_Init(&SD_SPI_PORT);
-  return SD_init_tries();
+  SPI_init(SPI_BAUDRATEPRESCALER_16);
+  return SD_init_tries(SD_INIT_TRIES);
+}
+
+// init using known SPI speed only
+SD_RESULT SD_init_at_speed(uint32_t prescaler, int tries)
+{
+  SPI_init(prescaler);
+  return SD_init_tries(tries);
 }
 
 uint32_t SD_get_spi_speed()
@@ -361,6 +399,30 @@ uint32_t SD_get_spi_speed()
   return sd_spi_speed;
 }
 
+// next SPI prescaler for the degraded mode, same steps as SD_init_try_speed
+uint32_t SD_get_slower_speed(uint32_t prescaler)
+{
+  switch (prescaler)
+  {
+  case SPI_BAUDRATEPRESCALER_2:
+    return SPI_BAUDRATEPRESCALER_4;
+  case SPI_BAUDRATEPRESCALER_4:
+    return SPI_BAUDRATEPRESCALER_8;
+  default:
+    return SD_LOWEST_SPEED;
+  }
+}
+
+uint8_t SD_get_version()
+{
+  return sd_version;
+}
+
+uint8_t SD_is_high_capacity()
+{
+  return sd_high_capacity;
+}
+
 SD_RESULT SD_read_single_block(uint32_t blockNum, uint8_t *buff)
 {
   SD_RESULT r;
@@ -380,8 +442,10 @@ SD_RESULT SD_read_single_block(uint32_t blockNum, uint8_t *buff)
   r = SD_wait_data_token();
   if (r != SD_RES_OK)
     return r;
+  PERF_START();
   SD_read_bytes(buff, SD_BLOCK_LENGTH);
   SD_read_bytes(crc, 2);
+  PERF_STOP(PERF_SD_READ_BLOCK);
 
   SD_unselect_purge();
   return SD_RES_OK;
@@ -406,16 +470,17 @@ SD_RESULT SD_write_single_block(uint32_t blockNum, const uint8_t *buff)
     return SD_RES_CMD24_R1_NOT_NULL;
 
   // send dummy bytes for NWR timing
-  uint8_t dummy = 0xFF;
-  SPI_transmit(&dummy, sizeof(dummy));
-  SPI_transmit(&dummy, sizeof(dummy));
+  SPI_receive();
+  SPI_receive();
 
   // start token
   uint8_t dataToken = SD_DATA_TOKEN;
   uint8_t crc[2] = { 0xFF, 0xFF };
-  SPI_transmit(&dataToken, sizeof(dataToken));
+  SPI_exchange(dataToken);
+  PERF_START();
   SPI_transmit((uint8_t*)buff, SD_BLOCK_LENGTH);
   SPI_transmit(crc, sizeof(crc));
+  PERF_STOP(PERF_SD_WRITE_BLOCK);
 
   /*
    dataResp:
@@ -424,8 +489,7 @@ SD_RESULT SD_write_single_block(uint32_t blockNum, const uint8_t *buff)
    101 - Data rejected due to CRC error
    110 - Data rejected due to write error
    */
-  uint8_t dataResp;
-  SD_read_bytes(&dataResp, sizeof(dataResp));
+  uint8_t dataResp = SPI_receive();
   if ((dataResp & 0x1F) != 0x05)
     return SD_RES_CMD24_DATA_REJECTED;
 
@@ -469,8 +533,10 @@ SD_RESULT SD_read_data(uint8_t *buff)
   r = SD_wait_data_token();
   if (r != SD_RES_OK)
     return r;
+  PERF_START();
   SD_read_bytes(buff, SD_BLOCK_LENGTH);
   SD_read_bytes(crc, 2);
+  PERF_STOP(PERF_SD_READ_BLOCK);
 
   SD_unselect_purge();
   return HAL_OK;
@@ -490,8 +556,7 @@ SD_RESULT SD_read_end()
    The received byte immediataly following CMD12 is a stuff byte, it should be
    discarded before receive the response of the CMD12
    */
-  uint8_t stuffByte;
-  SD_read_bytes(&stuffByte, sizeof(stuffByte));
+  SPI_receive();
 
   r = SD_read_r1(&r1);
   if (r != SD_RES_OK)
@@ -531,9 +596,11 @@ SD_RESULT SD_write_data(const uint8_t *buff)
 
   uint8_t dataToken = SD_SEND_MULTIPLE_DATA_TOKEN;
   uint8_t crc[2] = { 0xFF, 0xFF };
-  SPI_transmit(&dataToken, sizeof(dataToken));
+  SPI_exchange(dataToken);
+  PERF_START();
   SPI_transmit((uint8_t*)buff, SD_BLOCK_LENGTH);
   SPI_transmit(crc, sizeof(crc));
+  PERF_STOP(PERF_SD_WRITE_BLOCK);
 
   /*
    dataResp:
@@ -542,8 +609,7 @@ SD_RESULT SD_write_data(const uint8_t *buff)
    101 - Data rejected due to CRC error
    110 - Data rejected due to write error
    */
-  uint8_t dataResp;
-  SD_read_bytes(&dataResp, sizeof(dataResp));
+  uint8_t dataResp = SPI_receive();
   if ((dataResp & 0x1F) != 0x05)
     return SD_RES_WRITE_MULTI_DATA_REJECTED;
 
@@ -561,13 +627,11 @@ SD_RESULT SD_write_end()
 
   SD_select();
 
-  uint8_t stopTran = SD_STOP_DATA_TOKEN; // stop transaction token for CMD25
-  SPI_transmit(&stopTran, sizeof(stopTran));
+  SPI_exchange(SD_STOP_DATA_TOKEN); // stop transaction token for CMD25
 
   // skip one byte before readyng "busy"
   // this is required by the spec and is necessary for some real SD-cards!
-  uint8_t skipByte;
-  SD_read_bytes(&skipByte, sizeof(skipByte));
+  SPI_receive();
 
   r = SD_wait_not_busy();
   if (r != SD_RES_OK)
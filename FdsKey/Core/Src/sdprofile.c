@@ -0,0 +1,105 @@
+#include <string.h>
+#include "sdprofile.h"
+#include "sdcard.h"
+
+static HAL_StatusTypeDef sd_profile_erase()
+{
+  HAL_StatusTypeDef r;
+  FLASH_EraseInitTypeDef erase_init_struct;
+  uint32_t sector_error = 0;
+
+  erase_init_struct.TypeErase = FLASH_TYPEERASE_PAGES;
+  erase_init_struct.Banks = ((SD_PROFILE_FLASH_OFFSET - 0x08000000) / FLASH_BANK_SIZE == 0) ? FLASH_BANK_1 : FLASH_BANK_2;
+  erase_init_struct.Page = ((SD_PROFILE_FLASH_OFFSET - 0x08000000) / FLASH_PAGE_SIZE) % FLASH_PAGE_NB;
+  erase_init_struct.NbPages = 1;
+  r = HAL_FLASHEx_Erase(&erase_init_struct, &sector_error);
+  return r;
+}
+
+static HAL_StatusTypeDef sd_profile_save(SD_PROFILE *profile)
+{
+  HAL_StatusTypeDef r;
+  int i;
+  uint64_t buffer[sizeof(SD_PROFILE) / sizeof(uint64_t) + 1];
+
+  // do not wear flash if nothing changed
+  if (!memcmp((void*)SD_PROFILE_FLASH_OFFSET, profile, sizeof(SD_PROFILE)))
+    return HAL_OK;
+
+  r = HAL_FLASH_Unlock();
+  if (r != HAL_OK) return r;
+  r = sd_profile_erase();
+  if (r != HAL_OK)
+  {
+    HAL_FLASH_Lock();
+    return r;
+  }
+  memset(buffer, 0, sizeof(buffer));
+  memcpy(buffer, profile, sizeof(SD_PROFILE));
+  for (i = 0; i < sizeof(buffer); i += sizeof(uint64_t))
+  {
+    r = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, SD_PROFILE_FLASH_OFFSET + i, buffer[i / sizeof(uint64_t)]);
+    if (r != HAL_OK)
+    {
+      HAL_FLASH_Lock();
+      return r;
+    }
+  }
+  return HAL_FLASH_Lock();
+}
+
+// CID with zeroed padding, so it can be compared as a whole
+static SD_RESULT sd_profile_read_cid(SD_CID *cid)
+{
+  memset(cid, 0, sizeof(SD_CID));
+  return SD_read_CID(cid);
+}
+
+// init SD card using the remembered parameters first, full speed search is the fallback
+SD_RESULT sd_profile_init()
+{
+  SD_RESULT r;
+  SD_PROFILE profile;
+  SD_CID cid;
+
+  memcpy(&profile, (void*)SD_PROFILE_FLASH_OFFSET, sizeof(profile));
+  if (profile.magic == SD_PROFILE_MAGIC)
+  {
+    r = SD_init_at_speed(profile.prescaler, SD_INIT_FAST_TRIES);
+    // card type must match too, otherwise it's another card
+    if ((r == SD_RES_OK)
+        && (SD_get_version() == profile.version)
+        && (SD_is_high_capacity() == profile.high_capacity)
+        && (sd_profile_read_cid(&cid) == SD_RES_OK)
+        && !memcmp(&cid, &profile.cid, sizeof(cid)))
+      return SD_RES_OK;
+  }
+
+  r = SD_init_try_speed();
+  if (r != SD_RES_OK)
+    return r;
+  memset(&profile, 0, sizeof(profile));
+  if (sd_profile_read_cid(&profile.cid) != SD_RES_OK)
+    return SD_RES_OK; // card is working, just nothing to remember
+  profile.magic = SD_PROFILE_MAGIC;
+  profile.prescaler = SD_get_spi_speed();
+  profile.version = SD_get_version();
+  profile.high_capacity = SD_is_high_capacity();
+  // mount must not fail because of flash
+  sd_profile_save(&profile);
+  return SD_RES_OK;
+}
+
+// clear remembered parameters, next init will use full search
+HAL_StatusTypeDef sd_profile_forget()
+{
+  HAL_StatusTypeDef r;
+
+  if (*(uint32_t*)SD_PROFILE_FLASH_OFFSET != SD_PROFILE_MAGIC)
+    return HAL_OK;
+  r = HAL_FLASH_Unlock();
+  if (r != HAL_OK) return r;
+  r = sd_profile_erase();
+  HAL_FLASH_Lock();
+  return r;
+}
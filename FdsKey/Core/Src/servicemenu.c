@@ -9,7 +9,11 @@
 #include "splash.h"
 #include "confirm.h"
 #include "sdcard.h"
+#include "diskio.h"
 #include "blupdater.h"
+#include "perf.h"
+#include "profiler.h"
+#include "defrag.h"
 
 FDSKEY_SERVICE_SETTINGS fdskey_service_settings;
 FDSKEY_HARDWARE_VERSION fdskey_hw_version;
@@ -90,6 +94,7 @@ static void draw_item(uint8_t line, SETTING_ID item, uint8_t is_selected)
   char *value = value_v;
   int l;
   SD_CID cid;
+  const DISK_ERROR_STATS *disk_errors;
 
   switch((int)item)
   {
@@ -193,6 +198,13 @@ static void draw_item(uint8_t line, SETTING_ID item, uint8_t is_selected)
       break;
     }
     break;
+  case SERVICE_SETTING_SD_ERRORS:
+    // retries / reinits / slowdowns / failures
+    parameter_name = "SD errors";
+    disk_errors = disk_get_error_stats();
+    snprintf(value_v, sizeof(value_v), "%lu/%lu/%lu/%lu", (unsigned long)disk_errors->retries, (unsigned long)disk_errors->reinits,
+        (unsigned long)disk_errors->slowdowns, (unsigned long)disk_errors->failures);
+    break;
   case SERVICE_SETTING_SD_MANUFACTURER_ID:
     parameter_name = "SD manufacturer ID";
     sprintf(value_v, "%02X", cid.ManufacturerID);
@@ -227,6 +239,23 @@ static void draw_item(uint8_t line, SETTING_ID item, uint8_t is_selected)
   case SERVICE_SETTING_BL_UPDATE:
     parameter_name = "[ Update bootloader ]";
     break;
+#ifdef PERF_COUNTERS
+  case SERVICE_SETTING_PERF_SAVE:
+    parameter_name = "[ Save perf counters ]";
+    break;
+#endif
+  case SERVICE_SETTING_DEFRAG_REPORT:
+    parameter_name = "[ Fragmentation report ]";
+    break;
+  case SERVICE_SETTING_PROFILER:
+    if (profiler_is_running())
+    {
+      parameter_name = "[ Save profile ]";
+      sprintf(value, "%lu", (unsigned long)profiler_get_samples());
+    } else {
+      parameter_name = "[ Start profiler ]";
+    }
+    break;
   default:
     parameter_name = "[ Save and return ]";
     break;
@@ -269,6 +298,59 @@ static void update_free_space()
   }
 }
 
+#ifdef PERF_COUNTERS
+static void save_perf_counters()
+{
+  FRESULT fr;
+
+  fr = perf_save(PERF_FILE);
+  if (fr != FR_OK)
+  {
+    show_error_screen_fr(fr, 0);
+    return;
+  }
+  perf_reset();
+  show_message("Done!\nSaved to " PERF_FILE, 1);
+}
+#endif
+
+static void toggle_profiler()
+{
+  FRESULT fr;
+
+  if (!profiler_is_running())
+  {
+    profiler_start();
+    show_message("Profiler started", 1);
+    return;
+  }
+  fr = profiler_save(PROFILER_FILE);
+  if (fr != FR_OK)
+  {
+    show_error_screen_fr(fr, 0);
+    return;
+  }
+  show_message("Done!\nSaved to " PROFILER_FILE, 1);
+}
+
+static void show_defrag_report()
+{
+  FRESULT fr;
+  DEFRAG_REPORT report;
+  char text[128];
+
+  show_message("Scanning...", 0);
+  fr = defrag_report(&report);
+  if (fr != FR_OK)
+  {
+    show_error_screen_fr(fr, 0);
+    return;
+  }
+  sprintf(text, "Images: %d\nFragmented: %d (%d frags)\nDefragmented: %lu",
+      report.images, report.fragmented, report.fragments, (unsigned long)report.relocated);
+  show_message(text, 1);
+}
+
 void service_menu()
 {
   int line = 0;
@@ -316,6 +398,7 @@ void service_menu()
       case SERVICE_SETTING_BUILD_TIME:
       case SERVICE_SETTING_BL_COMMIT:
       case SERVICE_SETTING_SD_SPI_SPEED:
+      case SERVICE_SETTING_SD_ERRORS:
       case SERVICE_SETTING_SD_CAPACITY:
       case SERVICE_SETTING_FAT_SIZE:
       case SERVICE_SETTING_FAT_FREE:
@@ -336,6 +419,20 @@ void service_menu()
         update_bootloader();
         draw_all(line, selection);
         break;
+#ifdef PERF_COUNTERS
+      case SERVICE_SETTING_PERF_SAVE:
+        save_perf_counters();
+        draw_all(line, selection);
+        break;
+#endif
+      case SERVICE_SETTING_DEFRAG_REPORT:
+        show_defrag_report();
+        draw_all(line, selection);
+        break;
+      case SERVICE_SETTING_PROFILER:
+        toggle_profiler();
+        draw_all(line, selection);
+        break;
       default:
         service_settings_save();
         return;
@@ -4,6 +4,7 @@
 #include "main.h"
 #include "oled.h"
 #include "buttons.h"
+#include "generation.h"
 
 FDSKEY_SETTINGS fdskey_settings;
 
@@ -68,6 +69,10 @@ HAL_StatusTypeDef settings_save()
     if (r != HAL_OK)
       return r;
   }
+  // boot counter log shares the pages
+  r = generation_store();
+  if (r != HAL_OK)
+    return r;
 
   return HAL_FLASH_Lock();
 }
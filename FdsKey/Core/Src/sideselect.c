@@ -8,6 +8,7 @@
 #include "splash.h"
 #include "buttons.h"
 #include "settings.h"
+#include "blockstore.h"
 
 static void fds_side_draw(uint8_t side, uint8_t side_count, char* game_name, int text_scroll)
 {
@@ -161,14 +162,28 @@ void fds_side_select(char *directory, FILINFO *fno, uint8_t load_first)
   // remove brackets
   text_remove_brackets(game_name);
 
-  if (fno->fsize % FDS_ROM_SIDE_SIZE == FDS_ROM_HEADER_SIZE)
-    fno->fsize -= FDS_ROM_HEADER_SIZE;
-  if (fno->fsize % FDS_ROM_SIDE_SIZE != 0)
+#ifdef BLOCK_STORE
+  if (block_store_is_manifest(fno->fname))
   {
-    show_error_screen_fr(FDSR_INVALID_ROM, 0);
-    return;
+    // sides are listed in the manifest
+    fr = block_store_get_side_count(full_path, &side_count);
+    if (fr != FR_OK)
+    {
+      show_error_screen_fr(fr, 0);
+      return;
+    }
+  } else
+#endif
+  {
+    if (fno->fsize % FDS_ROM_SIDE_SIZE == FDS_ROM_HEADER_SIZE)
+      fno->fsize -= FDS_ROM_HEADER_SIZE;
+    if (fno->fsize % FDS_ROM_SIDE_SIZE != 0)
+    {
+      show_error_screen_fr(FDSR_INVALID_ROM, 0);
+      return;
+    }
+    side_count = fno->fsize / FDS_ROM_SIDE_SIZE;
   }
-  side_count = fno->fsize / FDS_ROM_SIDE_SIZE;
   if (!side_count)
   {
     // empty ROM
@@ -6,6 +6,7 @@
 #include "ff.h"
 #include "fdsemu.h"
 #include "buttons.h"
+#include "sdprofile.h"
 
 void show_message(char *text, uint8_t wait)
 {
@@ -125,5 +126,8 @@ void show_error_screen_sd(SD_RESULT r, uint8_t fatal)
 {
   char text[32];
   sprintf(text, "SD card error %d", r);
+  // remembered parameters may be the reason, do the full search next time
+  if (fatal)
+    sd_profile_forget();
   show_error_screen(text, fatal);
 }
@@ -0,0 +1,10 @@
+#ifndef INC_DELTA_H_
+#define INC_DELTA_H_
+
+#include "main.h"
+#include "fwdelta.h"
+
+uint32_t delta_crc32(uint32_t crc, const uint8_t *data, uint32_t size);
+void delta_update();
+
+#endif /* INC_DELTA_H_ */
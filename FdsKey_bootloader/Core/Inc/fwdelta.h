@@ -0,0 +1,37 @@
+#ifndef INC_FWDELTA_H_
+#define INC_FWDELTA_H_
+
+#include <stdint.h>
+
+// delta update file format, shared with tools/fwdelta, little endian:
+// header, then page records in the order they must be written,
+// every record is followed by its operations, literal operations are followed by data
+#define FWDELTA_FILE "fdskey.dlt"
+#define FWDELTA_MAGIC 0x544C4446 // "FDLT"
+#define FWDELTA_LITERAL 0xFFFFFFFF // operation source for data stored in the file
+
+typedef struct __attribute__((packed))
+{
+  uint32_t magic;
+  uint32_t page_size;
+  uint32_t base_size;   // build which must be in flash now
+  uint32_t base_crc;
+  uint32_t new_size;    // build after update
+  uint32_t new_crc;
+  uint32_t page_count;  // page records
+} FWDELTA_HEADER;
+
+typedef struct __attribute__((packed))
+{
+  uint16_t page;        // page number from the application start
+  uint16_t op_count;
+  uint32_t crc;         // CRC32 of the whole reconstructed page
+} FWDELTA_PAGE;
+
+typedef struct __attribute__((packed))
+{
+  uint32_t src;         // offset in the base build or FWDELTA_LITERAL
+  uint16_t len;
+} FWDELTA_OP;
+
+#endif /* INC_FWDELTA_H_ */
@@ -47,7 +47,7 @@ extern "C" {
 /* USER CODE BEGIN EM */
 #define APP_ADDRESS 0x08020000
 #define FIRMWARE_FILE "fdskey.bin"
-#define FIRMWARE_MAX_SIZE (384 * 1024 - FLASH_PAGE_SIZE * 4)
+#define FIRMWARE_MAX_SIZE (384 * 1024 - FLASH_PAGE_SIZE * 6)
 /* USER CODE END EM */
 
 /* Exported functions prototypes ---------------------------------------------*/
@@ -0,0 +1,142 @@
+#include <string.h>
+#include "delta.h"
+#include "ff.h"
+#include "splash.h"
+
+static uint8_t delta_page[FLASH_PAGE_SIZE] __attribute__((aligned(8)));
+
+// standard CRC32, start with 0
+uint32_t delta_crc32(uint32_t crc, const uint8_t *data, uint32_t size)
+{
+  int i;
+
+  crc = ~crc;
+  while (size--)
+  {
+    crc ^= *data++;
+    for (i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+static void delta_read(FIL *fp, void *buffer, UINT size)
+{
+  FRESULT fr;
+  UINT br;
+
+  fr = f_read(fp, buffer, size, &br);
+  show_error_screen_fr(fr, 1);
+  if (br != size)
+    show_error_screen("Delta file is broken", 1);
+}
+
+// build single page in memory from the base build in flash and literal data
+static void delta_build_page(FIL *fp, FWDELTA_HEADER *header, FWDELTA_PAGE *page)
+{
+  FWDELTA_OP op;
+  int pos = 0, i;
+
+  // data after the end of the build stays erased
+  memset(delta_page, 0xFF, sizeof(delta_page));
+  for (i = 0; i < page->op_count; i++)
+  {
+    delta_read(fp, &op, sizeof(op));
+    if (pos + op.len > FLASH_PAGE_SIZE)
+      show_error_screen("Delta file is broken", 1);
+    if (op.src == FWDELTA_LITERAL)
+    {
+      delta_read(fp, delta_page + pos, op.len);
+    } else {
+      if (op.src + op.len > header->base_size)
+        show_error_screen("Delta file is broken", 1);
+      memcpy(delta_page + pos, (void*)(APP_ADDRESS + op.src), op.len);
+    }
+    pos += op.len;
+  }
+  if (delta_crc32(0, delta_page, FLASH_PAGE_SIZE) != page->crc)
+    show_error_screen("Delta CRC mismatch", 1);
+}
+
+static void delta_write_page(int page)
+{
+  HAL_StatusTypeDef r;
+  FLASH_EraseInitTypeDef erase_init_struct;
+  uint32_t sector_error = 0;
+  uint32_t address = APP_ADDRESS + page * FLASH_PAGE_SIZE;
+  uint64_t data;
+  int i;
+
+  erase_init_struct.TypeErase = FLASH_TYPEERASE_PAGES;
+  erase_init_struct.Banks = ((address - 0x08000000) / FLASH_BANK_SIZE == 0) ? FLASH_BANK_1 : FLASH_BANK_2;
+  erase_init_struct.Page = ((address - 0x08000000) / FLASH_PAGE_SIZE) % FLASH_PAGE_NB;
+  erase_init_struct.NbPages = 1;
+  r = HAL_FLASHEx_Erase(&erase_init_struct, &sector_error);
+  if (r != HAL_OK)
+    show_error_screen("Sector erase error", 1);
+  for (i = 0; i < FLASH_PAGE_SIZE; i += sizeof(uint64_t))
+  {
+    memcpy(&data, delta_page + i, sizeof(data));
+    // already erased
+    if (data == 0xFFFFFFFFFFFFFFFFULL)
+      continue;
+    r = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, address + i, data);
+    if (r != HAL_OK)
+      show_error_screen("Flash writing error", 1);
+  }
+}
+
+// go through all the page records, write them to flash only if write is set,
+// records are ordered by the host tool so every page is built before its sources are overwritten
+static void delta_pass(FIL *fp, FWDELTA_HEADER *header, uint8_t write)
+{
+  FRESULT fr;
+  FWDELTA_PAGE page;
+  int i;
+
+  fr = f_lseek(fp, sizeof(FWDELTA_HEADER));
+  show_error_screen_fr(fr, 1);
+  for (i = 0; i < header->page_count; i++)
+  {
+    delta_read(fp, &page, sizeof(page));
+    if ((page.page + 1) * FLASH_PAGE_SIZE > FIRMWARE_MAX_SIZE)
+      show_error_screen("Delta file is broken", 1);
+    delta_build_page(fp, header, &page);
+    if (write)
+      delta_write_page(page.page);
+  }
+}
+
+// apply FWDELTA_FILE to the current firmware, only changed pages are rewritten,
+// errors are fatal
+void delta_update()
+{
+  FRESULT fr;
+  FIL fp;
+  FWDELTA_HEADER header;
+  HAL_StatusTypeDef r;
+
+  fr = f_open(&fp, FWDELTA_FILE, FA_READ);
+  show_error_screen_fr(fr, 1);
+  delta_read(&fp, &header, sizeof(header));
+  if (header.magic != FWDELTA_MAGIC || header.page_size != FLASH_PAGE_SIZE)
+    show_error_screen("Invalid delta file", 1);
+  if (header.base_size > FIRMWARE_MAX_SIZE || header.new_size > FIRMWARE_MAX_SIZE)
+    show_error_screen("File is too big", 1);
+  // delta is made against the single build
+  if (delta_crc32(0, (uint8_t*)APP_ADDRESS, header.base_size) != header.base_crc)
+    show_error_screen("Wrong base firmware", 1);
+
+  // check everything before the first erase, flash is not touched if file is broken
+  delta_pass(&fp, &header, 0);
+
+  r = HAL_FLASH_Unlock();
+  if (r != HAL_OK)
+    show_error_screen("Flash unlock error", 1);
+  delta_pass(&fp, &header, 1);
+  HAL_FLASH_Lock();
+  f_close(&fp);
+
+  if (delta_crc32(0, (uint8_t*)APP_ADDRESS, header.new_size) != header.new_crc)
+    show_error_screen("Update CRC mismatch", 1);
+}
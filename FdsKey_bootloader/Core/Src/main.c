@@ -28,6 +28,7 @@
 #include "settings.h"
 #include "servicemenu.h"
 #include "confirm.h"
+#include "delta.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -108,6 +109,7 @@ int main(void)
   HAL_StatusTypeDef r;
   FLASH_EraseInitTypeDef erase_init_struct;
   uint32_t sector_error = 0;
+  uint8_t delta = 0;
   /* USER CODE END 1 */
 
   /* MCU Configuration--------------------------------------------------------*/
@@ -162,61 +164,72 @@ int main(void)
   show_error_screen_fr(fr, 1);
 
   fr = f_stat(FIRMWARE_FILE, &fno);
-  if (fr == FR_NO_FILE)
-      show_error_screen(FIRMWARE_FILE " not found", 1);
-  show_error_screen_fr(fr, 1);
-  if (fno.fsize > FIRMWARE_MAX_SIZE)
-    show_error_screen("File is too big", 1);
+  // full image has priority, delta is used only when there is no full image
+  if (fr == FR_NO_FILE && f_stat(FWDELTA_FILE, &fno) == FR_OK)
+  {
+    delta = 1;
+  } else {
+    if (fr == FR_NO_FILE)
+        show_error_screen(FIRMWARE_FILE " not found", 1);
+    show_error_screen_fr(fr, 1);
+    if (fno.fsize > FIRMWARE_MAX_SIZE)
+      show_error_screen("File is too big", 1);
 
-  fr = f_open(&fp, FIRMWARE_FILE, FA_READ);
-  show_error_screen_fr(fr, 1);
+    fr = f_open(&fp, FIRMWARE_FILE, FA_READ);
+    show_error_screen_fr(fr, 1);
+  }
 
   show_updating_screen();
   /* USER CODE END 2 */
 
   /* Infinite loop */
   /* USER CODE BEGIN WHILE */
-  r = HAL_FLASH_Unlock();
-  if (r != HAL_OK)
-    show_error_screen("Flash unlock error", 1);
-  pos = 0;
-  while (1)
+  if (delta)
   {
-    fr = f_read(&fp, buffer, FLASH_PAGE_SIZE, &br);
-    show_error_screen_fr(fr, 1);
-    if (!br) break;
-    erase_init_struct.TypeErase = FLASH_TYPEERASE_PAGES;
-    erase_init_struct.Banks = ((APP_ADDRESS - 0x08000000 + pos) / FLASH_BANK_SIZE == 0) ? FLASH_BANK_1 : FLASH_BANK_2;
-    erase_init_struct.Page = ((APP_ADDRESS - 0x08000000 + pos) / FLASH_PAGE_SIZE) % FLASH_PAGE_NB;
-    erase_init_struct.NbPages = 1;
-    r = HAL_FLASHEx_Erase(&erase_init_struct, &sector_error);
+    delta_update();
+  } else {
+    r = HAL_FLASH_Unlock();
     if (r != HAL_OK)
-      show_error_screen("Sector erase error", 1);
-
-    for (i = 0; i < br; i += sizeof(uint64_t))
+      show_error_screen("Flash unlock error", 1);
+    pos = 0;
+    while (1)
     {
-      r = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, APP_ADDRESS + pos, buffer[i / sizeof(uint64_t)]);
+      fr = f_read(&fp, buffer, FLASH_PAGE_SIZE, &br);
+      show_error_screen_fr(fr, 1);
+      if (!br) break;
+      erase_init_struct.TypeErase = FLASH_TYPEERASE_PAGES;
+      erase_init_struct.Banks = ((APP_ADDRESS - 0x08000000 + pos) / FLASH_BANK_SIZE == 0) ? FLASH_BANK_1 : FLASH_BANK_2;
+      erase_init_struct.Page = ((APP_ADDRESS - 0x08000000 + pos) / FLASH_PAGE_SIZE) % FLASH_PAGE_NB;
+      erase_init_struct.NbPages = 1;
+      r = HAL_FLASHEx_Erase(&erase_init_struct, &sector_error);
       if (r != HAL_OK)
-        show_error_screen("Flash writing error", 1);
-      pos += sizeof(uint64_t);
+        show_error_screen("Sector erase error", 1);
+
+      for (i = 0; i < br; i += sizeof(uint64_t))
+      {
+        r = HAL_FLASH_Program(FLASH_TYPEPROGRAM_DOUBLEWORD, APP_ADDRESS + pos, buffer[i / sizeof(uint64_t)]);
+        if (r != HAL_OK)
+          show_error_screen("Flash writing error", 1);
+        pos += sizeof(uint64_t);
+      }
+      /* USER CODE END WHILE */
+
+      /* USER CODE BEGIN 3 */
     }
-    /* USER CODE END WHILE */
-
-    /* USER CODE BEGIN 3 */
+    HAL_FLASH_Lock();
+    f_close(&fp);
   }
-  HAL_FLASH_Lock();
-  f_close(&fp);
   show_message("Firmware updated", 0);
   HAL_Delay(1500);
 
-  if (confirm("Delete " FIRMWARE_FILE "?"))
+  if (confirm(delta ? "Delete " FWDELTA_FILE "?" : "Delete " FIRMWARE_FILE "?"))
   {
     // clear screen
     oled_draw_rectangle(0, oled_get_line() + OLED_HEIGHT, OLED_WIDTH - 1, oled_get_line() + OLED_HEIGHT + OLED_HEIGHT - 1, 1, 0);
     oled_update_invisible();
     oled_switch_to_invisible();
     // delete file
-    fr = f_unlink(FIRMWARE_FILE);
+    fr = f_unlink(delta ? FWDELTA_FILE : FIRMWARE_FILE);
     show_error_screen_fr(fr, 1);
   }
 
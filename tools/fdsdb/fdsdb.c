@@ -0,0 +1,92 @@
+// Known-good dump database generator for the FdsKey side verification.
+// Usage: fdsdb <image.fds> [...] >> fdsdumps.txt
+// Prints one line per side: disk ID, CRC32 of the block data and the file name.
+// Must match dumpcheck.h: ID is bytes 0x0F-0x16 of the disk info block,
+// CRC32 is calculated over all the valid blocks, zero padding is not included.
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ROM_HEADER_SIZE 16
+#define ROM_SIDE_SIZE 65500
+#define ID_OFFSET 0x0F
+#define ID_SIZE 8
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, uint32_t size)
+{
+  int i;
+
+  crc = ~crc;
+  while (size--)
+  {
+    crc ^= *data++;
+    for (i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+// size of the block data at the position, 0 if there is no valid block
+static uint32_t block_size(const uint8_t *side, uint32_t pos, int i)
+{
+  uint32_t size;
+
+  if (i == 0)
+    size = (side[pos] == 1) ? 56 : 0;
+  else if (i == 1)
+    size = (side[pos] == 2) ? 2 : 0;
+  else if (i % 2 == 0)
+    size = (side[pos] == 3) ? 16 : 0;
+  else
+    size = (side[pos] == 4) ? 1 + (side[pos - 16 + 13] | (side[pos - 16 + 14] << 8)) : 0;
+  return (pos + size <= ROM_SIDE_SIZE) ? size : 0;
+}
+
+static int process(const char *filename)
+{
+  FILE *f;
+  uint8_t side[ROM_SIDE_SIZE];
+  uint8_t header[ROM_HEADER_SIZE];
+  uint32_t pos, size, crc;
+  int s, i, j;
+
+  f = fopen(filename, "rb");
+  if (!f)
+  {
+    perror(filename);
+    return 1;
+  }
+  // header is optional
+  if (fread(header, 1, sizeof(header), f) != sizeof(header) || memcmp(header, "FDS\x1A", 4) != 0)
+    fseek(f, 0, SEEK_SET);
+  for (s = 0; fread(side, 1, sizeof(side), f) == sizeof(side); s++)
+  {
+    crc = 0;
+    for (i = 0, pos = 0; (size = block_size(side, pos, i)); i++, pos += size)
+      crc = crc32(crc, side + pos, size);
+    if (!i)
+    {
+      fprintf(stderr, "%s: side %d is not valid\n", filename, s);
+      continue;
+    }
+    for (j = 0; j < ID_SIZE; j++)
+      printf("%02X", side[ID_OFFSET + j]);
+    printf(" %08X %s side %d\n", crc, filename, s);
+  }
+  fclose(f);
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  int i, r = 0;
+
+  if (argc < 2)
+  {
+    fprintf(stderr, "Usage: %s <image.fds> [...] >> fdsdumps.txt\n", argv[0]);
+    return 1;
+  }
+  for (i = 1; i < argc; i++)
+    r |= process(argv[i]);
+  return r;
+}
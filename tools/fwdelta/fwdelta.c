@@ -0,0 +1,278 @@
+// Delta update generator for the FdsKey bootloader.
+// Usage: fwdelta <base.bin> <new.bin> <output.dlt>
+// Only changed pages are stored. Every page is built from pieces of the base build
+// which is still in flash and literal data, pages are ordered so a page is never
+// used as a source after it was rewritten.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "fwdelta.h"
+
+#define PAGE_SIZE 2048
+#define MAX_SIZE (384 * 1024)
+#define MIN_MATCH 8
+#define HASH_BITS 16
+#define MAX_CHAIN 512
+
+typedef struct
+{
+  uint8_t *data;
+  size_t size;
+  size_t len;
+} BUFFER;
+
+static uint8_t base[MAX_SIZE];
+static uint8_t new[MAX_SIZE];
+static uint32_t base_size, new_size;
+static int32_t hash_head[1 << HASH_BITS];
+static int32_t hash_prev[MAX_SIZE];
+static uint8_t written[MAX_SIZE / PAGE_SIZE];
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, uint32_t size)
+{
+  int i;
+
+  crc = ~crc;
+  while (size--)
+  {
+    crc ^= *data++;
+    for (i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+static void put(BUFFER *b, const void *data, size_t len)
+{
+  if (b->len + len > b->size)
+  {
+    b->size = (b->len + len) * 2;
+    b->data = realloc(b->data, b->size);
+    if (!b->data)
+    {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+  }
+  memcpy(b->data + b->len, data, len);
+  b->len += len;
+}
+
+static uint32_t load(const char *filename, uint8_t *data)
+{
+  FILE *f;
+  size_t size;
+
+  f = fopen(filename, "rb");
+  if (!f)
+  {
+    perror(filename);
+    exit(1);
+  }
+  size = fread(data, 1, MAX_SIZE, f);
+  if (!feof(f) || ferror(f))
+  {
+    fprintf(stderr, "%s: file is too big\n", filename);
+    exit(1);
+  }
+  fclose(f);
+  return size;
+}
+
+static uint32_t hash(const uint8_t *p)
+{
+  uint32_t h = 0;
+  int i;
+
+  for (i = 0; i < MIN_MATCH; i++)
+    h = h * 0x9E3779B1 + p[i];
+  return h >> (32 - HASH_BITS);
+}
+
+// index all base positions, newest first
+static void index_base()
+{
+  uint32_t i, h;
+
+  memset(hash_head, 0xFF, sizeof(hash_head));
+  for (i = 0; i + MIN_MATCH <= base_size; i++)
+  {
+    h = hash(base + i);
+    hash_prev[i] = hash_head[h];
+    hash_head[h] = i;
+  }
+}
+
+// page content after the update, erased flash after the end of the build
+static void new_page(int page, uint8_t *out)
+{
+  uint32_t start = page * PAGE_SIZE;
+
+  memset(out, 0xFF, PAGE_SIZE);
+  if (start < new_size)
+    memcpy(out, new + start, (new_size - start < PAGE_SIZE) ? new_size - start : PAGE_SIZE);
+}
+
+// page is not changed only if it's fully inside the base build
+static int page_changed(int page)
+{
+  uint8_t data[PAGE_SIZE];
+  uint32_t start = page * PAGE_SIZE;
+  uint32_t i;
+
+  new_page(page, data);
+  for (i = 0; i < PAGE_SIZE; i++)
+  {
+    if (start + i < base_size)
+    {
+      if (base[start + i] != data[i])
+        return 1;
+    } else if (data[i] != 0xFF)
+      return 1;
+  }
+  // tail of the last page is erased by the previous update
+  return start >= ((base_size + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+}
+
+// length of the match which doesn't touch rewritten pages
+static uint32_t match_length(uint32_t src, const uint8_t *data, uint32_t len)
+{
+  uint32_t l = 0;
+
+  while (l < len && src + l < base_size
+      && !written[(src + l) / PAGE_SIZE] && base[src + l] == data[l])
+    l++;
+  return l;
+}
+
+static void put_op(BUFFER *b, int *op_count, uint32_t src, const uint8_t *data, uint32_t len)
+{
+  FWDELTA_OP op;
+
+  op.src = src;
+  op.len = len;
+  put(b, &op, sizeof(op));
+  if (src == FWDELTA_LITERAL)
+    put(b, data, len);
+  (*op_count)++;
+}
+
+// encode single page, the page itself may be used as a source, it's in RAM while flashing
+static void encode_page(BUFFER *b, int page)
+{
+  uint8_t data[PAGE_SIZE];
+  FWDELTA_PAGE record;
+  size_t record_pos = b->len;
+  uint32_t end, pos, literal, best_len, best_src, l;
+  int32_t s;
+  int chain, op_count = 0;
+
+  new_page(page, data);
+  record.page = page;
+  record.op_count = 0;
+  record.crc = crc32(0, data, PAGE_SIZE);
+  put(b, &record, sizeof(record));
+
+  // erased tail is not stored
+  for (end = PAGE_SIZE; end && data[end - 1] == 0xFF; end--);
+  pos = literal = 0;
+  while (pos < end)
+  {
+    best_len = best_src = 0;
+    if (end - pos >= MIN_MATCH)
+    {
+      for (s = hash_head[hash(data + pos)], chain = 0; s >= 0 && chain < MAX_CHAIN; s = hash_prev[s], chain++)
+      {
+        l = match_length(s, data + pos, end - pos);
+        if (l > best_len)
+        {
+          best_len = l;
+          best_src = s;
+          if (l == end - pos) break;
+        }
+      }
+    }
+    if (best_len >= MIN_MATCH)
+    {
+      if (pos > literal)
+        put_op(b, &op_count, FWDELTA_LITERAL, data + literal, pos - literal);
+      put_op(b, &op_count, best_src, NULL, best_len);
+      pos += best_len;
+      literal = pos;
+    } else {
+      pos++;
+    }
+  }
+  if (pos > literal)
+    put_op(b, &op_count, FWDELTA_LITERAL, data + literal, pos - literal);
+  record.op_count = op_count;
+  memcpy(b->data + record_pos, &record, sizeof(record));
+}
+
+// encode all changed pages in the given direction
+static uint32_t encode(BUFFER *b, int page_count, int descending)
+{
+  int i, page;
+  uint32_t count = 0;
+
+  memset(written, 0, sizeof(written));
+  for (i = 0; i < page_count; i++)
+  {
+    page = descending ? page_count - 1 - i : i;
+    if (!page_changed(page))
+      continue;
+    encode_page(b, page);
+    written[page] = 1;
+    count++;
+  }
+  return count;
+}
+
+int main(int argc, char **argv)
+{
+  FILE *f;
+  FWDELTA_HEADER header;
+  BUFFER up = {0}, down = {0}, *best;
+  uint32_t up_count, down_count;
+  int page_count;
+
+  if (argc != 4)
+  {
+    fprintf(stderr, "Usage: %s <base.bin> <new.bin> <output.dlt>\n", argv[0]);
+    return 1;
+  }
+  base_size = load(argv[1], base);
+  new_size = load(argv[2], new);
+  page_count = (new_size + PAGE_SIZE - 1) / PAGE_SIZE;
+  index_base();
+
+  up_count = encode(&up, page_count, 0);
+  down_count = encode(&down, page_count, 1);
+  best = (down.len < up.len) ? &down : &up;
+
+  header.magic = FWDELTA_MAGIC;
+  header.page_size = PAGE_SIZE;
+  header.base_size = base_size;
+  header.base_crc = crc32(0, base, base_size);
+  header.new_size = new_size;
+  header.new_crc = crc32(0, new, new_size);
+  header.page_count = (best == &down) ? down_count : up_count;
+
+  f = fopen(argv[3], "wb");
+  if (!f)
+  {
+    perror(argv[3]);
+    return 1;
+  }
+  if (fwrite(&header, sizeof(header), 1, f) != 1
+      || (best->len && fwrite(best->data, best->len, 1, f) != 1)
+      || fclose(f))
+  {
+    perror(argv[3]);
+    return 1;
+  }
+  printf("%u of %d pages changed, %lu bytes (%s order)\n", header.page_count, page_count,
+      (unsigned long)(sizeof(header) + best->len), (best == &down) ? "descending" : "ascending");
+  return 0;
+}
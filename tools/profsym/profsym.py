@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+# resolve profile.txt written by the on-device sampling profiler against the firmware ELF
+# usage: profsym.py FdsKey.elf profile.txt [-n top] [--callers]
+
+import argparse
+import bisect
+import subprocess
+import sys
+
+
+def load_symbols(elf, nm):
+    out = subprocess.run([nm, "-n", "-S", "--defined-only", elf],
+                         check=True, capture_output=True, text=True).stdout
+    starts, ends, names = [], [], []
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) != 4 or parts[2] not in "tTwW":
+            continue
+        addr = int(parts[0], 16) & ~1
+        size = int(parts[1], 16)
+        starts.append(addr)
+        ends.append(addr + size)
+        names.append(parts[3])
+    return starts, ends, names
+
+
+def resolve(symbols, addr):
+    starts, ends, names = symbols
+    addr &= ~1
+    i = bisect.bisect_right(starts, addr) - 1
+    if i >= 0 and addr < ends[i]:
+        return names[i]
+    return "0x%08X" % addr
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("elf")
+    parser.add_argument("profile")
+    parser.add_argument("-n", "--top", type=int, default=30)
+    parser.add_argument("--callers", action="store_true",
+                        help="also group by the function that LR points into")
+    parser.add_argument("--nm", default="arm-none-eabi-nm")
+    args = parser.parse_args()
+
+    symbols = load_symbols(args.elf, args.nm)
+    total = 0
+    header = ""
+    functions = {}
+    pairs = {}
+    with open(args.profile) as f:
+        for line in f:
+            line = line.strip()
+            if not line:
+                continue
+            if line.startswith("#"):
+                header = line[1:].strip()
+                continue
+            pc, lr, count = line.split()
+            count = int(count)
+            total += count
+            func = resolve(symbols, int(pc, 16))
+            functions[func] = functions.get(func, 0) + count
+            if args.callers:
+                key = (func, resolve(symbols, int(lr, 16)))
+                pairs[key] = pairs.get(key, 0) + count
+
+    if not total:
+        sys.exit("profile is empty")
+    print(header)
+    for func, count in sorted(functions.items(), key=lambda x: -x[1])[:args.top]:
+        print("%6.2f%% %8d  %s" % (count * 100.0 / total, count, func))
+    if args.callers:
+        print()
+        for (func, caller), count in sorted(pairs.items(), key=lambda x: -x[1])[:args.top]:
+            print("%6.2f%% %8d  %s <- %s" % (count * 100.0 / total, count, func, caller))
+
+
+if __name__ == "__main__":
+    main()
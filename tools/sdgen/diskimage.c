@@ -0,0 +1,88 @@
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <unistd.h>
+#include "ff.h"
+#include "diskio.h"
+
+// FatFs disk I/O backed by the image file
+
+static FILE *disk_image = NULL;
+static LBA_t disk_image_sectors = 0;
+
+// create sparse image file of the given size
+int disk_image_create(const char *path, LBA_t sectors)
+{
+  disk_image = fopen(path, "w+b");
+  if (!disk_image)
+    return -1;
+  if (ftruncate(fileno(disk_image), (off_t)sectors * FF_MIN_SS) != 0)
+  {
+    fclose(disk_image);
+    disk_image = NULL;
+    return -1;
+  }
+  disk_image_sectors = sectors;
+  return 0;
+}
+
+int disk_image_close()
+{
+  int r = fclose(disk_image);
+  disk_image = NULL;
+  return r;
+}
+
+DSTATUS disk_initialize(BYTE pdrv)
+{
+  return disk_status(pdrv);
+}
+
+DSTATUS disk_status(BYTE pdrv)
+{
+  return (pdrv || !disk_image) ? STA_NOINIT : 0;
+}
+
+DRESULT disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count)
+{
+  if (pdrv || !disk_image || sector + count > disk_image_sectors)
+    return RES_PARERR;
+  if (fseeko(disk_image, (off_t)sector * FF_MIN_SS, SEEK_SET) != 0
+      || fread(buff, FF_MIN_SS, count, disk_image) != count)
+    return RES_ERROR;
+  return RES_OK;
+}
+
+DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count)
+{
+  if (pdrv || !disk_image || sector + count > disk_image_sectors)
+    return RES_PARERR;
+  if (fseeko(disk_image, (off_t)sector * FF_MIN_SS, SEEK_SET) != 0
+      || fwrite(buff, FF_MIN_SS, count, disk_image) != count)
+    return RES_ERROR;
+  return RES_OK;
+}
+
+DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff)
+{
+  if (pdrv || !disk_image)
+    return RES_NOTRDY;
+  switch (cmd)
+  {
+  case CTRL_SYNC:
+    return fflush(disk_image) == 0 ? RES_OK : RES_ERROR;
+  case GET_SECTOR_COUNT:
+    *(LBA_t*)buff = disk_image_sectors;
+    return RES_OK;
+  case GET_BLOCK_SIZE:
+    *(DWORD*)buff = 1;
+    return RES_OK;
+  default:
+    return RES_PARERR;
+  }
+}
+
+// fixed timestamp, so images are reproducible
+DWORD get_fattime()
+{
+  return ((DWORD)(2022 - 1980) << 25) | ((DWORD)1 << 21) | ((DWORD)1 << 16);
+}
@@ -0,0 +1,7 @@
+#ifndef __SDCARD_H__
+#define __SDCARD_H__
+
+// host replacement of the firmware SD card header, ffconf.h needs only the block size
+#define SD_BLOCK_LENGTH               512
+
+#endif // __SDCARD_H__
@@ -0,0 +1,400 @@
+// Synthetic SD card image generator for FdsKey benchmarks.
+// It uses the firmware FatFs with the same ffconf.h, so the file system
+// is created and filled exactly the way the device would see it.
+#define _FILE_OFFSET_BITS 64
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "ff.h"
+#include "diskio.h"
+
+#define FDS_ROM_HEADER_SIZE 16
+#define FDS_ROM_SIDE_SIZE 65500
+#define FDS_MAX_FILES 6
+#define FDS_MIN_FILE_SIZE 256
+#define FDS_MAX_FILE_SIZE 8192
+#define MAX_SIDES 8
+#define FILLER_NAME "~filler.tmp"
+#define MAX_PATH_LENGTH 1024
+
+int disk_image_create(const char *path, LBA_t sectors);
+int disk_image_close();
+
+typedef struct
+{
+  int min;
+  int max;
+} RANGE;
+
+typedef struct
+{
+  const char *output;
+  unsigned long size_mb;
+  BYTE fs_type;
+  DWORD cluster_size;
+  int depth;
+  int subfolders;
+  RANGE files;
+  RANGE name_length;
+  int cyrillic_percent;
+  int fragmentation_percent;
+  RANGE sides;
+  unsigned long seed;
+} OPTIONS;
+
+typedef struct
+{
+  unsigned long folders;
+  unsigned long files;
+  unsigned long long bytes;
+  unsigned long filler_clusters;
+} STATS;
+
+static OPTIONS opt = {
+  .output = NULL,
+  .size_mb = 1024,
+  .fs_type = FM_FAT32,
+  .cluster_size = 0,
+  .depth = 2,
+  .subfolders = 3,
+  .files = { 10, 100 },
+  .name_length = { 8, 40 },
+  .cyrillic_percent = 0,
+  .fragmentation_percent = 0,
+  .sides = { 1, 2 },
+  .seed = 1
+};
+static STATS stats;
+static FATFS fs;
+static uint32_t rng_state;
+static BYTE cluster_buffer[FF_MIN_SS * 128];
+static BYTE rom_buffer[FDS_ROM_HEADER_SIZE + FDS_ROM_SIDE_SIZE * MAX_SIDES];
+
+// xorshift32, the same seed gives the same image
+static uint32_t rng()
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return rng_state;
+}
+
+static int rng_range(RANGE r)
+{
+  return r.min + (int)(rng() % (uint32_t)(r.max - r.min + 1));
+}
+
+static int rng_percent(int percent)
+{
+  return (int)(rng() % 100) < percent;
+}
+
+// random name with the index at the end, so names in the folder are unique,
+// characters are in the firmware codepage (cp866)
+static void make_name(char *out, int index, const char *ext)
+{
+  static const char ascii[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789 -_()[]!&',";
+  char suffix[16];
+  int cyrillic = rng_percent(opt.cyrillic_percent);
+  int length = rng_range(opt.name_length);
+  int suffix_length = sprintf(suffix, "%d", index);
+  int i;
+  uint8_t c;
+
+  if (length < suffix_length + 1)
+    length = suffix_length + 1;
+  for (i = 0; i < length - suffix_length; i++)
+  {
+    if (cyrillic && (rng() % 4 != 0))
+    {
+      // А-Я, а-п, р-я
+      c = rng() % 64;
+      c = c < 48 ? 0x80 + c : 0xE0 + (c - 48);
+    } else {
+      c = ascii[rng() % (sizeof(ascii) - 1)];
+    }
+    // file system strips leading spaces
+    if (i == 0 && c == ' ')
+      c = '_';
+    out[i] = c;
+  }
+  strcpy(out + i, suffix);
+  strcat(out, ext);
+}
+
+// valid image: disk info, file amount, then file header and data pairs on every side
+static int make_rom(int side_count)
+{
+  int side, file, file_count, pos, size, i;
+  BYTE *rom = rom_buffer;
+  BYTE *s;
+
+  memset(rom_buffer, 0, sizeof(rom_buffer));
+  memcpy(rom, "FDS\x1a", 4);
+  rom[4] = side_count;
+  for (side = 0; side < side_count; side++)
+  {
+    s = rom + FDS_ROM_HEADER_SIZE + side * FDS_ROM_SIDE_SIZE;
+    // disk info block
+    s[0] = 1;
+    memcpy(s + 1, "*NINTENDO-HVC*", 14);
+    s[15] = 0xFF; // manufacturer
+    for (i = 0; i < 3; i++)
+      s[16 + i] = 'A' + rng() % 26;
+    s[19] = ' ';
+    s[21] = side & 1;
+    s[22] = side / 2;
+    pos = 56;
+    // file amount block
+    file_count = 1 + rng() % FDS_MAX_FILES;
+    s[pos] = 2;
+    s[pos + 1] = file_count;
+    pos += 2;
+    for (file = 0; file < file_count; file++)
+    {
+      size = FDS_MIN_FILE_SIZE + rng() % (FDS_MAX_FILE_SIZE - FDS_MIN_FILE_SIZE + 1);
+      if (pos + 16 + 1 + size > FDS_ROM_SIDE_SIZE)
+      {
+        s[57] = file;
+        break;
+      }
+      // file header block
+      s[pos] = 3;
+      s[pos + 1] = file;
+      s[pos + 2] = file;
+      sprintf((char*)s + pos + 3, "FILE%04d", file);
+      s[pos + 11] = 0x00;
+      s[pos + 12] = 0x60;
+      s[pos + 13] = size & 0xFF;
+      s[pos + 14] = (size >> 8) & 0xFF;
+      s[pos + 15] = 0; // PRG
+      pos += 16;
+      // file data block
+      s[pos] = 4;
+      for (i = 1; i <= size; i++)
+        s[pos + i] = rng();
+      pos += 1 + size;
+    }
+  }
+  return FDS_ROM_HEADER_SIZE + side_count * FDS_ROM_SIDE_SIZE;
+}
+
+// write file by clusters, random filler clusters between them fragment the free space
+static FRESULT write_image(const char *path, FIL *filler, const char *filler_path, int *filler_open)
+{
+  FRESULT fr;
+  FIL fp;
+  UINT bw;
+  int size = make_rom(rng_range(opt.sides));
+  int cluster = fs.csize * FF_MIN_SS;
+  int pos, l;
+
+  fr = f_open(&fp, path, FA_CREATE_NEW | FA_WRITE);
+  if (fr != FR_OK)
+    return fr;
+  for (pos = 0; pos < size; pos += l)
+  {
+    l = size - pos < cluster ? size - pos : cluster;
+    fr = f_write(&fp, rom_buffer + pos, l, &bw);
+    if (fr == FR_OK && bw != l)
+      fr = FR_DENIED;
+    if (fr == FR_OK && rng_percent(opt.fragmentation_percent))
+    {
+      // next cluster of the image will not be contiguous
+      if (!*filler_open)
+      {
+        fr = f_open(filler, filler_path, FA_CREATE_ALWAYS | FA_WRITE);
+        *filler_open = fr == FR_OK;
+      }
+      if (fr == FR_OK)
+        fr = f_write(filler, cluster_buffer, cluster, &bw);
+      if (fr == FR_OK && bw != cluster)
+        fr = FR_DENIED;
+      stats.filler_clusters++;
+    }
+    if (fr != FR_OK)
+    {
+      f_close(&fp);
+      return fr;
+    }
+  }
+  stats.files++;
+  stats.bytes += size;
+  return f_close(&fp);
+}
+
+// fill folder with images and subfolders
+static FRESULT fill_folder(char *path, int level)
+{
+  FRESULT fr = FR_OK;
+  FIL filler;
+  int filler_open = 0;
+  int file_count = rng_range(opt.files);
+  int i;
+  int l = strlen(path);
+  char name[FF_MAX_LFN + 1];
+  char filler_path[MAX_PATH_LENGTH];
+
+  sprintf(filler_path, "%s/" FILLER_NAME, path);
+  for (i = 0; i < file_count; i++)
+  {
+    make_name(name, i, ".fds");
+    if (l + 1 + strlen(name) + 1 > MAX_PATH_LENGTH)
+      continue;
+    path[l] = '/';
+    strcpy(path + l + 1, name);
+    fr = write_image(path, &filler, filler_path, &filler_open);
+    if (fr != FR_OK)
+      fprintf(stderr, "can't write %s: %d\n", path, fr);
+    path[l] = 0;
+    if (fr != FR_OK)
+      break;
+  }
+  // free filler clusters become holes for the next files
+  if (filler_open)
+  {
+    f_close(&filler);
+    if (fr == FR_OK)
+      fr = f_unlink(filler_path);
+  }
+  if (fr != FR_OK)
+    return fr;
+  stats.folders++;
+
+  if (level >= opt.depth)
+    return FR_OK;
+  for (i = 0; i < opt.subfolders; i++)
+  {
+    make_name(name, i, "");
+    if (l + 1 + strlen(name) + 1 > MAX_PATH_LENGTH)
+      continue;
+    path[l] = '/';
+    strcpy(path + l + 1, name);
+    fr = f_mkdir(path);
+    if (fr != FR_OK)
+      fprintf(stderr, "can't create %s: %d\n", path, fr);
+    else
+      fr = fill_folder(path, level + 1);
+    path[l] = 0;
+    if (fr != FR_OK)
+      return fr;
+  }
+  return FR_OK;
+}
+
+static int parse_range(const char *s, RANGE *r, int min, int max)
+{
+  char *end;
+
+  r->min = strtol(s, &end, 10);
+  r->max = (*end == '-') ? strtol(end + 1, &end, 10) : r->min;
+  return *end == 0 && r->min >= min && r->max >= r->min && r->max <= max ? 0 : -1;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+      "Usage: %s -o image [options]\n"
+      "  -o FILE      output image file\n"
+      "  -s MB        image size, default 1024\n"
+      "  -t TYPE      fat32 or exfat, default fat32\n"
+      "  -a BYTES     cluster size, default is chosen by f_mkfs()\n"
+      "  -d N         folder depth, default 2\n"
+      "  -D N         subfolders per folder, default 3\n"
+      "  -f MIN[-MAX] images per folder, default 10-100\n"
+      "  -n MIN[-MAX] name length, default 8-40\n"
+      "  -c PERCENT   names with cyrillic characters, default 0\n"
+      "  -g PERCENT   chance of the free space gap after every image cluster, default 0\n"
+      "  -S MIN[-MAX] sides per image, default 1-2\n"
+      "  -r SEED      random seed, default 1\n",
+      name);
+}
+
+int main(int argc, char **argv)
+{
+  FRESULT fr;
+  MKFS_PARM mkfs;
+  BYTE work[FF_MAX_SS * 64];
+  char path[MAX_PATH_LENGTH] = "";
+  int c;
+
+  while ((c = getopt(argc, argv, "o:s:t:a:d:D:f:n:c:g:S:r:h")) != -1)
+  {
+    switch (c)
+    {
+    case 'o': opt.output = optarg; break;
+    case 's': opt.size_mb = strtoul(optarg, NULL, 10); break;
+    case 't':
+      if (!strcmp(optarg, "fat32"))
+        opt.fs_type = FM_FAT32;
+      else if (!strcmp(optarg, "exfat"))
+        opt.fs_type = FM_EXFAT;
+      else
+      {
+        usage(argv[0]);
+        return 1;
+      }
+      break;
+    case 'a': opt.cluster_size = strtoul(optarg, NULL, 10); break;
+    case 'd': opt.depth = atoi(optarg); break;
+    case 'D': opt.subfolders = atoi(optarg); break;
+    case 'f':
+      if (parse_range(optarg, &opt.files, 0, 65535) != 0) { usage(argv[0]); return 1; }
+      break;
+    case 'n':
+      if (parse_range(optarg, &opt.name_length, 1, 200) != 0) { usage(argv[0]); return 1; }
+      break;
+    case 'c': opt.cyrillic_percent = atoi(optarg); break;
+    case 'g': opt.fragmentation_percent = atoi(optarg); break;
+    case 'S':
+      if (parse_range(optarg, &opt.sides, 1, MAX_SIDES) != 0) { usage(argv[0]); return 1; }
+      break;
+    case 'r': opt.seed = strtoul(optarg, NULL, 10); break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!opt.output || !opt.size_mb)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+  rng_state = opt.seed ? opt.seed : 1;
+
+  if (disk_image_create(opt.output, (LBA_t)opt.size_mb * 1024 * 1024 / FF_MIN_SS) != 0)
+  {
+    perror(opt.output);
+    return 1;
+  }
+  memset(&mkfs, 0, sizeof(mkfs));
+  mkfs.fmt = opt.fs_type;
+  mkfs.au_size = opt.cluster_size;
+  fr = f_mkfs("", &mkfs, work, sizeof(work));
+  if (fr != FR_OK)
+  {
+    fprintf(stderr, "f_mkfs() failed: %d\n", fr);
+    return 1;
+  }
+  fr = f_mount(&fs, "", 1);
+  if (fr != FR_OK)
+  {
+    fprintf(stderr, "f_mount() failed: %d\n", fr);
+    return 1;
+  }
+  memset(cluster_buffer, 0xFF, sizeof(cluster_buffer));
+  if (fs.csize * FF_MIN_SS > sizeof(cluster_buffer))
+  {
+    fprintf(stderr, "cluster is too large\n");
+    return 1;
+  }
+
+  fr = fill_folder(path, 0);
+  f_mount(NULL, "", 0);
+  disk_image_close();
+  printf("%s: %s, %lu bytes per cluster, %lu folders, %lu images, %llu bytes, %lu gap clusters\n",
+      opt.output, opt.fs_type == FM_EXFAT ? "exFAT" : "FAT32", (unsigned long)fs.csize * FF_MIN_SS,
+      stats.folders, stats.files, stats.bytes, stats.filler_clusters);
+  return fr == FR_OK ? 0 : 1;
+}